@@ -0,0 +1,84 @@
+/**
+ * Scratch bufs on the system allocator versus an arena: many short lived
+ * bufs grown by small puts, mixed with a few long lived ones, as buffers
+ * being formatted among others being kept. Prints throughput and peak
+ * rss of one mode per run, link another malloc to compare it:
+ *
+ *   make bench-alloc
+ *   make bench-alloc ALLOC_LIBS=-ljemalloc
+ *   make bench-alloc ALLOC_LIBS=-lmimalloc
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "buf.h"
+
+#define ROUNDS 200000
+#define SCRATCH 16      /* short lived bufs per round */
+#define KEPT 1024       /* long lived bufs, one replaced per round */
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool arena_mode = argc > 1 && strcmp(argv[1], "arena") == 0;
+    buf_arena_t *arena = buf_arena_new(64 * 1024);
+    buf_allocator_t *allocator = arena_mode ?
+        &arena->allocator : &buf_system_allocator;
+    buf_t *kept[KEPT] = {NULL};
+    uint8_t chunk[64];
+    size_t total = 0;
+    unsigned seed = 1;
+    int round, i, j;
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    double start = now();
+
+    for (round = 0; round < ROUNDS; round++) {
+        buf_t *scratch[SCRATCH];
+
+        for (i = 0; i < SCRATCH; i++) {
+            scratch[i] = buf_new_with(32, allocator);
+            seed = seed * 1103515245 + 12345;
+
+            for (j = (seed >> 16) % 32; j >= 0; j--)
+                buf_put(scratch[i], chunk, 1 + (seed >> 8) % 64);
+            total += scratch[i]->size;
+        }
+
+        for (i = 0; i < SCRATCH; i++)
+            buf_free(scratch[i]);
+        if (arena_mode)
+            buf_arena_reset(arena);
+
+        // long lived bufs always on the system allocator
+        i = (seed >> 4) % KEPT;
+        buf_free(kept[i]);
+        kept[i] = buf_new(256);
+        buf_put(kept[i], chunk, 1 + seed % 4096 / 64 * 64);
+    }
+
+    double elapsed = now() - start;
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-7s %8.2f M bufs/s, %8.2f GB/s, max rss %ld KB\n",
+            arena_mode ? "arena" : "system",
+            (double)ROUNDS * SCRATCH / elapsed / 1e6,
+            (double)total / elapsed / 1e9, usage.ru_maxrss);
+
+    for (i = 0; i < KEPT; i++)
+        buf_free(kept[i]);
+    buf_arena_free(arena);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * Contention benchmark: threads appending to one buf with a mutex around
+ * buf_put, versus buf_append_put. A reader drains sealed slots.
+ *
+ *   make bench-append
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "buf.h"
+
+#define PUTS 1000000
+#define RECORD 64
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static buf_t *shared;
+static buf_append_t *ap;
+static int done;
+static size_t puts_per_thread;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+put_mutex(void *arg)
+{
+    uint8_t rec[RECORD] = {0};
+    size_t i;
+    (void)arg;
+
+    for (i = 0; i < puts_per_thread; i++) {
+        pthread_mutex_lock(&lock);
+        if (buf_put(shared, rec, RECORD) != BUF_OK)
+            shared->size = 0;  // full, drop as a reader would
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static void *
+put_append(void *arg)
+{
+    uint8_t rec[RECORD] = {0};
+    size_t i;
+    (void)arg;
+
+    for (i = 0; i < puts_per_thread; i++)
+        while (buf_append_put(ap, rec, RECORD) != BUF_OK)
+            sched_yield();
+    return NULL;
+}
+
+static void *
+drain(void *arg)
+{
+    buf_t *buf = buf_new(1024);
+    (void)arg;
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE))
+        if (buf_append_take(ap, buf) != BUF_OK)
+            sched_yield();
+
+    buf_free(buf);
+    return NULL;
+}
+
+static double
+run(void *(*fn)(void *), int threads)
+{
+    pthread_t tids[64], reader;
+    double start = now();
+    int i;
+
+    done = 0;
+    puts_per_thread = PUTS / threads;
+
+    if (fn == put_append)
+        pthread_create(&reader, NULL, drain, NULL);
+
+    for (i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, fn, NULL);
+    for (i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    double elapsed = now() - start;
+
+    if (fn == put_append) {
+        __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+        pthread_join(reader, NULL);
+    }
+    return elapsed;
+}
+
+int
+main(void)
+{
+    int threads;
+
+    shared = buf_new(1024 * 1024);
+    ap = buf_append_new(1024 * 1024);
+
+    for (threads = 1; threads <= 16; threads *= 2) {
+        double m = run(put_mutex, threads);
+        double a = run(put_append, threads);
+        printf("%2d threads: mutex %.0f ops/s, lock-free %.0f ops/s\n",
+                threads, PUTS / m, PUTS / a);
+    }
+
+    buf_free(shared);
+    buf_append_free(ap);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * Throughput of BasicBuf::Find on string literals (specialized on the
+ * needle length) versus buf_indexb, scanning 8MB of text for a needle
+ * found at the end.
+ *
+ *   make bench-basic-buf
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "basic_buf.hh"
+
+#define SIZE (8 * 1024 * 1024)
+#define ROUNDS 32
+
+using namespace buf;
+
+static volatile size_t sink;
+static BasicBuf<SystemAllocator, ExactGrowth, 0> text;
+static buf_t *cbuf;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+find_crlf(void)
+{
+    sink = text.Find("\r\n");
+}
+
+static void
+find_crlf_runtime(void)
+{
+    sink = text.Find(reinterpret_cast<const uint8_t *>("\r\n"), 2);
+}
+
+static void
+indexb_crlf(void)
+{
+    sink = buf_indexb(cbuf, (uint8_t *)"\r\n", 2, 0);
+}
+
+static void
+find_boundary(void)
+{
+    sink = text.Find("--boundary");
+}
+
+static void
+indexb_boundary(void)
+{
+    sink = buf_indexb(cbuf, (uint8_t *)"--boundary", 10, 0);
+}
+
+/* bytes scanned per second, in GB/s */
+static double
+gbps(void (*fn)(void))
+{
+    double start = now();
+    int i;
+
+    for (i = 0; i < ROUNDS; i++)
+        fn();
+    return (double)SIZE * ROUNDS / (now() - start) / 1e9;
+}
+
+int
+main(void)
+{
+    size_t idx;
+
+    if (!text.Reserve(SIZE) || (cbuf = buf_new(SIZE)) == NULL)
+        return 1;
+
+    // no needle but the one at the end, the whole text is scanned
+    for (idx = 0; idx < SIZE - 12; idx++)
+        text.Append(static_cast<uint8_t>('a' + (idx * 7 + idx / 13) % 26));
+    text.Append("--boundary\r\n", 12);
+    buf_put(cbuf, text.Data(), text.Size());
+
+    printf("\"\\r\\n\"        Find %6.2f GB/s, Find(ptr, len) %6.2f GB/s, "
+            "buf_indexb %6.2f GB/s\n", gbps(find_crlf),
+            gbps(find_crlf_runtime), gbps(indexb_crlf));
+    printf("\"--boundary\"  Find %6.2f GB/s, buf_indexb %6.2f GB/s\n",
+            gbps(find_boundary), gbps(indexb_boundary));
+
+    buf_free(cbuf);
+    return 0;
+}
@@ -0,0 +1,35 @@
+var util = require('util');
+var Buf = require('../index').Buf;
+
+// per call cost of the hottest methods, run before and after changes to
+// the binding layer
+
+n = 1000000;
+
+function bench(name, fn) {
+  var startAt = new Date();
+  for (var i = 0; i < n; i++)
+    fn(i);
+  var endAt = new Date();
+  console.log(util.format('bbuf %s:\t %d op in %s ms\t=> %dops',
+                          name, n, endAt - startAt,
+                          (1000 * n / (endAt - startAt)).toFixed(1)));
+}
+
+var buf = new Buf(1024 * 1024);
+var buffer = new Buffer('abc');
+var line = 'lorem ipsum dolor sit amet\n';
+
+bench('put(byte)    ', function(i) { buf.put(97); });
+bench('put(string)  ', function(i) { buf.put('a'); });
+bench('put(buffer)  ', function(i) { buf.put(buffer); });
+bench('length       ', function(i) { return buf.length; });
+bench('charAt       ', function(i) { return buf.charAt(i); });
+bench('pop          ', function(i) { buf.pop(1); });
+
+buf.clear();
+for (var i = 0; i < 64; i++)
+  buf.put(line);
+
+bench('indexOf(byte)', function(i) { return buf.indexOf(10); });
+bench('indexOf(str) ', function(i) { return buf.indexOf('amet'); });
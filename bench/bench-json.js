@@ -0,0 +1,68 @@
+var util = require('util');
+var Buf = require('../index').Buf;
+
+// serialize a list of user records: JSON.stringify, versus writing each
+// field into a buf (the output is the same)
+
+var n = 200;
+var users = [];
+
+for (var i = 0; i < 1000; i++) {
+  users.push({
+    id: i,
+    name: 'user ' + i,
+    email: 'user' + i + '@example.com',
+    bio: 'Says "hello" a lot.\nLikes\ttabs, café and 中文. ' +
+      new Array(1 + i % 8).join('lorem ipsum dolor sit amet '),
+    score: i / 7,
+    active: i % 3 === 0,
+  });
+}
+
+function write(buf, users) {
+  buf.putJSONRaw('[');
+  for (var i = 0; i < users.length; i++) {
+    var u = users[i];
+    buf.putJSONRaw(i === 0 ? '{"id":' : ',{"id":');
+    buf.putJSONNumber(u.id);
+    buf.putJSONRaw(',"name":');
+    buf.putJSONString(u.name);
+    buf.putJSONRaw(',"email":');
+    buf.putJSONString(u.email);
+    buf.putJSONRaw(',"bio":');
+    buf.putJSONString(u.bio);
+    buf.putJSONRaw(',"score":');
+    buf.putJSONNumber(u.score);
+    buf.putJSONRaw(u.active ? ',"active":true}' : ',"active":false}');
+  }
+  buf.putJSONRaw(']');
+}
+
+var buf = new Buf(1024 * 1024);
+write(buf, users);
+
+if (buf.toString() !== JSON.stringify(users))
+  throw new Error('outputs differ');
+
+var size = buf.length;
+var startAt, endAt;
+
+startAt = new Date();
+for (var i = 0; i < n; i++) {
+  buf.clear();
+  buf.put(JSON.stringify(users));
+}
+endAt = new Date();
+console.log(util.format('JSON.stringify + put:\t %d op in %s ms\t=> %dMB/s',
+                        n, endAt - startAt,
+                        (1000 * n * size / 1048576 / (endAt - startAt)).toFixed(1)));
+
+startAt = new Date();
+for (var i = 0; i < n; i++) {
+  buf.clear();
+  write(buf, users);
+}
+endAt = new Date();
+console.log(util.format('bbuf putJSON*:\t\t %d op in %s ms\t=> %dMB/s',
+                        n, endAt - startAt,
+                        (1000 * n * size / 1048576 / (endAt - startAt)).toFixed(1)));
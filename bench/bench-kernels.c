@@ -0,0 +1,200 @@
+/**
+ * Throughput of the byte kernels in simd.c, versus plain byte loops.
+ *
+ *   make bench-kernels
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "buf.h"
+
+#define SIZE (8 * 1024 * 1024)
+#define ROUNDS 32
+
+static volatile size_t sink;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+naive_isspace(buf_t *buf)
+{
+    size_t idx;
+
+    for (idx = 0; idx < buf->size; idx++)
+        if (!isspace(buf->data[idx]))
+            break;
+    sink = idx;
+}
+
+static void
+naive_trim(buf_t *buf)
+{
+    size_t start = 0, end = buf->size;
+
+    while (start < buf->size && isspace(buf->data[start]))
+        start++;
+    while (end > 0 && isspace(buf->data[end - 1]))
+        end--;
+    sink = start + end;
+}
+
+static void
+naive_reverse(buf_t *buf)
+{
+    size_t i = 0, j = buf->size;
+
+    while (j - i >= 2) {
+        uint8_t tmp = buf->data[i];
+        buf->data[i++] = buf->data[--j];
+        buf->data[j] = tmp;
+    }
+}
+
+static void
+naive_countc(buf_t *buf)
+{
+    size_t count = 0, idx;
+
+    for (idx = 0; idx < buf->size; idx++)
+        if (buf->data[idx] == 'x')
+            count++;
+    sink = count;
+}
+
+static void
+naive_histogram(buf_t *buf)
+{
+    size_t bins[MAX_UINT8] = {0};
+    size_t idx;
+
+    for (idx = 0; idx < buf->size; idx++)
+        bins[buf->data[idx]]++;
+    sink = bins['x'];
+}
+
+static buf_t *json;
+
+static void
+naive_putjson(buf_t *buf)
+{
+    size_t idx;
+
+    json->size = 0;
+    buf_putc(json, '"');
+
+    for (idx = 0; idx < buf->size; idx++) {
+        uint8_t c = buf->data[idx];
+
+        if (c == '"' || c == '\\') {
+            buf_putc(json, '\\');
+            buf_putc(json, c);
+        } else if (c < 0x20) {
+            buf_sprintf(json, "\\u%04x", c);
+        } else {
+            buf_putc(json, c);
+        }
+    }
+
+    buf_putc(json, '"');
+    sink = json->size;
+}
+
+static void
+kernel_isspace(buf_t *buf)
+{
+    sink = buf_isspace(buf);
+}
+
+static void
+kernel_trim(buf_t *buf)
+{
+    sink = buf_ltrim(buf) + buf_rtrim(buf);
+}
+
+static void
+kernel_reverse(buf_t *buf)
+{
+    buf_reverse(buf);
+}
+
+static void
+kernel_countc(buf_t *buf)
+{
+    sink = buf_countc(buf, 'x');
+}
+
+static void
+kernel_putjson(buf_t *buf)
+{
+    json->size = 0;
+    buf_putjson(json, buf->data, buf->size);
+    sink = json->size;
+}
+
+static void
+kernel_histogram(buf_t *buf)
+{
+    size_t bins[MAX_UINT8] = {0};
+
+    buf_histogram(buf, bins);
+    sink = bins['x'];
+}
+
+/* bytes scanned per second, in GB/s */
+static double
+gbps(void (*fn)(buf_t *), buf_t *buf, size_t scanned)
+{
+    double start = now();
+    int i;
+
+    for (i = 0; i < ROUNDS; i++)
+        fn(buf);
+    return (double)scanned * ROUNDS / (now() - start) / 1e9;
+}
+
+int
+main(void)
+{
+    buf_t *spaces = buf_new(SIZE);
+    buf_t *text = buf_new(SIZE);
+    size_t idx;
+
+    json = buf_new(SIZE);
+
+    for (idx = 0; idx < SIZE; idx++) {
+        buf_putc(spaces, " \t\r\n"[idx & 3]);
+        buf_putc(text, 'a' + (idx * 7 + idx / 13) % 26);
+    }
+
+    // all spaces, so trim and isSpace scan the whole buf
+    printf("isSpace    naive %6.2f GB/s, buf %6.2f GB/s\n",
+            gbps(naive_isspace, spaces, SIZE),
+            gbps(kernel_isspace, spaces, SIZE));
+    printf("trim       naive %6.2f GB/s, buf %6.2f GB/s\n",
+            gbps(naive_trim, spaces, SIZE * 2),
+            gbps(kernel_trim, spaces, SIZE * 2));
+    printf("reverse    naive %6.2f GB/s, buf %6.2f GB/s\n",
+            gbps(naive_reverse, text, SIZE),
+            gbps(kernel_reverse, text, SIZE));
+    printf("count      naive %6.2f GB/s, buf %6.2f GB/s\n",
+            gbps(naive_countc, text, SIZE),
+            gbps(kernel_countc, text, SIZE));
+    printf("putjson    naive %6.2f GB/s, buf %6.2f GB/s\n",
+            gbps(naive_putjson, text, SIZE),
+            gbps(kernel_putjson, text, SIZE));
+    printf("histogram  naive %6.2f GB/s, buf %6.2f GB/s\n",
+            gbps(naive_histogram, text, SIZE),
+            gbps(kernel_histogram, text, SIZE));
+
+    buf_free(spaces);
+    buf_free(text);
+    buf_free(json);
+    return 0;
+}
@@ -0,0 +1,31 @@
+var util = require('util');
+var Buf = require('../index').Buf;
+
+// search a 16mb buf (the max size) with 1, 2, 4.. threads
+var size = 16 * 1024 * 1024 - 1024;
+var n = 20;
+var buf = new Buf(1024 * 1024);
+var line = 'lorem ipsum dolor sit amet, consectetur adipiscing elit\n';
+
+while (buf.length + line.length < size)
+  buf.put(line);
+buf.put('needle');
+
+var cpus = require('os').cpus().length;
+var origin = Buf.configure();
+
+for (var threads = 1; threads <= cpus; threads *= 2) {
+  Buf.configure({threads: threads});
+  var startAt = new Date();
+  for (var i = 0; i < n; i++) {
+    buf.indexOf('needle');
+    buf.count('elit');
+  }
+  var endAt = new Date();
+  var mb = 2 * n * buf.length / 1024 / 1024;
+  console.log(util.format('bbuf search %d threads:\t %d op in %s ms\t=> %dMB/s',
+                          threads, 2 * n, endAt - startAt,
+                          (1000 * mb / (endAt - startAt)).toFixed(1)));
+}
+
+Buf.configure(origin);
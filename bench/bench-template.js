@@ -0,0 +1,52 @@
+var util = require('util');
+var Buf = require('../index').Buf;
+
+// render a response head by a template, versus the same by put calls
+
+var n = 1000000;
+
+var tpl = Buf.compileTemplate(
+  'HTTP/1.1 $status OK\r\n' +
+  'Content-Type: application/json\r\n' +
+  'Content-Length: $len\r\n' +
+  'X-Request-Id: $id\r\n' +
+  'Connection: keep-alive\r\n\r\n',
+  ['$status', '$len', '$id']);
+
+function puts(buf, status, len, id) {
+  buf.put('HTTP/1.1 ');
+  buf.put(String(status));
+  buf.put(' OK\r\nContent-Type: application/json\r\nContent-Length: ');
+  buf.put(String(len));
+  buf.put('\r\nX-Request-Id: ');
+  buf.put(id);
+  buf.put('\r\nConnection: keep-alive\r\n\r\n');
+}
+
+function render(buf, status, len, id) {
+  buf.render(tpl, [status, len, id]);
+}
+
+var a = new Buf(1024 * 1024), b = new Buf(1024 * 1024);
+puts(a, 200, 1234, 'c0ffee');
+render(b, 200, 1234, 'c0ffee');
+
+if (!a.equals(b))
+  throw new Error('outputs differ');
+
+function bench(name, fn) {
+  var buf = new Buf(1024 * 1024);
+  var startAt = new Date();
+  for (var i = 0; i < n; i++) {
+    if ((i & 1023) === 0)
+      buf.clear();
+    fn(buf, 200, i, 'c0ffee');
+  }
+  var endAt = new Date();
+  console.log(util.format('bbuf %s:\t %d op in %s ms\t=> %dops',
+                          name, n, endAt - startAt,
+                          (1000 * n / (endAt - startAt)).toFixed(1)));
+}
+
+bench('put chain', puts);
+bench('render   ', render);
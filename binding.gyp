@@ -1,7 +1,8 @@
 {
   'targets': [{
     'target_name': 'buf',
-    'sources': ['src/cc/bind.cc', 'src/cc/buf.cc'],
+    'sources': ['src/cc/bind.cc', 'src/cc/buf.cc', 'src/cc/scan.cc',
+                'src/cc/ring.cc', 'src/cc/map.cc', 'src/cc/template.cc'],
     'include_dirs': ["<!(node -e \"require('nan')\")"],
     'dependencies': ['src/c/buf.gyp:buf'],
     'defines': ['_GNU_SOURCE'],
@@ -1 +1,147 @@
 exports = module.exports = require('bindings')('buf.node');
+
+var stream = require('stream');
+var util = require('util');
+
+var Buf = exports.Buf;
+
+// Writable appending to a buf. Writes made in one tick are corked and
+// reach the buf as one batch: one grow, then each chunk copied once.
+function BufWriteStream(buf, options) {
+  if (!(this instanceof BufWriteStream))
+    return new BufWriteStream(buf, options);
+
+  if (!Buf.isBuf(buf))
+    throw new TypeError('requires buf');
+
+  options = options || {};
+  stream.Writable.call(this, {
+    highWaterMark: options.highWaterMark,
+    decodeStrings: false,  // utf8 strings are encoded right into the buf
+  });
+
+  this.buf = buf;
+  this._autoCorked = false;
+}
+util.inherits(BufWriteStream, stream.Writable);
+
+BufWriteStream.prototype.write = function(chunk, encoding, cb) {
+  var self = this;
+
+  if (!this._autoCorked && typeof this.cork === 'function') {
+    this._autoCorked = true;
+    this.cork();
+    process.nextTick(function() {
+      self._autoCorked = false;
+      self.uncork();
+    });
+  }
+  return stream.Writable.prototype.write.call(this, chunk, encoding, cb);
+};
+
+BufWriteStream.prototype._put = function(chunk, encoding) {
+  if (typeof chunk === 'string' && encoding !== 'utf8')
+    chunk = new Buffer(chunk, encoding);
+  this.buf.put(chunk);
+};
+
+BufWriteStream.prototype._write = function(chunk, encoding, cb) {
+  try {
+    this._put(chunk, encoding);
+  } catch (err) {
+    return cb(err);
+  }
+  cb();
+};
+
+BufWriteStream.prototype._writev = function(chunks, cb) {
+  var size = this.buf.length;
+  var i;
+
+  // string lengths are a lower bound of their bytes, good enough to
+  // grow once in the common case
+  for (i = 0; i < chunks.length; i++)
+    size += chunks[i].chunk.length;
+
+  try {
+    if (size > this.buf.cap)
+      this.buf.grow(size);
+    for (i = 0; i < chunks.length; i++)
+      this._put(chunks[i].chunk, chunks[i].encoding);
+  } catch (err) {
+    return cb(err);
+  }
+  cb();
+};
+
+var hasBufferFrom = typeof Buffer.from === 'function' &&
+  typeof ArrayBuffer === 'function' && (function() {
+    try {
+      return Buffer.from(new ArrayBuffer(2), 1, 1).length === 1;
+    } catch (err) {
+      return false;
+    }
+  })();
+
+// Readable of a buf range in chunks of `chunkSize` bytes. Chunks are
+// copies, so the buf may change or be locked by async operations while
+// they wait in the stream buffer. With `zeroCopy` (node >= 4.5) they are
+// buffers over a view of the buf data.
+function BufReadStream(buf, options) {
+  if (!(this instanceof BufReadStream))
+    return new BufReadStream(buf, options);
+
+  if (!Buf.isBuf(buf))
+    throw new TypeError('requires buf');
+
+  options = options || {};
+  stream.Readable.call(this, {highWaterMark: options.highWaterMark});
+
+  this.buf = buf;
+  this.chunkSize = options.chunkSize || 64 * 1024;
+  this.pos = options.start || 0;
+  this.end = options.end;
+  this.zeroCopy = !!options.zeroCopy && hasBufferFrom;
+}
+util.inherits(BufReadStream, stream.Readable);
+
+BufReadStream.prototype._chunk = function(view, begin, end) {
+  if (view !== null)
+    return Buffer.from(view.buffer, view.byteOffset + begin, end - begin);
+  return this.buf.toBuffer(begin, end);
+};
+
+BufReadStream.prototype._read = function() {
+  var end = this.buf.length;
+  var view = this.zeroCopy ? this.buf.view() : null;
+
+  if (this.end !== undefined && this.end < end)
+    end = this.end;
+
+  // push until the consumer is full, the rest is read on demand
+  for (;;) {
+    if (this.pos >= end)
+      return this.push(null);
+
+    var next = Math.min(this.pos + this.chunkSize, end);
+    var chunk = this._chunk(view, this.pos, next);
+
+    this.pos = next;
+
+    if (!this.push(chunk))
+      return;
+  }
+};
+
+exports.BufWriteStream = BufWriteStream;
+exports.BufReadStream = BufReadStream;
+
+// Public API: - Buf.createWriteStream(buf[, options])
+Buf.createWriteStream = function(buf, options) {
+  return new BufWriteStream(buf, options);
+};
+
+// Public API: - Buf.prototype.createReadStream([options])
+Buf.prototype.createReadStream = function(options) {
+  return new BufReadStream(this, options);
+};
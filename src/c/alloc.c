@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Allocators of buf data. The system allocator wraps malloc/realloc/free,
+ * builds linking jemalloc or mimalloc in place of malloc use it as is. An
+ * arena hands out bumped pointers from large blocks and frees all of them
+ * at once on reset, for short lived scratch bufs.
+ */
+
+#include "buf.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_ALIGNED(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ALIGNED(sizeof(buf_arena_block_t))
+#define ARENA_MIN_BLOCK 4096
+
+static void *
+system_alloc(void *ctx, size_t size)
+{
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *
+system_realloc(void *ctx, void *ptr, size_t old, size_t size)
+{
+    (void)ctx;
+    (void)old;
+    return realloc(ptr, size);
+}
+
+static void
+system_free(void *ctx, void *ptr, size_t size)
+{
+    (void)ctx;
+    (void)size;
+    free(ptr);
+}
+
+buf_allocator_t buf_system_allocator = {
+    system_alloc, system_realloc, system_free, NULL};
+
+static buf_allocator_t *current = &buf_system_allocator;
+
+/**
+ * Set the allocator of bufs created later by buf_new, NULL to restore the
+ * system allocator. Existing bufs keep their own. Not thread safe, set it
+ * before bufs are created.
+ */
+void
+buf_set_allocator(buf_allocator_t *allocator)
+{
+    current = allocator != NULL ? allocator : &buf_system_allocator;
+}
+
+/**
+ * Get the allocator used by buf_new.
+ */
+buf_allocator_t *
+buf_get_allocator(void)
+{
+    return current;
+}
+
+/* data of a block */
+static inline uint8_t *
+block_data(buf_arena_block_t *block)
+{
+    return (uint8_t *)block + ARENA_HEADER;
+}
+
+static void *
+arena_alloc(void *ctx, size_t size)
+{
+    buf_arena_t *arena = ctx;
+    buf_arena_block_t *block = arena->blocks;
+
+    size = ARENA_ALIGNED(size);
+
+    if (block == NULL || size > block->size - arena->used) {
+        size_t bsize = size > arena->block ? size : arena->block;
+
+        if ((block = malloc(ARENA_HEADER + bsize)) == NULL)
+            return NULL;
+
+        block->next = arena->blocks;
+        block->size = bsize;
+        arena->blocks = block;
+        arena->used = 0;
+    }
+
+    arena->last = block_data(block) + arena->used;
+    arena->used += size;
+    return arena->last;
+}
+
+static void *
+arena_realloc(void *ctx, void *ptr, size_t old, size_t size)
+{
+    buf_arena_t *arena = ctx;
+
+    if (ptr == NULL)
+        return arena_alloc(ctx, size);
+
+    if (ptr == arena->last) {
+        // the last allocation, grow in place if the block has room
+        size_t off = arena->last - block_data(arena->blocks);
+
+        if (ARENA_ALIGNED(size) <= arena->blocks->size - off) {
+            arena->used = off + ARENA_ALIGNED(size);
+            return ptr;
+        }
+    }
+
+    void *data = arena_alloc(ctx, size);
+
+    if (data != NULL)
+        memcpy(data, ptr, old < size ? old : size);
+    return data;
+}
+
+static void
+arena_free(void *ctx, void *ptr, size_t size)
+{
+    buf_arena_t *arena = ctx;
+
+    (void)size;
+
+    // only the last allocation is given back
+    if (ptr != NULL && ptr == arena->last) {
+        arena->used = arena->last - block_data(arena->blocks);
+        arena->last = NULL;
+    }
+}
+
+/**
+ * New arena allocating blocks of at least `block` bytes. Bufs on it are
+ * created with buf_new_with(unit, &arena->allocator).
+ */
+buf_arena_t *
+buf_arena_new(size_t block)
+{
+    buf_arena_t *arena = malloc(sizeof(buf_arena_t));
+
+    if (arena != NULL) {
+        arena->allocator.alloc = arena_alloc;
+        arena->allocator.realloc = arena_realloc;
+        arena->allocator.free = arena_free;
+        arena->allocator.ctx = arena;
+        arena->blocks = NULL;
+        arena->used = 0;
+        arena->block = block > ARENA_MIN_BLOCK ? block : ARENA_MIN_BLOCK;
+        arena->last = NULL;
+    }
+
+    return arena;
+}
+
+/**
+ * Free all memory of the arena at once, the current block is kept for
+ * reuse. Bufs on the arena must be cleared (or freed) before use again.
+ * O(blocks)
+ */
+void
+buf_arena_reset(buf_arena_t *arena)
+{
+    assert(arena != NULL);
+
+    if (arena->blocks != NULL) {
+        buf_arena_block_t *block = arena->blocks->next;
+
+        while (block != NULL) {
+            buf_arena_block_t *next = block->next;
+            free(block);
+            block = next;
+        }
+
+        arena->blocks->next = NULL;
+    }
+
+    arena->used = 0;
+    arena->last = NULL;
+}
+
+/**
+ * Free arena and all its blocks.
+ */
+void
+buf_arena_free(buf_arena_t *arena)
+{
+    if (arena != NULL) {
+        buf_arena_reset(arena);
+        free(arena->blocks);
+        free(arena);
+    }
+}
@@ -14,13 +14,32 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sched.h>
+
 #include "buf.h"
+#include "probes.h"
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
 
 /**
- * New buf.
+ * New buf, data is allocated by the global allocator.
  */
 buf_t *
 buf_new(size_t unit)
+{
+    return buf_new_with(unit, NULL);
+}
+
+/**
+ * New buf with data allocated by `allocator` (the global one if NULL).
+ * The buf struct itself is always malloced, since data and allocators
+ * are exchanged by buf_swap.
+ */
+buf_t *
+buf_new_with(size_t unit, buf_allocator_t *allocator)
 {
     buf_t *buf = malloc(sizeof(buf_t));
 
@@ -29,6 +48,9 @@ buf_new(size_t unit)
         buf->size = 0;
         buf->cap = 0;
         buf->unit = unit;
+        buf->gap = 0;
+        buf->gaplen = 0;
+        buf->allocator = allocator != NULL ? allocator : buf_get_allocator();
     }
 
     return buf;
@@ -41,8 +63,10 @@ void
 buf_free(buf_t *buf)
 {
     if (buf != NULL) {
+        BUF_PROBE3(free, buf, buf->cap, buf->size);
+
         if (buf->data != NULL)
-            free(buf->data);
+            buf->allocator->free(buf->allocator->ctx, buf->data, buf->cap);
         free(buf);
     }
 }
@@ -56,21 +80,52 @@ buf_clear(buf_t *buf)
 {
     assert(buf != NULL);
 
+    BUF_PROBE3(clear, buf, buf->cap, buf->size);
+
     if (buf->data != NULL)
-        free(buf->data);
+        buf->allocator->free(buf->allocator->ctx, buf->data, buf->cap);
     buf->data = NULL;
     buf->size = 0;
     buf->cap = 0;
+    buf->gaplen = 0;
+}
+
+/**
+ * Swap data (and the allocators owning it) of two bufs, the units are
+ * kept. O(1)
+ */
+void
+buf_swap(buf_t *a, buf_t *b)
+{
+    assert(a != NULL && b != NULL);
+
+    buf_t t = *a;
+
+    a->data = b->data;
+    a->size = b->size;
+    a->cap = b->cap;
+    a->gap = b->gap;
+    a->gaplen = b->gaplen;
+    a->allocator = b->allocator;
+    b->data = t.data;
+    b->size = t.size;
+    b->cap = t.cap;
+    b->gap = t.gap;
+    b->gaplen = t.gaplen;
+    b->allocator = t.allocator;
 }
 
 /**
- * Increase buf allocated size to `size`, O(1), O(n)
+ * Increase buf allocated size to `size`, flattens buf so the bytes from
+ * `data + size` are free. O(1), O(n)
  */
 int
 buf_grow(buf_t *buf, size_t size)
 {
     assert(buf != NULL && buf->unit != 0);
 
+    buf_flat(buf);
+
     if (size > BUF_MAX_SIZE)
         return BUF_ENOMEM;
 
@@ -82,11 +137,14 @@ buf_grow(buf_t *buf, size_t size)
     while (cap < size)
         cap += buf->unit;
 
-    uint8_t *data = realloc(buf->data, cap);
+    uint8_t *data = buf->allocator->realloc(buf->allocator->ctx, buf->data,
+            buf->cap, cap);
 
     if (data == NULL)
         return BUF_ENOMEM;
 
+    BUF_PROBE5(grow, buf, buf->cap, cap, buf->size, data != buf->data);
+
     buf->data = data;
     buf->cap = cap;
     return BUF_OK;
@@ -100,6 +158,8 @@ buf_str(buf_t *buf)
 {
     assert(buf && buf->unit);
 
+    buf_flat(buf);
+
     if (buf->size < buf->cap && buf->data[buf->size] == '\0')
         return (char *)buf->data;
 
@@ -134,6 +194,7 @@ buf_putc(buf_t *buf, char ch)
 void
 buf_print(buf_t *buf)
 {
+    buf_flat(buf);
     printf("%.*s", (int)buf->size, buf->data);
 }
 
@@ -143,6 +204,7 @@ buf_print(buf_t *buf)
 void
 buf_println(buf_t *buf)
 {
+    buf_flat(buf);
     printf("%.*s\n", (int)buf->size, buf->data);
 }
 
@@ -152,8 +214,19 @@ buf_println(buf_t *buf)
 int
 buf_put(buf_t *buf, uint8_t *data, size_t size)
 {
+    // data may point into buf itself (e.g. put buf to itself)
+    bool alias = buf->data != NULL && data >= buf->data &&
+        data < buf->data + buf->cap;
+    size_t off = alias ? (size_t)(data - buf->data) : 0;
+
+    if (alias && buf->gaplen > 0 && off >= buf->gap + buf->gaplen)
+        off -= buf->gaplen;  // where flattening moves it
+
     int result = buf_grow(buf, buf->size + size);
 
+    if (alias)
+        data = buf->data + off;
+
     if (result == BUF_OK) {
         memcpy(buf->data + buf->size, data, size);
         buf->size += size;
@@ -171,6 +244,251 @@ buf_puts(buf_t *buf, char *str)
     return buf_put(buf, (uint8_t *)str, strlen(str));
 }
 
+/*
+ * Concurrent append: writers reserve with a fetch-add on a word holding
+ * (generation, offset), copy into the generation's slot, and publish in
+ * reservation order by moving the slot's commit index. A reservation not
+ * fitting the slot seals it and rotates writers to the other slot, which
+ * the single reader must have taken back.
+ */
+
+#define APPEND_OFF_BITS 40
+#define APPEND_OFF_MASK ((UINT64_C(1) << APPEND_OFF_BITS) - 1)
+#define APPEND_GEN(w) ((w) >> APPEND_OFF_BITS)
+#define APPEND_OFF(w) ((size_t)((w) & APPEND_OFF_MASK))
+
+enum {
+    APPEND_FREE = 0,
+    APPEND_LIVE = 1,
+    APPEND_SEALED = 2,
+};
+
+static inline void
+append_relax(int *spins)
+{
+    // the writer waited for may be descheduled, dont burn its cpu
+    if (++*spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __asm__ __volatile__("pause");
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+static void
+append_reset(buf_append_slot_t *slot)
+{
+    slot->buf->size = 0;
+    slot->commit = 0;
+    slot->limit = SIZE_MAX;
+}
+
+/**
+ * New concurrent append buf, each of its 2 slots holds `cap` bytes.
+ * Returns NULL on failure.
+ */
+buf_append_t *
+buf_append_new(size_t cap)
+{
+    if (cap == 0 || cap > BUF_MAX_SIZE)
+        return NULL;
+
+    buf_append_t *ap = malloc(sizeof(buf_append_t));
+
+    if (ap == NULL)
+        return NULL;
+
+    memset(ap, 0, sizeof(buf_append_t));
+    ap->cap = cap;
+
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        ap->slots[i].buf = buf_new(cap);
+
+        if (ap->slots[i].buf == NULL ||
+                buf_grow(ap->slots[i].buf, cap) != BUF_OK) {
+            buf_append_free(ap);
+            return NULL;
+        }
+
+        append_reset(&ap->slots[i]);
+    }
+
+    ap->slots[0].state = APPEND_LIVE;
+    return ap;
+}
+
+/**
+ * Free concurrent append buf, no writers should be running.
+ */
+void
+buf_append_free(buf_append_t *ap)
+{
+    if (ap != NULL) {
+        buf_free(ap->slots[0].buf);
+        buf_free(ap->slots[1].buf);
+        free(ap);
+    }
+}
+
+/**
+ * Seal generation `gen` and make the other slot live, fails if that slot
+ * is not taken back yet. Returns true if `gen` is sealed (maybe by
+ * another thread).
+ */
+static bool
+append_rotate(buf_append_t *ap, uint64_t gen)
+{
+    buf_append_slot_t *slot = &ap->slots[gen & 1];
+    buf_append_slot_t *next = &ap->slots[(gen + 1) & 1];
+    uint64_t word = __atomic_load_n(&ap->word, __ATOMIC_ACQUIRE);
+    int spins = 0;
+
+    do {
+        if (APPEND_GEN(word) != gen)
+            return true;
+        if (__atomic_load_n(&next->state, __ATOMIC_ACQUIRE) != APPEND_FREE)
+            return false;
+    } while (!__atomic_compare_exchange_n(&ap->word, &word,
+                (gen + 1) << APPEND_OFF_BITS, false, __ATOMIC_ACQ_REL,
+                __ATOMIC_ACQUIRE));
+
+    __atomic_store_n(&next->state, APPEND_LIVE, __ATOMIC_RELEASE);
+
+    // reserved end that fits: all of it, or where the first writer
+    // overflowing started
+    size_t end = APPEND_OFF(word);
+
+    if (end > ap->cap) {
+        while ((end = __atomic_load_n(&slot->limit, __ATOMIC_ACQUIRE)) ==
+                SIZE_MAX)
+            append_relax(&spins);
+    }
+
+    while (__atomic_load_n(&slot->commit, __ATOMIC_ACQUIRE) != end)
+        append_relax(&spins);
+
+    slot->buf->size = end;
+    __atomic_store_n(&slot->state, APPEND_SEALED, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Append data from any thread, lock-free. Returns BUF_EFAILED if data is
+ * larger than a slot, or the live slot is full while the sealed one is
+ * not taken yet. O(n)
+ */
+int
+buf_append_put(buf_append_t *ap, uint8_t *data, size_t size)
+{
+    assert(ap != NULL);
+
+    if (size > ap->cap)
+        return BUF_EFAILED;
+
+    for (;;) {
+        uint64_t word = __atomic_load_n(&ap->word, __ATOMIC_ACQUIRE);
+        uint64_t gen = APPEND_GEN(word);
+        int spins = 0;
+
+        if (APPEND_OFF(word) + size > ap->cap) {
+            // full, help to rotate or wait for it
+            if (!append_rotate(ap, gen))
+                return BUF_EFAILED;
+            continue;
+        }
+
+        word = __atomic_fetch_add(&ap->word, size, __ATOMIC_ACQ_REL);
+        gen = APPEND_GEN(word);
+
+        buf_append_slot_t *slot = &ap->slots[gen & 1];
+        size_t pos = APPEND_OFF(word);
+
+        if (pos + size <= ap->cap) {
+            memcpy(slot->buf->data + pos, data, size);
+
+            while (__atomic_load_n(&slot->commit, __ATOMIC_ACQUIRE) != pos)
+                append_relax(&spins);
+            __atomic_store_n(&slot->commit, pos + size, __ATOMIC_RELEASE);
+            return BUF_OK;
+        }
+
+        if (pos <= ap->cap)
+            // the first overflowing writer marks where the slot ends
+            __atomic_store_n(&slot->limit, pos, __ATOMIC_RELEASE);
+
+        if (!append_rotate(ap, gen))
+            return BUF_EFAILED;
+    }
+}
+
+/**
+ * Get the committed prefix of the live slot, its data is set to `data`.
+ * For the single reader. O(1)
+ */
+size_t
+buf_append_peek(buf_append_t *ap, uint8_t **data)
+{
+    assert(ap != NULL && data != NULL);
+
+    uint64_t gen = APPEND_GEN(__atomic_load_n(&ap->word, __ATOMIC_ACQUIRE));
+    buf_append_slot_t *slot = &ap->slots[gen & 1];
+
+    *data = slot->buf->data;
+    return __atomic_load_n(&slot->commit, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Seal the live slot now, so its bytes can be taken. Returns BUF_EFAILED
+ * if the sealed slot is not taken yet. For the single reader.
+ */
+int
+buf_append_seal(buf_append_t *ap)
+{
+    assert(ap != NULL);
+
+    uint64_t gen = APPEND_GEN(__atomic_load_n(&ap->word, __ATOMIC_ACQUIRE));
+    return append_rotate(ap, gen) ? BUF_OK : BUF_EFAILED;
+}
+
+/**
+ * Take the sealed slot by swapping its storage with buf, the bytes buf
+ * had are dropped. Returns BUF_EFAILED if no slot is sealed. For the
+ * single reader. O(1)
+ */
+int
+buf_append_take(buf_append_t *ap, buf_t *buf)
+{
+    assert(ap != NULL && buf != NULL);
+
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        buf_append_slot_t *slot = &ap->slots[i];
+
+        if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != APPEND_SEALED)
+            continue;
+
+        // the slot needs its full cap back
+        if (buf_grow(buf, ap->cap) != BUF_OK)
+            return BUF_ENOMEM;
+
+        buf_swap(buf, slot->buf);
+        append_reset(slot);
+        __atomic_store_n(&slot->state, APPEND_FREE, __ATOMIC_RELEASE);
+
+        // writers may be stuck on a full live slot
+        uint64_t word = __atomic_load_n(&ap->word, __ATOMIC_ACQUIRE);
+
+        if (APPEND_OFF(word) >= ap->cap)
+            append_rotate(ap, APPEND_GEN(word));
+        return BUF_OK;
+    }
+    return BUF_EFAILED;
+}
+
 
 /**
  * Remove left data from buf by number of bytes, O(n)
@@ -183,17 +501,21 @@ buf_lrm(buf_t *buf, size_t size)
     if (size > buf->size) {
         size_t size_ = buf->size;
         buf->size = 0;
+        buf->gaplen = 0;
         return size_;
     }
 
+    buf_flat(buf);
+
     buf->size -= size;
+    BUF_PROBE4(lrm, buf, size, buf->size, buf->cap);
     memmove(buf->data, buf->data + size, buf->size);
     return size;
 }
 
 
 /**
- * Remove right data from buf by number of bytes, O(1)
+ * Remove right data from buf by number of bytes, gap aware. O(1)
  */
 size_t
 buf_rrm(buf_t *buf, size_t size)
@@ -203,12 +525,212 @@ buf_rrm(buf_t *buf, size_t size)
     if (size > buf->size) {
         size_t size_ = buf->size;
         buf->size = 0;
+        buf->gaplen = 0;
         return size_;
     }
+
     buf->size -= size;
+
+    // the bytes left all before the gap: flat
+    if (buf->size <= buf->gap)
+        buf->gaplen = 0;
+    return size;
+}
+
+/*
+ * Gap buffer: mid-buffer edits keep a gap of spare bytes at the edit
+ * point, [gap, gap + gaplen) of data, moved lazily to the next edit.
+ * Reads by index and the compares are gap aware, appends and searches
+ * flatten buf first (see buf_flat). Pointers into data stay valid only
+ * while buf is flat.
+ */
+
+/**
+ * Move the gap to `idx` and make it at least `size` bytes. O(k), O(n)
+ */
+static int
+gap_move(buf_t *buf, size_t idx, size_t size)
+{
+    if (buf->gaplen < size) {
+        // flatten, grow, then open the gap over all spare bytes
+        buf_flat(buf);
+
+        if (buf->size + size > buf->cap) {
+            int res = buf_grow(buf, buf->size + size);
+
+            if (res != BUF_OK)
+                return res;
+        }
+
+        buf->gap = buf->size;
+        buf->gaplen = buf->cap - buf->size;
+    }
+
+    uint8_t *data = buf->data;
+
+    if (buf->gaplen == 0)
+        ;  // flat, an empty gap is anywhere
+    else if (idx < buf->gap)
+        memmove(data + idx + buf->gaplen, data + idx, buf->gap - idx);
+    else if (idx > buf->gap)
+        memmove(data + buf->gap, data + buf->gap + buf->gaplen,
+                idx - buf->gap);
+
+    buf->gap = idx;
+    return BUF_OK;
+}
+
+/**
+ * Close the gap if it ends the data, buf is flat then.
+ */
+static void
+gap_trim(buf_t *buf)
+{
+    if (buf->gap >= buf->size)
+        buf->gaplen = 0;
+}
+
+/**
+ * Make buf data contiguous by moving the gap to the end. O(k)
+ */
+void
+buf_flat(buf_t *buf)
+{
+    assert(buf != NULL);
+
+    if (buf->gaplen == 0)
+        return;
+
+    memmove(buf->data + buf->gap, buf->data + buf->gap + buf->gaplen,
+            buf->size - buf->gap);
+    buf->gaplen = 0;
+}
+
+/**
+ * Get pointer to the byte at `idx` (< size), gap aware. O(1)
+ */
+uint8_t *
+buf_at(buf_t *buf, size_t idx)
+{
+    assert(buf != NULL && idx < buf->size);
+
+    if (buf->gaplen > 0 && idx >= buf->gap)
+        idx += buf->gaplen;
+    return buf->data + idx;
+}
+
+static size_t case_mismatch(uint8_t *, uint8_t *, size_t);
+
+/**
+ * Get the first index where `a` and `b` differ, or `size` if none. O(n)
+ */
+static size_t
+byte_mismatch(uint8_t *a, uint8_t *b, size_t size)
+{
+    size_t idx = 0;
+
+    if (memcmp(a, b, size) == 0)
+        return size;
+    while (a[idx] == b[idx])
+        idx++;
+    return idx;
+}
+
+/**
+ * Get the first offset where `size` bytes of buf from `idx` differ from
+ * data (ignoring ascii case if `fold`), or `size` if none. Compares the
+ * runs before and after the gap. O(k)
+ */
+static size_t
+gap_mismatch(buf_t *buf, size_t idx, uint8_t *data, size_t size, bool fold)
+{
+    size_t off = 0;
+
+    while (off < size) {
+        size_t pos = idx + off;
+        size_t run = size - off;
+
+        if (buf->gaplen > 0 && pos < buf->gap && buf->gap - pos < run)
+            run = buf->gap - pos;
+
+        uint8_t *p = buf_at(buf, pos);
+        size_t n = fold ? case_mismatch(p, data + off, run) :
+            byte_mismatch(p, data + off, run);
+
+        if (n < run)
+            return off + n;
+        off += run;
+    }
     return size;
 }
 
+/**
+ * Replace `del` bytes at `idx` with data, moves the gap there. O(k),
+ * k is the distance the gap moves.
+ */
+int
+buf_splice(buf_t *buf, size_t idx, size_t del, uint8_t *data, size_t size)
+{
+    assert(buf != NULL && buf->unit != 0);
+
+    if (idx > buf->size)
+        idx = buf->size;
+    if (del > buf->size - idx)
+        del = buf->size - idx;
+
+    uint8_t *copy = NULL;
+
+    if (size > 0 && buf->data != NULL && data >= buf->data &&
+            data < buf->data + buf->cap) {
+        // data points into buf, which the gap moves through
+        if ((copy = malloc(size)) == NULL)
+            return BUF_ENOMEM;
+        memcpy(copy, data, size);
+        data = copy;
+    }
+
+    int res = gap_move(buf, idx, size > del ? size - del : 0);
+
+    if (res == BUF_OK) {
+        // remove by widening the gap, then fill from its start
+        buf->gaplen += del;
+        buf->size -= del;
+        if (size > 0)
+            memcpy(buf->data + buf->gap, data, size);
+        buf->gap += size;
+        buf->gaplen -= size;
+        buf->size += size;
+        gap_trim(buf);
+    }
+
+    if (copy != NULL)
+        free(copy);
+    return res;
+}
+
+/**
+ * Insert data at `idx`. O(k)
+ */
+int
+buf_insert(buf_t *buf, size_t idx, uint8_t *data, size_t size)
+{
+    return buf_splice(buf, idx, 0, data, size);
+}
+
+/**
+ * Remove `len` bytes at `idx`, returns bytes removed. O(k)
+ */
+size_t
+buf_remove(buf_t *buf, size_t idx, size_t len)
+{
+    assert(buf != NULL);
+
+    size_t size = buf->size;
+
+    buf_splice(buf, idx, len, NULL, 0);
+    return size - buf->size;
+}
+
 /**
  * Formatted printing to a buffer.
  */
@@ -217,6 +739,8 @@ buf_sprintf(buf_t *buf, const char *fmt, ...)
 {
     assert(buf != NULL && buf->unit != 0);
 
+    buf_flat(buf);
+
     if (buf->size >= buf->cap &&
             buf_grow(buf, buf->size + 1) != BUF_OK)
         return BUF_ENOMEM;
@@ -250,13 +774,44 @@ buf_sprintf(buf_t *buf, const char *fmt, ...)
     return BUF_OK;
 }
 
+/**
+ * Compare buf with bytes, similar to `strcmp`. O(n)
+ */
+int
+buf_cmpb(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    size_t len = buf->size < size ? buf->size : size;
+    size_t idx = gap_mismatch(buf, 0, data, len, false);
+
+    if (idx < len)
+        return *buf_at(buf, idx) - data[idx];
+
+    if (buf->size == size)
+        return 0;
+    return buf->size > size ? 1 : -1;
+}
+
 /**
  * Compare buf with string. O(n)
  */
 int
 buf_cmp(buf_t *buf, char *s)
 {
-    return strcmp(buf_str(buf), s);
+    return buf_cmpb(buf, (uint8_t *)s, strlen(s));
+}
+
+/**
+ * Test if buf equals with bytes. O(n)
+ */
+bool
+buf_equalsb(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    return buf->size == size &&
+        gap_mismatch(buf, 0, data, size, false) == size;
 }
 
 /**
@@ -265,94 +820,284 @@ buf_cmp(buf_t *buf, char *s)
 bool
 buf_equals(buf_t *buf, char *s)
 {
-    if (buf_cmp(buf, s) == 0)
-        return true;
-    return false;
+    return buf_equalsb(buf, (uint8_t *)s, strlen(s));
 }
 
 /**
- * Test if a buf is space. O(n)
+ * Test if a buf is startswith a prefix. O(k)
  */
 bool
-buf_isspace(buf_t *buf)
+buf_startswithb(buf_t *buf, uint8_t *prefix, size_t size)
 {
     assert(buf != NULL);
 
-    size_t idx;
-
-    for (idx = 0; idx < buf->size; idx++)
-        if (!isspace(buf->data[idx]))
-            return false;
-    if (buf->size > 0)
-        return true;
-    return false;
+    return size <= buf->size &&
+        gap_mismatch(buf, 0, prefix, size, false) == size;
 }
 
 /**
- * Test if a buf is startswith a prefix. O(k)
+ * Test if a buf is startswith a prefix string. O(k)
  */
 bool
 buf_startswith(buf_t *buf, char *prefix)
 {
-    assert(buf != NULL);
+    return buf_startswithb(buf, (uint8_t *)prefix, strlen(prefix));
+}
 
-    size_t idx = 0;
+/**
+ * Test if a buf is endswith a suffix. O(k)
+ */
+bool
+buf_endswithb(buf_t *buf, uint8_t *suffix, size_t size)
+{
+    assert(buf != NULL);
 
-    while (idx < buf->size && prefix[idx] != '\0') {
-        if (buf->data[idx] != (uint8_t)prefix[idx])
-            return false;
-        idx++;
-    }
-    return true;
+    return size <= buf->size &&
+        gap_mismatch(buf, buf->size - size, suffix, size, false) == size;
 }
 
 /**
- * Test if a buf is startswith a prefix. O(k)
+ * Test if a buf is endswith a suffix string. O(k)
  */
 bool
 buf_endswith(buf_t *buf, char *suffix)
 {
-    assert(buf != NULL);
+    return buf_endswithb(buf, (uint8_t *)suffix, strlen(suffix));
+}
 
-    size_t len = 0;
-    size_t idx = 0;
+/*
+ * ASCII case folding, only 'A'~'Z' and 'a'~'z' are folded, other bytes
+ * (utf8 ones included) are left as they are. Kernels run 16 bytes a step
+ * by sse2, 8 bytes by swar else.
+ */
 
-    while (suffix[len] != '\0') {len++;}
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGH 0x8080808080808080ULL
 
-    while (idx < buf->size && idx < len) {
-        // buf->size >= 1 was already gauranteed
-        if (buf->data[buf->size - 1 - idx] != (uint8_t)suffix[len - 1 - idx])
-            return false;
-        idx++;
-    }
-    return true;
+static inline uint8_t
+fold_lower(uint8_t c)
+{
+    return (uint8_t)(c - 'A') < 26 ? c | 0x20 : c;
 }
 
 /**
- * Reverse buf in place. O(n/2)
+ * Get the 0x20 bit of each byte of `w` within [lo, hi], both ascii.
  */
-void
-buf_reverse(buf_t *buf)
+static inline uint64_t
+swar_range(uint64_t w, uint8_t lo, uint8_t hi)
 {
-    assert(buf != NULL);
+    uint64_t h = w & ~SWAR_HIGH;
+    uint64_t a = h + SWAR_ONES * (uint64_t)(0x80 - lo);  // high bit: >= lo
+    uint64_t z = h + SWAR_ONES * (uint64_t)(0x7f - hi);  // high bit: > hi
+    return (a & ~z & ~w & SWAR_HIGH) >> 2;
+}
+
+#ifdef HAVE_SSE2
+static inline __m128i
+sse2_range(__m128i v, uint8_t lo, uint8_t hi)
+{
+    // move [lo, hi] to the bottom of signed bytes
+    __m128i s = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - lo)));
+    __m128i m = _mm_cmplt_epi8(s, _mm_set1_epi8((char)(0x80 + hi - lo + 1)));
+    return _mm_and_si128(m, _mm_set1_epi8(0x20));
+}
+#endif
+
+/**
+ * Flip the case bit of bytes within [lo, hi]. O(n)
+ */
+static void
+case_flip(uint8_t *data, size_t size, uint8_t lo, uint8_t hi)
+{
+    size_t idx = 0;
+
+#ifdef HAVE_SSE2
+    for (; idx + 16 <= size; idx += 16) {
+        __m128i v = _mm_loadu_si128((__m128i *)(data + idx));
+        v = _mm_xor_si128(v, sse2_range(v, lo, hi));
+        _mm_storeu_si128((__m128i *)(data + idx), v);
+    }
+#endif
+
+    for (; idx + 8 <= size; idx += 8) {
+        uint64_t w;
+        memcpy(&w, data + idx, 8);
+        w ^= swar_range(w, lo, hi);
+        memcpy(data + idx, &w, 8);
+    }
+
+    for (; idx < size; idx++)
+        if (data[idx] >= lo && data[idx] <= hi)
+            data[idx] ^= 0x20;
+}
 
-    if (buf->size == 0)
+/**
+ * Flip the case bit of bytes of buf within [lo, hi], the runs before and
+ * after the gap. O(n)
+ */
+static void
+case_flip_buf(buf_t *buf, uint8_t lo, uint8_t hi)
+{
+    if (buf->gaplen == 0) {
+        case_flip(buf->data, buf->size, lo, hi);
         return;
+    }
 
-    uint8_t tmp;
+    case_flip(buf->data, buf->gap, lo, hi);
+    case_flip(buf->data + buf->gap + buf->gaplen, buf->size - buf->gap,
+            lo, hi);
+}
+
+/**
+ * Get the first index where `a` and `b` differ ignoring case, or `size`
+ * if none. O(n)
+ */
+static size_t
+case_mismatch(uint8_t *a, uint8_t *b, size_t size)
+{
     size_t idx = 0;
-    // buf->size >= 1 was already gauranteed
-    size_t end = buf->size - 1;
-
-    while (idx < end) {
-        // swap
-        tmp = buf->data[idx];
-        buf->data[idx] = buf->data[end];
-        buf->data[end] = tmp;
-        // move
-        idx ++;
-        end --;
+
+#ifdef HAVE_SSE2
+    for (; idx + 16 <= size; idx += 16) {
+        __m128i x = _mm_loadu_si128((__m128i *)(a + idx));
+        __m128i y = _mm_loadu_si128((__m128i *)(b + idx));
+        x = _mm_or_si128(x, sse2_range(x, 'A', 'Z'));
+        y = _mm_or_si128(y, sse2_range(y, 'A', 'Z'));
+
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+
+        if (mask != 0)
+            return idx + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; idx + 8 <= size; idx += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + idx, 8);
+        memcpy(&y, b + idx, 8);
+
+        if ((x | swar_range(x, 'A', 'Z')) != (y | swar_range(y, 'A', 'Z')))
+            break;  // the tail loop locates it
     }
+
+    for (; idx < size; idx++)
+        if (fold_lower(a[idx]) != fold_lower(b[idx]))
+            return idx;
+    return size;
+}
+
+/**
+ * Convert ascii letters in buf to lower case in place. O(n)
+ */
+void
+buf_lower(buf_t *buf)
+{
+    assert(buf != NULL);
+
+    case_flip_buf(buf, 'A', 'Z');
+}
+
+/**
+ * Convert ascii letters in buf to upper case in place. O(n)
+ */
+void
+buf_upper(buf_t *buf)
+{
+    assert(buf != NULL);
+
+    case_flip_buf(buf, 'a', 'z');
+}
+
+/**
+ * Compare buf with bytes ignoring ascii case, similar to `strcasecmp`.
+ * O(n)
+ */
+int
+buf_casecmpb(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    size_t len = buf->size < size ? buf->size : size;
+    size_t idx = gap_mismatch(buf, 0, data, len, true);
+
+    if (idx < len)
+        return fold_lower(*buf_at(buf, idx)) - fold_lower(data[idx]);
+
+    if (buf->size == size)
+        return 0;
+    return buf->size > size ? 1 : -1;
+}
+
+/**
+ * Compare buf with string ignoring ascii case. O(n)
+ */
+int
+buf_casecmp(buf_t *buf, char *s)
+{
+    return buf_casecmpb(buf, (uint8_t *)s, strlen(s));
+}
+
+/**
+ * Test if buf equals with bytes ignoring ascii case. O(n)
+ */
+bool
+buf_caseequalsb(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    return buf->size == size &&
+        gap_mismatch(buf, 0, data, size, true) == size;
+}
+
+/**
+ * Test if buf equals with string ignoring ascii case. O(n)
+ */
+bool
+buf_caseequals(buf_t *buf, char *s)
+{
+    return buf_caseequalsb(buf, (uint8_t *)s, strlen(s));
+}
+
+/**
+ * Test if a buf is startswith a prefix ignoring ascii case. O(k)
+ */
+bool
+buf_casestartswithb(buf_t *buf, uint8_t *prefix, size_t size)
+{
+    assert(buf != NULL);
+
+    return size <= buf->size &&
+        gap_mismatch(buf, 0, prefix, size, true) == size;
+}
+
+/**
+ * Test if a buf is startswith a prefix string ignoring ascii case. O(k)
+ */
+bool
+buf_casestartswith(buf_t *buf, char *prefix)
+{
+    return buf_casestartswithb(buf, (uint8_t *)prefix, strlen(prefix));
+}
+
+/**
+ * Test if a buf is endswith a suffix ignoring ascii case. O(k)
+ */
+bool
+buf_caseendswithb(buf_t *buf, uint8_t *suffix, size_t size)
+{
+    assert(buf != NULL);
+
+    return size <= buf->size &&
+        gap_mismatch(buf, buf->size - size, suffix, size, true) == size;
+}
+
+/**
+ * Test if a buf is endswith a suffix string ignoring ascii case. O(k)
+ */
+bool
+buf_caseendswith(buf_t *buf, char *suffix)
+{
+    return buf_caseendswithb(buf, (uint8_t *)suffix, strlen(suffix));
 }
 
 /**
@@ -361,52 +1106,374 @@ buf_reverse(buf_t *buf)
 size_t
 buf_indexc(buf_t *buf, char ch, size_t start)
 {
-    size_t idx;
+    assert(buf != NULL);
+
+    buf_flat(buf);
 
-    for (idx = start; idx < buf->size && buf->data[idx] != (uint8_t)ch;
-            idx++);
+    if (start >= buf->size)
+        return buf->size;
 
-    if (idx < buf->size)
-        return idx;  // match
+    uint8_t *p = memchr(buf->data + start, (uint8_t)ch, buf->size - start);
+
+    if (p != NULL)
+        return p - buf->data;  // match
     return buf->size;
 }
 
 /**
- * Search string in buf by Boyer-Moore algorithm.
+ * Init a finder for bytes `sub`, which is referenced, not copied. The
+ * Boyer-Moore-Horspool table is built once and reused by each find. O(m)
+ */
+void
+buf_finder_init(buf_finder_t *finder, uint8_t *sub, size_t len)
+{
+    assert(finder != NULL);
+
+    size_t idx;
+
+    finder->sub = sub;
+    finder->len = len;
+
+    if (len < 2)
+        return;
+
+    // build bad char table
+    for (idx = 0; idx < MAX_UINT8; idx++)
+        finder->table[idx] = len;
+    for (idx = 0; idx < len - 1; idx++)
+        finder->table[sub[idx]] = len - 1 - idx;
+}
+
+/**
+ * Find the finder bytes in data from `start`, returns `size` if not
+ * found. O(n)
  */
 size_t
-buf_indexs(buf_t *buf, char *sub, size_t start)
+buf_finder_find(buf_finder_t *finder, uint8_t *data, size_t size,
+        size_t start)
 {
-    assert(buf != NULL);
+    assert(finder != NULL);
+
+    uint8_t *sub = finder->sub;
+    size_t len = finder->len;
+
+    if (len == 0)
+        return start < size ? start : size;
+
+    if (start >= size || len > size - start)
+        return size;
+
+    if (len == 1) {
+        uint8_t *p = memchr(data + start, sub[0], size - start);
+        return p != NULL ? (size_t)(p - data) : size;
+    }
 
-    size_t len = strlen(sub);
     size_t last = len - 1;
     size_t idx;
 
-    size_t table[MAX_UINT8] = {0};
+    for (idx = start; idx <= size - len;
+            idx += finder->table[data[idx + last]])
+        if (data[idx + last] == sub[last] &&
+                memcmp(data + idx, sub, last) == 0)
+            return idx;
+
+    return size;
+}
+
+/**
+ * Search bytes in buf by Boyer-Moore-Horspool algorithm.
+ */
+size_t
+buf_indexb(buf_t *buf, uint8_t *sub, size_t len, size_t start)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);
+
+    if (len == 1)
+        return buf_indexc(buf, sub[0], start);
+
+    buf_finder_t finder;
+
+    buf_finder_init(&finder, sub, len);
+    return buf_finder_find(&finder, buf->data, buf->size, start);
+}
+
+/**
+ * Search bytes in buf ignoring ascii case, by Boyer-Moore-Horspool with
+ * both cases of each byte in the shift table. O(n)
+ */
+size_t
+buf_caseindexb(buf_t *buf, uint8_t *sub, size_t len, size_t start)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);
+
+    uint8_t *data = buf->data;
+    size_t size = buf->size;
+
+    if (len == 0)
+        return start < size ? start : size;
+
+    if (start >= size || len > size - start)
+        return size;
+
+    size_t table[MAX_UINT8];
+    size_t last = len - 1;
+    size_t idx;
 
-    // build bad char table
     for (idx = 0; idx < MAX_UINT8; idx++)
         table[idx] = len;
-    for (idx = 0; idx < len; idx++)
-        table[(uint8_t)sub[idx]] = last - idx;
-
-    // search
-    size_t i, j, k, t, skip;
-
-    for (i = start; i < buf->size; i += skip) {
-        skip = 0;
-        for (j = 0; j < len; j++) {
-            k = last - j;
-            if ((uint8_t)sub[k] != buf->data[i + k]) {
-                t = table[buf->data[i + k]];
-                skip = t > j? t - j : 1;
-                break;
+
+    for (idx = 0; idx < last; idx++) {
+        uint8_t c = fold_lower(sub[idx]);
+        table[c] = last - idx;
+        if (c >= 'a' && c <= 'z')
+            table[c ^ 0x20] = last - idx;
+    }
+
+    uint8_t tail = fold_lower(sub[last]);
+
+    for (idx = start; idx <= size - len;
+            idx += table[data[idx + last]])
+        if (fold_lower(data[idx + last]) == tail &&
+                case_mismatch(data + idx, sub, last) == last)
+            return idx;
+
+    return size;
+}
+
+/**
+ * Search string in buf ignoring ascii case.
+ */
+size_t
+buf_caseindexs(buf_t *buf, char *sub, size_t start)
+{
+    return buf_caseindexb(buf, (uint8_t *)sub, strlen(sub), start);
+}
+
+/**
+ * Count non-overlapping occurrences of bytes in buf, an empty `sub`
+ * counts 0. O(n)
+ */
+size_t
+buf_count(buf_t *buf, uint8_t *sub, size_t len)
+{
+    assert(buf != NULL);
+
+    if (len == 0)
+        return 0;
+
+    buf_flat(buf);
+
+    buf_finder_t finder;
+    size_t count = 0;
+    size_t idx = 0;
+
+    buf_finder_init(&finder, sub, len);
+
+    while ((idx = buf_finder_find(&finder, buf->data, buf->size, idx)) <
+            buf->size) {
+        count++;
+        idx += len;
+    }
+    return count;
+}
+
+/**
+ * Find offsets of at most `limit` non-overlapping `sub` in buf, to a new
+ * array set to `offs` (NULL if none found). Returns the count, or
+ * `(size_t)-1` on no memory.
+ */
+static size_t
+find_offsets(buf_t *buf, uint8_t *sub, size_t len, size_t limit,
+        size_t **offs)
+{
+    buf_finder_t finder;
+    size_t count = 0, cap = 0, idx = 0;
+
+    *offs = NULL;
+    buf_flat(buf);
+    buf_finder_init(&finder, sub, len);
+
+    while (count < limit && (idx = buf_finder_find(&finder, buf->data,
+                    buf->size, idx)) < buf->size) {
+        if (count == cap) {
+            cap = cap == 0 ? 16 : cap * 2;
+            size_t *p = realloc(*offs, cap * sizeof(size_t));
+
+            if (p == NULL) {
+                free(*offs);
+                *offs = NULL;
+                return (size_t)-1;
             }
+            *offs = p;
         }
-        if (skip == 0)
-            return i;
+
+        (*offs)[count++] = idx;
+        idx += len;
     }
+    return count;
+}
 
-    return buf->size;
+/**
+ * A replacement pointing into buf is moved by the writes and may be freed
+ * by a grow, copy it to `copy` first.
+ */
+static int
+rep_copy(buf_t *buf, uint8_t **rep, size_t rlen, uint8_t **copy)
+{
+    if (rlen == 0 || buf->data == NULL || *rep < buf->data ||
+            *rep >= buf->data + buf->cap)
+        return BUF_OK;
+    if ((*copy = malloc(rlen)) == NULL)
+        return BUF_ENOMEM;
+    memcpy(*copy, *rep, rlen);
+    *rep = *copy;
+    return BUF_OK;
+}
+
+/**
+ * Replace at most `limit` non-overlapping `sub` with `rep` in place, the
+ * number replaced is set to `count`. One search pass, then the output is
+ * sized exactly and filled by one memmove per segment: forward if `rep`
+ * is not longer than `sub`, else backward from the grown end. O(n)
+ */
+int
+buf_replace(buf_t *buf, uint8_t *sub, size_t len, uint8_t *rep,
+        size_t rlen, size_t limit, size_t *count)
+{
+    assert(buf != NULL && count != NULL);
+
+    size_t *offs;
+    size_t n, i;
+
+    *count = 0;
+
+    if (len == 0)
+        return BUF_EFAILED;
+
+    if ((n = find_offsets(buf, sub, len, limit, &offs)) == (size_t)-1)
+        return BUF_ENOMEM;
+
+    if (n == 0)
+        return BUF_OK;
+
+    uint8_t *copy = NULL;
+
+    if (rep_copy(buf, &rep, rlen, &copy) != BUF_OK) {
+        free(offs);
+        return BUF_ENOMEM;
+    }
+
+    uint8_t *data = buf->data;
+    size_t size = buf->size;
+
+    if (rlen <= len) {
+        size_t w = offs[0];
+
+        for (i = 0; i < n; i++) {
+            size_t end = i + 1 < n ? offs[i + 1] : size;
+            memcpy(data + w, rep, rlen);
+            w += rlen;
+            memmove(data + w, data + offs[i] + len, end - offs[i] - len);
+            w += end - offs[i] - len;
+        }
+
+        buf->size = w;
+    } else {
+        size_t grown = size + n * (rlen - len);
+
+        if (buf_grow(buf, grown) != BUF_OK) {
+            free(copy);
+            free(offs);
+            return BUF_ENOMEM;
+        }
+
+        data = buf->data;
+        size_t w = grown;
+
+        for (i = n; i-- > 0;) {
+            size_t end = i + 1 < n ? offs[i + 1] : size;
+            size_t tail = end - offs[i] - len;
+            w -= tail;
+            memmove(data + w, data + offs[i] + len, tail);
+            w -= rlen;
+            memcpy(data + w, rep, rlen);
+        }
+
+        buf->size = grown;
+    }
+
+    free(copy);
+    free(offs);
+    *count = n;
+    return BUF_OK;
+}
+
+/**
+ * Put `src` to buf with at most `limit` non-overlapping `sub` replaced by
+ * `rep`, the number replaced is set to `count`. buf is grown once to the
+ * exact size. O(n)
+ */
+int
+buf_replace_into(buf_t *buf, buf_t *src, uint8_t *sub, size_t len,
+        uint8_t *rep, size_t rlen, size_t limit, size_t *count)
+{
+    assert(buf != NULL && src != NULL && buf != src && count != NULL);
+
+    size_t *offs;
+    size_t n, i;
+
+    *count = 0;
+
+    if (len == 0)
+        return BUF_EFAILED;
+
+    if ((n = find_offsets(src, sub, len, limit, &offs)) == (size_t)-1)
+        return BUF_ENOMEM;
+
+    size_t size = src->size - n * len + n * rlen;
+    uint8_t *copy = NULL;
+
+    if (n > 0 && rep_copy(buf, &rep, rlen, &copy) != BUF_OK) {
+        free(offs);
+        return BUF_ENOMEM;
+    }
+
+    if (buf_grow(buf, buf->size + size) != BUF_OK) {
+        free(copy);
+        free(offs);
+        return BUF_ENOMEM;
+    }
+
+    uint8_t *w = buf->data + buf->size;
+    size_t r = 0;
+
+    for (i = 0; i < n; i++) {
+        memcpy(w, src->data + r, offs[i] - r);
+        w += offs[i] - r;
+        memcpy(w, rep, rlen);
+        w += rlen;
+        r = offs[i] + len;
+    }
+
+    if (src->size > r)
+        memcpy(w, src->data + r, src->size - r);
+
+    buf->size += size;
+    free(copy);
+    free(offs);
+    *count = n;
+    return BUF_OK;
+}
+
+/**
+ * Search string in buf.
+ */
+size_t
+buf_indexs(buf_t *buf, char *sub, size_t start)
+{
+    return buf_indexb(buf, (uint8_t *)sub, strlen(sub), start);
 }
@@ -1,14 +1,20 @@
 {
+  'variables': {'buf_probes%': 1},
   'targets': [{
     'target_name': 'buf',
       'type': 'static_library',
       'direct_dependent_settings': {
         'include_dirs': [ '.'  ],
+        'conditions': [['buf_probes==0', {'defines': ['BUF_NO_PROBES']}]]
       },
-      'sources': ['./buf.c'],
+      'sources': ['./buf.c', './codec.c', './hash.c',
+                  './deflate.c', './ring.c', './simd.c',
+                  './map.c', './sort.c', './alloc.c', './template.c'],
       'conditions': [
         ['OS=="mac"', {'xcode_settings': {'GCC_C_LANGUAGE_STANDARD': 'c99'}}],
-        ['OS=="solaris"', {'cflags+': [ '-std=c99']}]
+        ['OS=="solaris"', {'cflags+': [ '-std=c99']}],
+        ['OS=="linux"', {'link_settings': {'libraries': ['-lrt']}}],
+        ['buf_probes==0', {'defines': ['BUF_NO_PROBES']}]
       ]
   }]
 }
@@ -41,17 +41,134 @@ typedef enum {
     BUF_EFAILED = 2,
 } buf_error_t;
 
+typedef struct buf_hash64_st {
+    uint64_t total;     /* total bytes hashed */
+    uint64_t v[4];      /* accumulators */
+    uint64_t seed;
+    uint8_t mem[32];    /* pending stripe */
+    size_t len;         /* pending stripe size */
+} buf_hash64_t;
+
+typedef struct buf_finder_st {
+    uint8_t *sub;       /* bytes to find (referenced) */
+    size_t len;         /* bytes size */
+    size_t table[MAX_UINT8];  /* bad char shifts */
+} buf_finder_t;
+
+#define BUF_RING_ALIGN 64
+
+typedef struct buf_ring_st {
+    uint32_t magic;     /* set once initialized */
+    size_t cap;         /* data size, power of 2 */
+    uint8_t pad0[BUF_RING_ALIGN - 2 * sizeof(size_t)];
+    size_t head;        /* consumer: taken end */
+    uint8_t pad1[BUF_RING_ALIGN - sizeof(size_t)];
+    size_t reserve;     /* producers: reserved end */
+    uint8_t pad2[BUF_RING_ALIGN - sizeof(size_t)];
+    size_t tail;        /* producers: committed end */
+    uint8_t pad3[BUF_RING_ALIGN - sizeof(size_t)];
+} buf_ring_t;           /* data follows */
+
+typedef struct buf_allocator_st {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t old, size_t size);
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *ctx;          /* passed to the hooks */
+} buf_allocator_t;
+
+typedef struct buf_arena_block_st {
+    struct buf_arena_block_st *next;
+    size_t size;        /* bytes after the header */
+} buf_arena_block_t;
+
+typedef struct buf_arena_st {
+    buf_allocator_t allocator;  /* hooks on this arena */
+    buf_arena_block_t *blocks;  /* current block first */
+    size_t used;        /* bytes used in the current block */
+    size_t block;       /* min block size */
+    uint8_t *last;      /* last allocation, grown in place */
+} buf_arena_t;
+
 typedef struct buf_st {
     uint8_t *data;      /* real data */
     size_t size;        /* real data size */
     size_t cap;         /* buf cap */
     size_t unit;        /* reallocation unit size */
+    size_t gap;         /* gap offset in data, if gaplen > 0 */
+    size_t gaplen;      /* gap size, 0 if data is flat */
+    buf_allocator_t *allocator;  /* owner of data */
 } buf_t;
 
+typedef struct buf_key_st {
+    uint8_t *data;      /* key bytes (referenced) */
+    size_t size;        /* key size */
+    size_t ref;         /* caller's tag, e.g. the index of the owner */
+} buf_key_t;
+
+typedef struct buf_map_slot_st {
+    uint32_t hash;      /* low 32 bits of the key hash */
+    uint32_t entry;     /* entry index + 1, 0 if empty */
+} buf_map_slot_t;
+
+typedef struct buf_map_entry_st {
+    uint64_t hash;      /* key hash */
+    size_t off;         /* key offset in the arena */
+    size_t len;         /* key size, BUF_MAP_DELETED if deleted */
+    double value;
+} buf_map_entry_t;
+
+#define BUF_MAP_DELETED ((size_t)-1)
+
+typedef struct buf_map_st {
+    buf_map_slot_t *slots;      /* open addressing, linear probing */
+    size_t cap;                 /* slots, power of 2 */
+    buf_map_entry_t *entries;   /* in insertion order */
+    size_t nentries;            /* entries used, deleted ones included */
+    size_t ecap;                /* entries cap */
+    size_t size;                /* live keys */
+    uint8_t *keys;              /* key bytes arena */
+    size_t ksize;               /* arena used */
+    size_t kcap;                /* arena cap */
+    uint64_t seed;              /* key hash seed, random per map */
+} buf_map_t;
+
+typedef struct buf_tpl_seg_st {
+    size_t off;         /* literal offset in template bytes */
+    size_t len;         /* literal size */
+    size_t slot;        /* slot filled after the literal, or BUF_TPL_END */
+} buf_tpl_seg_t;
+
+#define BUF_TPL_END ((size_t)-1)
+
+typedef struct buf_tpl_st {
+    uint8_t *bytes;     /* literals, holes cut out */
+    size_t size;        /* literal bytes */
+    buf_tpl_seg_t *segs;
+    size_t nsegs;       /* holes + 1 */
+    size_t nslots;      /* values to render */
+} buf_tpl_t;
+
+typedef struct buf_append_slot_st {
+    buf_t *buf;         /* storage, size is set once sealed */
+    size_t commit;      /* committed prefix */
+    size_t limit;       /* offset of the first reservation not fitting */
+    int state;          /* free, live or sealed */
+    uint8_t pad[BUF_RING_ALIGN - 3 * sizeof(size_t) - sizeof(int)];
+} buf_append_slot_t;
+
+typedef struct buf_append_st {
+    uint64_t word;      /* generation << 40 | reserved offset */
+    uint8_t pad[BUF_RING_ALIGN - sizeof(uint64_t)];
+    buf_append_slot_t slots[2];
+    size_t cap;         /* bytes each slot holds */
+} buf_append_t;
+
 
 buf_t *buf_new(size_t);
+buf_t *buf_new_with(size_t, buf_allocator_t *);
 void buf_free(buf_t *);
 void buf_clear(buf_t *);
+void buf_swap(buf_t *, buf_t *);
 int buf_grow(buf_t *, size_t);
 char *buf_str(buf_t *);
 void buf_print(buf_t *);
@@ -59,17 +176,118 @@ void buf_println(buf_t *);
 int buf_put(buf_t *, uint8_t *, size_t);
 int buf_putc(buf_t *, char);
 int buf_puts(buf_t *, char *);
+buf_append_t *buf_append_new(size_t);
+void buf_append_free(buf_append_t *);
+int buf_append_put(buf_append_t *, uint8_t *, size_t);
+size_t buf_append_peek(buf_append_t *, uint8_t **);
+int buf_append_seal(buf_append_t *);
+int buf_append_take(buf_append_t *, buf_t *);
 size_t buf_lrm(buf_t *, size_t);
 size_t buf_rrm(buf_t *, size_t);
+void buf_flat(buf_t *);
+uint8_t *buf_at(buf_t *, size_t);
+int buf_splice(buf_t *, size_t, size_t, uint8_t *, size_t);
+int buf_insert(buf_t *, size_t, uint8_t *, size_t);
+size_t buf_remove(buf_t *, size_t, size_t);
 int buf_sprintf(buf_t *, const char *, ...);
-bool buf_isspace(buf_t *);
 int buf_cmp(buf_t *, char *);
+int buf_cmpb(buf_t *, uint8_t *, size_t);
 bool buf_equals(buf_t *, char *);
+bool buf_equalsb(buf_t *, uint8_t *, size_t);
 bool buf_startswith(buf_t *, char *);
+bool buf_startswithb(buf_t *, uint8_t *, size_t);
 bool buf_endswith(buf_t *, char *);
-void buf_reverse(buf_t *);
+bool buf_endswithb(buf_t *, uint8_t *, size_t);
+void buf_lower(buf_t *);
+void buf_upper(buf_t *);
+int buf_casecmp(buf_t *, char *);
+int buf_casecmpb(buf_t *, uint8_t *, size_t);
+bool buf_caseequals(buf_t *, char *);
+bool buf_caseequalsb(buf_t *, uint8_t *, size_t);
+bool buf_casestartswith(buf_t *, char *);
+bool buf_casestartswithb(buf_t *, uint8_t *, size_t);
+bool buf_caseendswith(buf_t *, char *);
+bool buf_caseendswithb(buf_t *, uint8_t *, size_t);
 size_t buf_indexc(buf_t *, char, size_t);
 size_t buf_indexs(buf_t *, char *, size_t);
+size_t buf_indexb(buf_t *, uint8_t *, size_t, size_t);
+size_t buf_caseindexs(buf_t *, char *, size_t);
+size_t buf_caseindexb(buf_t *, uint8_t *, size_t, size_t);
+size_t buf_count(buf_t *, uint8_t *, size_t);
+int buf_replace(buf_t *, uint8_t *, size_t, uint8_t *, size_t, size_t,
+        size_t *);
+int buf_replace_into(buf_t *, buf_t *, uint8_t *, size_t, uint8_t *, size_t,
+        size_t, size_t *);
+void buf_finder_init(buf_finder_t *, uint8_t *, size_t);
+size_t buf_finder_find(buf_finder_t *, uint8_t *, size_t, size_t);
+
+/* alloc.c */
+extern buf_allocator_t buf_system_allocator;
+void buf_set_allocator(buf_allocator_t *);
+buf_allocator_t *buf_get_allocator(void);
+buf_arena_t *buf_arena_new(size_t);
+void buf_arena_free(buf_arena_t *);
+void buf_arena_reset(buf_arena_t *);
+
+/* codec.c */
+int buf_hexencode(buf_t *, uint8_t *, size_t, char);
+int buf_hexdecode(buf_t *, uint8_t *, size_t);
+int buf_b64encode(buf_t *, uint8_t *, size_t);
+int buf_b64decode(buf_t *, uint8_t *, size_t);
+int buf_hexdump(buf_t *, uint8_t *, size_t, size_t);
+bool buf_isascii(uint8_t *, size_t);
+bool buf_isutf8(uint8_t *, size_t);
+
+/* hash.c */
+uint32_t buf_crc32(uint32_t, uint8_t *, size_t);
+uint32_t buf_crc32c(uint32_t, uint8_t *, size_t);
+uint64_t buf_hash64(uint8_t *, size_t, uint64_t);
+void buf_hash64_init(buf_hash64_t *, uint64_t);
+void buf_hash64_update(buf_hash64_t *, uint8_t *, size_t);
+uint64_t buf_hash64_digest(buf_hash64_t *);
+
+/* ring.c */
+buf_ring_t *buf_ring_new(char *, size_t);
+buf_ring_t *buf_ring_open(char *);
+void buf_ring_free(buf_ring_t *);
+int buf_ring_unlink(char *);
+size_t buf_ring_size(buf_ring_t *);
+int buf_ring_reserve(buf_ring_t *, size_t, size_t *);
+void buf_ring_write(buf_ring_t *, size_t, uint8_t *, size_t);
+void buf_ring_commit(buf_ring_t *, size_t, size_t);
+int buf_ring_put(buf_ring_t *, uint8_t *, size_t);
+int buf_ring_take(buf_ring_t *, buf_t *, size_t);
+bool buf_ring_wait(buf_ring_t *, size_t, bool, long);
+
+/* simd.c */
+bool buf_isspace(buf_t *);
+size_t buf_ltrim(buf_t *);
+size_t buf_rtrim(buf_t *);
+size_t buf_countc(buf_t *, char);
+void buf_reverse(buf_t *);
+void buf_histogram(buf_t *, size_t *);
+int buf_putjson(buf_t *, uint8_t *, size_t);
+
+/* map.c */
+buf_map_t *buf_map_new(size_t);
+void buf_map_free(buf_map_t *);
+void buf_map_clear(buf_map_t *);
+double *buf_map_get(buf_map_t *, uint8_t *, size_t);
+int buf_map_put(buf_map_t *, uint8_t *, size_t, double **);
+bool buf_map_del(buf_map_t *, uint8_t *, size_t);
+size_t buf_map_next(buf_map_t *, size_t, uint8_t **, size_t *, double **);
+
+/* template.c */
+buf_tpl_t *buf_tpl_new(uint8_t *, size_t, uint8_t **, size_t *, size_t);
+void buf_tpl_free(buf_tpl_t *);
+int buf_tpl_render(buf_t *, buf_tpl_t *, uint8_t **, size_t *);
+
+/* sort.c */
+int buf_sort(buf_key_t *, size_t, bool);
+
+/* deflate.c */
+int buf_deflate(buf_t *, uint8_t *, size_t, int, bool);
+int buf_inflate(buf_t *, uint8_t *, size_t);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,473 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "buf.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static const char b64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* hex char => nibble, -1 for invalid chars */
+static const int8_t hex_table[MAX_UINT8] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/* base64 char => 6 bits, -1 for invalid chars (accepts url-safe '-' '_') */
+static const int8_t b64_table[MAX_UINT8] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, 62, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+#if defined(__SSE2__)
+/**
+ * Encode 16 bytes to 32 hex chars.
+ */
+static inline void
+hexencode16(char *dst, const uint8_t *src)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    __m128i lo = _mm_and_si128(v, mask);
+
+    hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+            _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+    lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+            _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+
+    _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+/**
+ * Decode 32 hex chars to 16 bytes, returns false on invalid chars.
+ */
+static inline bool
+hexdecode16(uint8_t *dst, const uint8_t *src)
+{
+    const __m128i minus1 = _mm_set1_epi8(-1);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i six = _mm_set1_epi8(6);
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i alpha = _mm_set1_epi8('a');
+    const __m128i low8 = _mm_set1_epi16(0x00ff);
+
+    __m128i out[2];
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + 16 * i));
+        __m128i d = _mm_sub_epi8(c, zero);
+        __m128i l = _mm_sub_epi8(_mm_or_si128(c, lower), alpha);
+        __m128i isd = _mm_and_si128(_mm_cmpgt_epi8(d, minus1),
+                _mm_cmplt_epi8(d, ten));
+        __m128i isl = _mm_and_si128(_mm_cmpgt_epi8(l, minus1),
+                _mm_cmplt_epi8(l, six));
+
+        if (_mm_movemask_epi8(_mm_or_si128(isd, isl)) != 0xffff)
+            return false;
+
+        // nibbles, then join each (hi, lo) pair in a 16 bits lane
+        __m128i v = _mm_or_si128(_mm_and_si128(isd, d),
+                _mm_and_si128(isl, _mm_add_epi8(l, ten)));
+        out[i] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, low8), 4),
+                _mm_srli_epi16(v, 8));
+    }
+
+    _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(out[0], out[1]));
+    return true;
+}
+#endif
+
+/**
+ * Grow buf to `size`, rebase `*data` if it points into buf itself.
+ */
+static int
+grow_alias(buf_t *buf, uint8_t **data, size_t size)
+{
+    bool alias = buf->data != NULL && *data >= buf->data &&
+        *data < buf->data + buf->cap;
+    size_t off = alias ? (size_t)(*data - buf->data) : 0;
+    int res = buf_grow(buf, size);
+
+    if (alias)
+        *data = buf->data + off;
+    return res;
+}
+
+/**
+ * Put hex encoded data to buf, bytes are joined by `sep` unless it's
+ * '\0'. O(n)
+ */
+int
+buf_hexencode(buf_t *buf, uint8_t *data, size_t size, char sep)
+{
+    assert(buf != NULL);
+
+    if (size == 0)
+        return BUF_OK;
+
+    size_t len = sep == '\0' ? size * 2 : size * 3 - 1;
+    int res = grow_alias(buf, &data, buf->size + len);
+
+    if (res != BUF_OK)
+        return res;
+
+    char *dst = (char *)buf->data + buf->size;
+    size_t idx = 0;
+
+    if (sep == '\0') {
+#if defined(__SSE2__)
+        for (; idx + 16 <= size; idx += 16, dst += 32)
+            hexencode16(dst, data + idx);
+#endif
+        for (; idx < size; idx++) {
+            *dst++ = hex_digits[data[idx] >> 4];
+            *dst++ = hex_digits[data[idx] & 0x0f];
+        }
+    } else {
+        for (; idx < size; idx++) {
+            if (idx > 0)
+                *dst++ = sep;
+            *dst++ = hex_digits[data[idx] >> 4];
+            *dst++ = hex_digits[data[idx] & 0x0f];
+        }
+    }
+
+    buf->size += len;
+    return BUF_OK;
+}
+
+/**
+ * Put bytes decoded from hex string to buf, fails on odd length or
+ * invalid chars. O(n)
+ */
+int
+buf_hexdecode(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    if (size % 2 != 0)
+        return BUF_EFAILED;
+
+    int res = grow_alias(buf, &data, buf->size + size / 2);
+
+    if (res != BUF_OK)
+        return res;
+
+    uint8_t *dst = buf->data + buf->size;
+    size_t idx = 0;
+
+#if defined(__SSE2__)
+    for (; idx + 32 <= size; idx += 32, dst += 16)
+        if (!hexdecode16(dst, data + idx))
+            break;
+#endif
+
+    for (; idx < size; idx += 2) {
+        int8_t hi = hex_table[data[idx]];
+        int8_t lo = hex_table[data[idx + 1]];
+
+        if (hi < 0 || lo < 0)
+            return BUF_EFAILED;
+        *dst++ = (uint8_t)(hi << 4 | lo);
+    }
+
+    buf->size += size / 2;
+    return BUF_OK;
+}
+
+/**
+ * Put base64 encoded data to buf (with padding). O(n)
+ */
+int
+buf_b64encode(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    size_t len = (size + 2) / 3 * 4;
+    int res = grow_alias(buf, &data, buf->size + len);
+
+    if (res != BUF_OK)
+        return res;
+
+    char *dst = (char *)buf->data + buf->size;
+    size_t idx;
+    uint32_t v;
+
+    for (idx = 0; idx + 3 <= size; idx += 3) {
+        v = (uint32_t)data[idx] << 16 | data[idx + 1] << 8 | data[idx + 2];
+        *dst++ = b64_digits[v >> 18];
+        *dst++ = b64_digits[(v >> 12) & 0x3f];
+        *dst++ = b64_digits[(v >> 6) & 0x3f];
+        *dst++ = b64_digits[v & 0x3f];
+    }
+
+    if (idx < size) {
+        v = (uint32_t)data[idx] << 16;
+        if (idx + 1 < size)
+            v |= data[idx + 1] << 8;
+        *dst++ = b64_digits[v >> 18];
+        *dst++ = b64_digits[(v >> 12) & 0x3f];
+        *dst++ = idx + 1 < size ? b64_digits[(v >> 6) & 0x3f] : '=';
+        *dst++ = '=';
+    }
+
+    buf->size += len;
+    return BUF_OK;
+}
+
+/**
+ * Put bytes decoded from base64 string to buf, padding is optional and
+ * url-safe chars are accepted. O(n)
+ */
+int
+buf_b64decode(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    // strip padding
+    if (size > 0 && data[size - 1] == '=') size--;
+    if (size > 0 && data[size - 1] == '=') size--;
+
+    if (size % 4 == 1)
+        return BUF_EFAILED;
+
+    size_t len = size / 4 * 3 + (size % 4 ? size % 4 - 1 : 0);
+    int res = grow_alias(buf, &data, buf->size + len);
+
+    if (res != BUF_OK)
+        return res;
+
+    uint8_t *dst = buf->data + buf->size;
+    size_t idx;
+    int32_t a, b, c, d;
+
+    for (idx = 0; idx + 4 <= size; idx += 4) {
+        a = b64_table[data[idx]];
+        b = b64_table[data[idx + 1]];
+        c = b64_table[data[idx + 2]];
+        d = b64_table[data[idx + 3]];
+
+        if ((a | b | c | d) < 0)
+            return BUF_EFAILED;
+
+        uint32_t v = (uint32_t)(a << 18 | b << 12 | c << 6 | d);
+        *dst++ = (uint8_t)(v >> 16);
+        *dst++ = (uint8_t)(v >> 8);
+        *dst++ = (uint8_t)v;
+    }
+
+    if (idx < size) {
+        a = b64_table[data[idx]];
+        b = b64_table[data[idx + 1]];
+        c = idx + 2 < size ? b64_table[data[idx + 2]] : 0;
+
+        if ((a | b | c) < 0)
+            return BUF_EFAILED;
+
+        uint32_t v = (uint32_t)(a << 18 | b << 12 | c << 6);
+        *dst++ = (uint8_t)(v >> 16);
+        if (idx + 2 < size)
+            *dst++ = (uint8_t)(v >> 8);
+    }
+
+    buf->size += len;
+    return BUF_OK;
+}
+
+/**
+ * Put `hexdump -C` style dump of data to buf, `offset` is the address
+ * of the first byte. O(n)
+ */
+int
+buf_hexdump(buf_t *buf, uint8_t *data, size_t size, size_t offset)
+{
+    assert(buf != NULL);
+
+    // offset + 2 + 16 * 3 + 1 + 2 + 16 ascii + 2
+    char line[96];
+    size_t idx, i;
+    bool squeezed = false;
+    int res;
+
+    for (idx = 0; idx < size; idx += 16) {
+        size_t n = size - idx < 16 ? size - idx : 16;
+
+        // squeeze lines equal to the previous one
+        if (idx > 0 && n == 16 &&
+                memcmp(data + idx, data + idx - 16, 16) == 0) {
+            if (!squeezed && (res = buf_puts(buf, "*\n")) != BUF_OK)
+                return res;
+            squeezed = true;
+            continue;
+        }
+
+        squeezed = false;
+        char *p = line + snprintf(line, sizeof(line), "%08lx  ",
+                (unsigned long)(offset + idx));
+
+        for (i = 0; i < 16; i++) {
+            if (i < n) {
+                *p++ = hex_digits[data[idx + i] >> 4];
+                *p++ = hex_digits[data[idx + i] & 0x0f];
+            } else {
+                *p++ = ' ';
+                *p++ = ' ';
+            }
+            *p++ = ' ';
+            if (i == 7)
+                *p++ = ' ';
+        }
+
+        *p++ = ' ';
+        *p++ = '|';
+
+        for (i = 0; i < n; i++)
+            *p++ = data[idx + i] >= 0x20 && data[idx + i] < 0x7f ?
+                data[idx + i] : '.';
+
+        *p++ = '|';
+        *p++ = '\n';
+
+        if ((res = buf_put(buf, (uint8_t *)line, p - line)) != BUF_OK)
+            return res;
+    }
+
+    return buf_sprintf(buf, "%08lx\n", (unsigned long)(offset + size));
+}
+
+/**
+ * Test if data is pure ascii. O(n)
+ */
+bool
+buf_isascii(uint8_t *data, size_t size)
+{
+    size_t idx = 0;
+
+#if defined(__SSE2__)
+    for (; idx + 64 <= size; idx += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + idx));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + idx + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(data + idx + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(data + idx + 48));
+
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b),
+                        _mm_or_si128(c, d))) != 0)
+            return false;
+    }
+#endif
+
+    uint8_t acc = 0;
+
+    for (; idx < size; idx++)
+        acc |= data[idx];
+    return acc < 0x80;
+}
+
+/**
+ * Test if data is valid utf8 (no overlongs, surrogates or code points
+ * above U+10FFFF). O(n)
+ */
+bool
+buf_isutf8(uint8_t *data, size_t size)
+{
+    size_t idx = 0;
+
+    while (idx < size) {
+#if defined(__SSE2__)
+        // skip ascii runs
+        if (idx + 16 <= size && _mm_movemask_epi8(_mm_loadu_si128(
+                        (const __m128i *)(data + idx))) == 0) {
+            idx += 16;
+            continue;
+        }
+#endif
+        uint8_t ch = data[idx];
+
+        if (ch < 0x80) {
+            idx++;
+            continue;
+        }
+
+        size_t n, k;
+        uint8_t lo = 0x80, hi = 0xbf;  // range of the 2nd byte
+
+        if (ch >= 0xc2 && ch <= 0xdf) {
+            n = 1;
+        } else if (ch >= 0xe0 && ch <= 0xef) {
+            n = 2;
+            if (ch == 0xe0) lo = 0xa0;
+            if (ch == 0xed) hi = 0x9f;
+        } else if (ch >= 0xf0 && ch <= 0xf4) {
+            n = 3;
+            if (ch == 0xf0) lo = 0x90;
+            if (ch == 0xf4) hi = 0x8f;
+        } else {
+            return false;
+        }
+
+        if (size - idx - 1 < n)
+            return false;
+        if (data[idx + 1] < lo || data[idx + 1] > hi)
+            return false;
+        for (k = 2; k <= n; k++)
+            if ((data[idx + k] & 0xc0) != 0x80)
+                return false;
+        idx += n + 1;
+    }
+
+    return true;
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <zlib.h>
+
+#include "buf.h"
+
+/**
+ * Grow buf to hold at least `more` bytes after its data, rebase the
+ * stream input if it points into buf itself.
+ */
+static int
+grow_stream(buf_t *buf, z_stream *zs, size_t more)
+{
+    uint8_t *in = (uint8_t *)zs->next_in;
+    bool alias = buf->data != NULL && in >= buf->data &&
+        in < buf->data + buf->cap;
+    size_t off = alias ? (size_t)(in - buf->data) : 0;
+    size_t size = buf->size + more;
+
+    if (size > BUF_MAX_SIZE)
+        size = BUF_MAX_SIZE;
+
+    if (size <= buf->size)
+        return BUF_ENOMEM;
+
+    int res = buf_grow(buf, size);
+
+    if (alias)
+        zs->next_in = buf->data + off;
+    return res;
+}
+
+/**
+ * Put data deflated (zlib format, or gzip if `gzip`) to buf, by
+ * compression `level` (0~9, -1 for default). O(n)
+ */
+int
+buf_deflate(buf_t *buf, uint8_t *data, size_t size, int level, bool gzip)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);  // output goes to data + size
+
+    z_stream zs;
+    size_t origin = buf->size;
+    int ret, res = BUF_OK;
+
+    memset(&zs, 0, sizeof(zs));
+
+    if (deflateInit2(&zs, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK)
+        return BUF_EFAILED;
+
+    zs.next_in = data;
+    zs.avail_in = size;
+
+    // the bound is exact enough to grow once
+    size_t more = deflateBound(&zs, size);
+
+    do {
+        if (buf->cap - buf->size < more &&
+                (res = grow_stream(buf, &zs, more)) != BUF_OK)
+            break;
+
+        zs.next_out = buf->data + buf->size;
+        zs.avail_out = buf->cap - buf->size;
+        ret = deflate(&zs, Z_FINISH);
+        buf->size = buf->cap - zs.avail_out;
+
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            res = BUF_EFAILED;
+            break;
+        }
+
+        more = buf->size / 2 + 64;
+    } while (ret != Z_STREAM_END);
+
+    deflateEnd(&zs);
+
+    if (res != BUF_OK)
+        buf->size = origin;
+    return res;
+}
+
+/**
+ * Put data inflated (zlib or gzip format, auto detected) to buf. O(n)
+ */
+int
+buf_inflate(buf_t *buf, uint8_t *data, size_t size)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);  // output goes to data + size
+
+    z_stream zs;
+    size_t origin = buf->size;
+    int ret, res = BUF_OK;
+
+    memset(&zs, 0, sizeof(zs));
+
+    if (inflateInit2(&zs, 15 + 32) != Z_OK)
+        return BUF_EFAILED;
+
+    zs.next_in = data;
+    zs.avail_in = size;
+
+    // size hint: gzip trailer has the input size (mod 2^32)
+    size_t more = size * 4 + 64;
+
+    if (size >= 18 && data[0] == 0x1f && data[1] == 0x8b)
+        more = ((size_t)data[size - 4] | (size_t)data[size - 3] << 8 |
+                (size_t)data[size - 2] << 16 |
+                (size_t)data[size - 1] << 24) + 1;
+
+    // deflate ratio is 1032:1 at most, dont trust a larger trailer
+    if (more > size * 1032)
+        more = size * 1032;
+
+    do {
+        if (buf->cap - buf->size < more &&
+                (res = grow_stream(buf, &zs, more)) != BUF_OK)
+            break;
+
+        zs.next_out = buf->data + buf->size;
+        zs.avail_out = buf->cap - buf->size;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        buf->size = buf->cap - zs.avail_out;
+
+        if (ret == Z_BUF_ERROR && zs.avail_out > 0) {
+            // truncated input
+            res = BUF_EFAILED;
+            break;
+        }
+
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            res = ret == Z_MEM_ERROR ? BUF_ENOMEM : BUF_EFAILED;
+            break;
+        }
+
+        more = zs.avail_out > 0 ? 0 : buf->size / 2 + 64;
+    } while (ret != Z_STREAM_END);
+
+    inflateEnd(&zs);
+
+    if (res != BUF_OK)
+        buf->size = origin;
+    return res;
+}
@@ -0,0 +1,281 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "buf.h"
+#include "crc_table.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_SSE42_DISPATCH 1
+#include <nmmintrin.h>
+#endif
+
+/**
+ * Slicing-by-8 crc update, `crc` is the pre-conditioned register.
+ */
+static uint32_t
+crc_slice8(const uint32_t table[8][256], uint32_t crc, const uint8_t *data,
+        size_t size)
+{
+    // align to 8 bytes
+    while (size > 0 && ((uintptr_t)data & 7) != 0) {
+        crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        size--;
+    }
+
+    while (size >= 8) {
+        uint32_t lo = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t hi = (uint32_t)data[4] | (uint32_t)data[5] << 8 |
+            (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+            table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+            table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+            table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size-- > 0)
+        crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+/**
+ * Update crc32 (IEEE 802.3, as zlib) with data, start with crc 0. O(n)
+ */
+uint32_t
+buf_crc32(uint32_t crc, uint8_t *data, size_t size)
+{
+    return ~crc_slice8(crc32_table, ~crc, data, size);
+}
+
+#ifdef HAVE_SSE42_DISPATCH
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *data, size_t size)
+{
+    while (size > 0 && ((uintptr_t)data & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        size--;
+    }
+
+    uint64_t crc64 = crc;
+
+    for (; size >= 8; size -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = (uint32_t)crc64;
+
+    while (size-- > 0)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+/**
+ * Update crc32c (Castagnoli) with data, start with crc 0. Uses the sse4.2
+ * crc32 instruction if the cpu has it. O(n)
+ */
+uint32_t
+buf_crc32c(uint32_t crc, uint8_t *data, size_t size)
+{
+#ifdef HAVE_SSE42_DISPATCH
+    if (__builtin_cpu_supports("sse4.2"))
+        return ~crc32c_sse42(~crc, data, size);
+#endif
+    return ~crc_slice8(crc32c_table, ~crc, data, size);
+}
+
+/*
+ * xxHash64, see https://github.com/Cyan4973/xxHash
+ */
+
+#define PRIME64_1 11400714785074694791ULL
+#define PRIME64_2 14029467366897019727ULL
+#define PRIME64_3 1609587929392839161ULL
+#define PRIME64_4 9650029242287828579ULL
+#define PRIME64_5 2870177450012600261ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+        (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * Init hash64 state by seed.
+ */
+void
+buf_hash64_init(buf_hash64_t *state, uint64_t seed)
+{
+    assert(state != NULL);
+
+    state->total = 0;
+    state->v[0] = seed + PRIME64_1 + PRIME64_2;
+    state->v[1] = seed + PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME64_1;
+    state->seed = seed;
+    state->len = 0;
+}
+
+/**
+ * Feed data to hash64 state. O(n)
+ */
+void
+buf_hash64_update(buf_hash64_t *state, uint8_t *data, size_t size)
+{
+    assert(state != NULL);
+
+    state->total += size;
+
+    // fill pending stripe first
+    if (state->len + size < 32) {
+        if (size > 0)
+            memcpy(state->mem + state->len, data, size);
+        state->len += size;
+        return;
+    }
+
+    if (state->len > 0) {
+        size_t n = 32 - state->len;
+        memcpy(state->mem + state->len, data, n);
+        state->v[0] = xxh64_round(state->v[0], read64(state->mem));
+        state->v[1] = xxh64_round(state->v[1], read64(state->mem + 8));
+        state->v[2] = xxh64_round(state->v[2], read64(state->mem + 16));
+        state->v[3] = xxh64_round(state->v[3], read64(state->mem + 24));
+        data += n;
+        size -= n;
+        state->len = 0;
+    }
+
+    uint64_t v1 = state->v[0], v2 = state->v[1];
+    uint64_t v3 = state->v[2], v4 = state->v[3];
+
+    for (; size >= 32; size -= 32, data += 32) {
+        v1 = xxh64_round(v1, read64(data));
+        v2 = xxh64_round(v2, read64(data + 8));
+        v3 = xxh64_round(v3, read64(data + 16));
+        v4 = xxh64_round(v4, read64(data + 24));
+    }
+
+    state->v[0] = v1;
+    state->v[1] = v2;
+    state->v[2] = v3;
+    state->v[3] = v4;
+
+    if (size > 0)
+        memcpy(state->mem, data, size);
+    state->len = size;
+}
+
+/**
+ * Get hash64 digest, the state can still be updated after. O(1)
+ */
+uint64_t
+buf_hash64_digest(buf_hash64_t *state)
+{
+    assert(state != NULL);
+
+    uint64_t h;
+    const uint8_t *p = state->mem;
+    size_t len = state->len;
+
+    if (state->total >= 32) {
+        uint64_t v1 = state->v[0], v2 = state->v[1];
+        uint64_t v3 = state->v[2], v4 = state->v[3];
+
+        h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = state->seed + PRIME64_5;
+    }
+
+    h += state->total;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if (len >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+
+    for (; len > 0; len--, p++) {
+        h ^= (*p) * PRIME64_5;
+        h = ROTL64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Hash data to 64 bits by seed (xxHash64). O(n)
+ */
+uint64_t
+buf_hash64(uint8_t *data, size_t size, uint64_t seed)
+{
+    buf_hash64_t state;
+
+    buf_hash64_init(&state, seed);
+    buf_hash64_update(&state, data, size);
+    return buf_hash64_digest(&state);
+}
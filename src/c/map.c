@@ -0,0 +1,354 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Hash map from bytes to numbers. Slots are 8 bytes (hash bits and entry
+ * index) probed linearly, so a lookup mostly touches one cache line before
+ * the key compare. Entries are kept in insertion order, key bytes are
+ * copied to one arena. Deleted entries are dropped by compaction.
+ */
+
+#include <time.h>
+#include "buf.h"
+
+#define MAP_MIN_CAP 16
+#define MAP_MAX_ENTRIES 0xffffffffU
+
+/**
+ * Hash seed of a new map, so colliding keys can't be precomputed: mixes
+ * the clocks with heap and stack addresses (randomized by aslr).
+ */
+static uint64_t
+map_seed(buf_map_t *map)
+{
+    uint64_t mix[4];
+
+    mix[0] = (uint64_t)time(NULL);
+    mix[1] = (uint64_t)clock();
+    mix[2] = (uint64_t)(uintptr_t)map;
+    mix[3] = (uint64_t)(uintptr_t)&mix;
+    return buf_hash64((uint8_t *)mix, sizeof(mix), mix[0] ^ mix[2]);
+}
+
+/**
+ * Find the slot of the key, or the empty slot to put it.
+ */
+static buf_map_slot_t *
+find_slot(buf_map_t *map, uint8_t *key, size_t len, uint64_t hash)
+{
+    size_t mask = map->cap - 1;
+    size_t idx = (uint32_t)hash & mask;
+
+    for (;; idx = (idx + 1) & mask) {
+        buf_map_slot_t *slot = &map->slots[idx];
+
+        if (slot->entry == 0)
+            return slot;
+
+        if (slot->hash == (uint32_t)hash) {
+            buf_map_entry_t *entry = &map->entries[slot->entry - 1];
+
+            if (entry->len == len && (len == 0 ||
+                        memcmp(map->keys + entry->off, key, len) == 0))
+                return slot;
+        }
+    }
+}
+
+/**
+ * Rebuild slots of live entries with `cap` slots.
+ */
+static int
+rehash(buf_map_t *map, size_t cap)
+{
+    buf_map_slot_t *slots = calloc(cap, sizeof(buf_map_slot_t));
+    size_t mask = cap - 1;
+    size_t i;
+
+    if (slots == NULL)
+        return BUF_ENOMEM;
+
+    for (i = 0; i < map->nentries; i++) {
+        buf_map_entry_t *entry = &map->entries[i];
+
+        if (entry->len == BUF_MAP_DELETED)
+            continue;
+
+        size_t idx = (uint32_t)entry->hash & mask;
+
+        while (slots[idx].entry != 0)
+            idx = (idx + 1) & mask;
+
+        slots[idx].hash = (uint32_t)entry->hash;
+        slots[idx].entry = (uint32_t)(i + 1);
+    }
+
+    free(map->slots);
+    map->slots = slots;
+    map->cap = cap;
+    return BUF_OK;
+}
+
+/**
+ * Drop deleted entries and their key bytes, in place.
+ */
+static int
+compact(buf_map_t *map)
+{
+    size_t r, w = 0, off = 0;
+
+    for (r = 0; r < map->nentries; r++) {
+        buf_map_entry_t entry = map->entries[r];
+
+        if (entry.len == BUF_MAP_DELETED)
+            continue;
+
+        if (entry.len > 0)
+            memmove(map->keys + off, map->keys + entry.off, entry.len);
+
+        entry.off = off;
+        map->entries[w++] = entry;
+        off += entry.len;
+    }
+
+    map->nentries = w;
+    map->ksize = off;
+    return rehash(map, map->cap);
+}
+
+/**
+ * New map with room for `hint` keys before rehashing.
+ */
+buf_map_t *
+buf_map_new(size_t hint)
+{
+    buf_map_t *map = calloc(1, sizeof(buf_map_t));
+    size_t cap = MAP_MIN_CAP;
+
+    if (map == NULL)
+        return NULL;
+
+    while (cap / 4 * 3 < hint && cap <= MAP_MAX_ENTRIES)
+        cap <<= 1;
+
+    map->slots = calloc(cap, sizeof(buf_map_slot_t));
+
+    if (map->slots == NULL) {
+        free(map);
+        return NULL;
+    }
+
+    map->cap = cap;
+    map->seed = map_seed(map);
+    return map;
+}
+
+/**
+ * Free map.
+ */
+void
+buf_map_free(buf_map_t *map)
+{
+    if (map == NULL)
+        return;
+
+    free(map->slots);
+    free(map->entries);
+    free(map->keys);
+    free(map);
+}
+
+/**
+ * Remove all keys, memory is kept for reuse. O(cap)
+ */
+void
+buf_map_clear(buf_map_t *map)
+{
+    assert(map != NULL);
+
+    memset(map->slots, 0, map->cap * sizeof(buf_map_slot_t));
+    map->nentries = 0;
+    map->size = 0;
+    map->ksize = 0;
+}
+
+/**
+ * Get the value of key, NULL if not found. The pointer is valid until the
+ * next put or del. O(1)
+ */
+double *
+buf_map_get(buf_map_t *map, uint8_t *key, size_t len)
+{
+    assert(map != NULL);
+
+    uint64_t hash = buf_hash64(key, len, map->seed);
+    buf_map_slot_t *slot = find_slot(map, key, len, hash);
+
+    if (slot->entry == 0)
+        return NULL;
+    return &map->entries[slot->entry - 1].value;
+}
+
+/**
+ * Get the value of key to `value`, the key is added with value 0 if not
+ * found. The pointer is valid until the next put or del. O(1)
+ */
+int
+buf_map_put(buf_map_t *map, uint8_t *key, size_t len, double **value)
+{
+    assert(map != NULL && value != NULL);
+
+    uint64_t hash = buf_hash64(key, len, map->seed);
+    buf_map_slot_t *slot = find_slot(map, key, len, hash);
+
+    if (slot->entry != 0) {
+        *value = &map->entries[slot->entry - 1].value;
+        return BUF_OK;
+    }
+
+    // keep the load under 3/4
+    if ((map->size + 1) * 4 > map->cap * 3) {
+        if (map->cap > MAP_MAX_ENTRIES || rehash(map, map->cap * 2) != BUF_OK)
+            return BUF_ENOMEM;
+        slot = find_slot(map, key, len, hash);
+    }
+
+    if (map->nentries == map->ecap) {
+        if (map->nentries - map->size >= map->nentries / 2 &&
+                map->nentries > 0) {
+            // half are deleted, reuse them
+            if (compact(map) != BUF_OK)
+                return BUF_ENOMEM;
+        } else {
+            size_t ecap = map->ecap == 0 ? MAP_MIN_CAP : map->ecap * 2;
+            buf_map_entry_t *entries;
+
+            if (map->ecap >= MAP_MAX_ENTRIES)
+                return BUF_ENOMEM;
+            if (ecap > MAP_MAX_ENTRIES)
+                ecap = MAP_MAX_ENTRIES;
+
+            entries = realloc(map->entries, ecap * sizeof(buf_map_entry_t));
+
+            if (entries == NULL)
+                return BUF_ENOMEM;
+
+            map->entries = entries;
+            map->ecap = ecap;
+        }
+        slot = find_slot(map, key, len, hash);
+    }
+
+    if (len > map->kcap - map->ksize) {
+        size_t kcap = map->kcap == 0 ? 256 : map->kcap * 2;
+        uint8_t *keys;
+
+        if (kcap < map->ksize + len)
+            kcap = map->ksize + len;
+
+        if ((keys = realloc(map->keys, kcap)) == NULL)
+            return BUF_ENOMEM;
+
+        map->keys = keys;
+        map->kcap = kcap;
+    }
+
+    buf_map_entry_t *entry = &map->entries[map->nentries];
+
+    if (len > 0)
+        memcpy(map->keys + map->ksize, key, len);
+
+    entry->hash = hash;
+    entry->off = map->ksize;
+    entry->len = len;
+    entry->value = 0;
+
+    slot->hash = (uint32_t)hash;
+    slot->entry = (uint32_t)++map->nentries;
+
+    map->ksize += len;
+    map->size++;
+    *value = &entry->value;
+    return BUF_OK;
+}
+
+/**
+ * Delete key from map, returns false if not found. Following slots are
+ * shifted back, so no tombstones are left in slots. O(1)
+ */
+bool
+buf_map_del(buf_map_t *map, uint8_t *key, size_t len)
+{
+    assert(map != NULL);
+
+    uint64_t hash = buf_hash64(key, len, map->seed);
+    buf_map_slot_t *slot = find_slot(map, key, len, hash);
+
+    if (slot->entry == 0)
+        return false;
+
+    map->entries[slot->entry - 1].len = BUF_MAP_DELETED;
+
+    if (--map->size == 0) {
+        buf_map_clear(map);
+        return true;
+    }
+
+    size_t mask = map->cap - 1;
+    size_t i = slot - map->slots, j = i;
+
+    for (;;) {
+        j = (j + 1) & mask;
+
+        if (map->slots[j].entry == 0)
+            break;
+
+        size_t home = map->slots[j].hash & mask;
+
+        // the hole at i is on the probe path of j
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            map->slots[i] = map->slots[j];
+            i = j;
+        }
+    }
+
+    map->slots[i].hash = 0;
+    map->slots[i].entry = 0;
+    return true;
+}
+
+/**
+ * Iterate entries in insertion order. Start with `idx` 0 and pass the
+ * returned index back, 0 is returned at the end. O(1) amortized
+ */
+size_t
+buf_map_next(buf_map_t *map, size_t idx, uint8_t **key, size_t *len,
+        double **value)
+{
+    assert(map != NULL);
+
+    while (idx < map->nentries) {
+        buf_map_entry_t *entry = &map->entries[idx++];
+
+        if (entry->len != BUF_MAP_DELETED) {
+            *key = map->keys + entry->off;
+            *len = entry->len;
+            *value = &entry->value;
+            return idx;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Static tracepoints (USDT) of provider `bbuf`, scripts are in trace/.
+ * A probe is a nop until a tracer attaches. Probes are built in if
+ * <sys/sdt.h> (systemtap-sdt-dev) is found, configure with
+ * `-Dbuf_probes=0` (defines BUF_NO_PROBES) to compile them out. Bufs are
+ * identified by the address of their buf_t.
+ *
+ *   grow(buf, old_cap, cap, size, moved)   data reallocated
+ *   lrm(buf, removed, moved, cap)          bytes removed from left, moved
+ *   clear(buf, cap, size)                  data released
+ *   free(buf, cap, size)                   buf freed
+ *   put(buf, len, size, cap)               bytes put by buf.put
+ *   copy(buf, target, len)                 bytes copied by buf.copy
+ *   slice(buf, target, len)                bytes copied by buf.slice
+ */
+
+#ifndef __PROBES_H
+#define __PROBES_H
+
+#if !defined(BUF_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BUF_HAVE_PROBES
+#endif
+#endif
+
+#ifdef BUF_HAVE_PROBES
+#define BUF_PROBE3(name, a, b, c)                                            \
+    DTRACE_PROBE3(bbuf, name, a, b, c)
+#define BUF_PROBE4(name, a, b, c, d)                                         \
+    DTRACE_PROBE4(bbuf, name, a, b, c, d)
+#define BUF_PROBE5(name, a, b, c, d, e)                                      \
+    DTRACE_PROBE5(bbuf, name, a, b, c, d, e)
+#else
+#define BUF_PROBE3(name, a, b, c)
+#define BUF_PROBE4(name, a, b, c, d)
+#define BUF_PROBE5(name, a, b, c, d, e)
+#endif
+
+#endif
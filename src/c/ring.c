@@ -0,0 +1,337 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* shm_open, nanosleep, anonymous mmap */
+#endif
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buf.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define RING_MAGIC 0x62627266  /* "bbrf" */
+#define RING_DATA(ring) ((uint8_t *)(ring) + sizeof(buf_ring_t))
+
+#define LOAD(p, order) __atomic_load_n(p, __ATOMIC_##order)
+#define STORE(p, v, order) __atomic_store_n(p, v, __ATOMIC_##order)
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause");
+#endif
+}
+
+/**
+ * Map a ring of `size` bytes (header included) from fd, or anonymous
+ * shared memory if fd is -1.
+ */
+static buf_ring_t *
+ring_map(int fd, size_t size)
+{
+    void *addr;
+
+    if (fd < 0)
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    else
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    return addr == MAP_FAILED ? NULL : (buf_ring_t *)addr;
+}
+
+/**
+ * New ring with at least `cap` bytes of storage (rounded up to a power of
+ * 2) in shared memory: a shm object named `name` that other processes
+ * can open, or an anonymous mapping shared with forked children if
+ * `name` is NULL. Returns NULL on failure.
+ */
+buf_ring_t *
+buf_ring_new(char *name, size_t cap)
+{
+    size_t size = 64;
+    int fd = -1;
+
+    if (cap == 0 || cap > BUF_MAX_SIZE)
+        return NULL;
+
+    while (size < cap)
+        size <<= 1;
+    cap = size;
+    size += sizeof(buf_ring_t);
+
+    if (name != NULL) {
+        if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+            return NULL;
+
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    }
+
+    buf_ring_t *ring = ring_map(fd, size);
+
+    if (fd >= 0)
+        close(fd);
+
+    if (ring == NULL) {
+        if (name != NULL)
+            shm_unlink(name);
+        return NULL;
+    }
+
+    ring->cap = cap;
+    ring->head = 0;
+    ring->reserve = 0;
+    ring->tail = 0;
+    STORE(&ring->magic, RING_MAGIC, RELEASE);
+    return ring;
+}
+
+/**
+ * Open a ring created by `buf_ring_new` with `name`, NULL on failure.
+ */
+buf_ring_t *
+buf_ring_open(char *name)
+{
+    assert(name != NULL);
+
+    struct stat st;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR, 0)) < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(buf_ring_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    buf_ring_t *ring = ring_map(fd, st.st_size);
+    close(fd);
+
+    if (ring == NULL)
+        return NULL;
+
+    if (LOAD(&ring->magic, ACQUIRE) != RING_MAGIC ||
+            ring->cap + sizeof(buf_ring_t) != (size_t)st.st_size) {
+        munmap(ring, st.st_size);
+        return NULL;
+    }
+    return ring;
+}
+
+/**
+ * Unmap ring, the memory is released once all processes unmap it (and
+ * the name is unlinked).
+ */
+void
+buf_ring_free(buf_ring_t *ring)
+{
+    if (ring != NULL)
+        munmap(ring, ring->cap + sizeof(buf_ring_t));
+}
+
+/**
+ * Remove ring name, opened rings are still usable.
+ */
+int
+buf_ring_unlink(char *name)
+{
+    assert(name != NULL);
+    return shm_unlink(name) == 0 ? BUF_OK : BUF_EFAILED;
+}
+
+/**
+ * Get bytes size ready to take. O(1)
+ */
+size_t
+buf_ring_size(buf_ring_t *ring)
+{
+    assert(ring != NULL);
+    return LOAD(&ring->tail, ACQUIRE) - LOAD(&ring->head, ACQUIRE);
+}
+
+/**
+ * Reserve `size` bytes for a producer, the start position is set to `pos`.
+ * Returns BUF_EFAILED if the ring has no room, non-blocking. O(1)
+ */
+int
+buf_ring_reserve(buf_ring_t *ring, size_t size, size_t *pos)
+{
+    assert(ring != NULL && pos != NULL);
+
+    size_t r = LOAD(&ring->reserve, RELAXED);
+
+    do {
+        if (size > ring->cap - (r - LOAD(&ring->head, ACQUIRE)))
+            return BUF_EFAILED;
+    } while (!__atomic_compare_exchange_n(&ring->reserve, &r, r + size,
+                true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    *pos = r;
+    return BUF_OK;
+}
+
+/**
+ * Write data to reserved bytes at `pos`. O(n)
+ */
+void
+buf_ring_write(buf_ring_t *ring, size_t pos, uint8_t *data, size_t size)
+{
+    assert(ring != NULL);
+
+    uint8_t *base = RING_DATA(ring);
+    size_t off = pos & (ring->cap - 1);
+    size_t n = ring->cap - off;
+
+    if (n > size)
+        n = size;
+
+    memcpy(base + off, data, n);
+    memcpy(base, data + n, size - n);
+}
+
+/**
+ * Publish `size` bytes reserved at `pos` to the consumer, waits for the
+ * producers reserved earlier to commit first. O(1)
+ */
+void
+buf_ring_commit(buf_ring_t *ring, size_t pos, size_t size)
+{
+    assert(ring != NULL);
+
+    int spins = 0;
+
+    while (LOAD(&ring->tail, ACQUIRE) != pos) {
+        // the earlier producer may be descheduled, dont burn its cpu
+        if (++spins < 1000)
+            cpu_relax();
+        else
+            sched_yield();
+    }
+    STORE(&ring->tail, pos + size, RELEASE);
+}
+
+/**
+ * Put data to ring as a whole, returns BUF_EFAILED if the ring has no
+ * room, non-blocking. O(n)
+ */
+int
+buf_ring_put(buf_ring_t *ring, uint8_t *data, size_t size)
+{
+    size_t pos;
+
+    if (buf_ring_reserve(ring, size, &pos) != BUF_OK)
+        return BUF_EFAILED;
+
+    buf_ring_write(ring, pos, data, size);
+    buf_ring_commit(ring, pos, size);
+    return BUF_OK;
+}
+
+/**
+ * Take at most `max` bytes from ring and put them to buf, single
+ * consumer, non-blocking. O(n)
+ */
+int
+buf_ring_take(buf_ring_t *ring, buf_t *buf, size_t max)
+{
+    assert(ring != NULL && buf != NULL);
+
+    size_t head = LOAD(&ring->head, RELAXED);
+    size_t size = LOAD(&ring->tail, ACQUIRE) - head;
+
+    if (size > max)
+        size = max;
+
+    if (size == 0)
+        return BUF_OK;
+
+    int res = buf_grow(buf, buf->size + size);
+
+    if (res != BUF_OK)
+        return res;
+
+    uint8_t *base = RING_DATA(ring);
+    size_t off = head & (ring->cap - 1);
+    size_t n = ring->cap - off;
+
+    if (n > size)
+        n = size;
+
+    memcpy(buf->data + buf->size, base + off, n);
+    memcpy(buf->data + buf->size + n, base, size - n);
+    buf->size += size;
+    STORE(&ring->head, head + size, RELEASE);
+    return BUF_OK;
+}
+
+/**
+ * Wait until `size` bytes are free to put (if `put`) or ready to take,
+ * up to `timeout` ms (negative to wait forever). Spins first, then
+ * sleeps with backoff. Returns false on timeout.
+ */
+bool
+buf_ring_wait(buf_ring_t *ring, size_t size, bool put, long timeout)
+{
+    assert(ring != NULL);
+
+    struct timespec ts = {0, 1000};
+    long waited = 0;  // ns
+    int spins = 0;
+
+    for (;;) {
+        size_t used = LOAD(&ring->reserve, ACQUIRE) - LOAD(&ring->head,
+                ACQUIRE);
+
+        if (put ? ring->cap - used >= size : buf_ring_size(ring) >= size)
+            return true;
+
+        if (spins < 1000) {
+            spins++;
+            cpu_relax();
+            continue;
+        }
+
+        if (timeout >= 0 && waited >= timeout * 1000000L)
+            return false;
+
+        if (spins < 1100) {
+            spins++;
+            sched_yield();
+            continue;
+        }
+
+        nanosleep(&ts, NULL);
+        waited += ts.tv_nsec;
+
+        if (ts.tv_nsec < 1000000)
+            ts.tv_nsec *= 2;
+    }
+}
@@ -0,0 +1,618 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Byte kernels: each has a scalar version, a sse2 version if the compiler
+ * targets it, and an avx2 version picked at runtime if the cpu has it.
+ */
+
+#include "buf.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AVX2_DISPATCH 1
+#define USE_AVX2() __builtin_cpu_supports("avx2")
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/* spaces are ' ' and '\t' '\n' '\v' '\f' '\r' (0x09~0x0d), as isspace()
+ * in the "C" locale */
+static inline bool
+is_space(uint8_t c)
+{
+    return c == ' ' || (uint8_t)(c - '\t') < 5;
+}
+
+static inline uint64_t
+bswap64(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(v);
+#else
+    v = (v & 0x00000000ffffffffULL) << 32 | v >> 32;
+    v = (v & 0x0000ffff0000ffffULL) << 16 | (v & 0xffff0000ffff0000ULL) >> 16;
+    return (v & 0x00ff00ff00ff00ffULL) << 8 | (v & 0xff00ff00ff00ff00ULL) >> 8;
+#endif
+}
+
+/* json escape of a byte: 0 if none, 'u' for \u00XX */
+static const char json_escapes[MAX_UINT8] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+/*
+ * Scalar kernels
+ */
+
+static size_t
+space_span_scalar(uint8_t *data, size_t size)
+{
+    size_t idx = 0;
+
+    while (idx < size && is_space(data[idx]))
+        idx++;
+    return idx;
+}
+
+static size_t
+space_rspan_scalar(uint8_t *data, size_t end)
+{
+    while (end > 0 && is_space(data[end - 1]))
+        end--;
+    return end;
+}
+
+static size_t
+countc_scalar(uint8_t *data, size_t size, uint8_t ch)
+{
+    size_t count = 0;
+    size_t idx;
+
+    for (idx = 0; idx < size; idx++)
+        count += data[idx] == ch;
+    return count;
+}
+
+/* copy bytes until one to escape in json, returns bytes copied */
+static size_t
+json_copy_scalar(uint8_t *dst, uint8_t *src, size_t size)
+{
+    size_t idx = 0;
+
+    while (idx < size && json_escapes[src[idx]] == 0) {
+        dst[idx] = src[idx];
+        idx++;
+    }
+    return idx;
+}
+
+static void
+reverse_scalar(uint8_t *data, size_t size)
+{
+    size_t i = 0, j = size;
+
+    // 8 bytes from each side a step
+    while (j - i >= 16) {
+        uint64_t a, b;
+        memcpy(&a, data + i, 8);
+        memcpy(&b, data + j - 8, 8);
+        a = bswap64(a);
+        b = bswap64(b);
+        memcpy(data + i, &b, 8);
+        memcpy(data + j - 8, &a, 8);
+        i += 8;
+        j -= 8;
+    }
+
+    while (j - i >= 2) {
+        uint8_t tmp = data[i];
+        data[i++] = data[--j];
+        data[j] = tmp;
+    }
+}
+
+/*
+ * SSE2 kernels
+ */
+
+#ifdef HAVE_SSE2
+/* bitmask of space bytes in v */
+static inline int
+sse2_spaces(__m128i v)
+{
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return _mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+static inline __m128i
+sse2_reverse(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+/* bitmask of bytes to escape in json: '"', '\\' and controls */
+static inline int
+sse2_json(__m128i v)
+{
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+    __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+    __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+    return _mm_movemask_epi8(_mm_or_si128(ctl, _mm_or_si128(quote, slash)));
+}
+
+/* whole vectors are stored, dst has room for size bytes */
+static size_t
+json_copy_sse2(uint8_t *dst, uint8_t *src, size_t size)
+{
+    size_t idx;
+
+    for (idx = 0; idx + 16 <= size; idx += 16) {
+        __m128i v = _mm_loadu_si128((__m128i *)(src + idx));
+        int mask = sse2_json(v);
+
+        _mm_storeu_si128((__m128i *)(dst + idx), v);
+
+        if (mask != 0)
+            return idx + __builtin_ctz(mask);
+    }
+    return idx + json_copy_scalar(dst + idx, src + idx, size - idx);
+}
+
+static size_t
+space_span_sse2(uint8_t *data, size_t size)
+{
+    size_t idx;
+
+    for (idx = 0; idx + 16 <= size; idx += 16) {
+        int mask = sse2_spaces(_mm_loadu_si128((__m128i *)(data + idx)));
+
+        if (mask != 0xffff)
+            return idx + __builtin_ctz(~mask);
+    }
+    return idx + space_span_scalar(data + idx, size - idx);
+}
+
+static size_t
+space_rspan_sse2(uint8_t *data, size_t end)
+{
+    for (; end >= 16; end -= 16) {
+        int mask = sse2_spaces(_mm_loadu_si128((__m128i *)(data + end - 16)));
+
+        if (mask != 0xffff)
+            return end - 16 + (32 - __builtin_clz(~mask & 0xffff));
+    }
+    return space_rspan_scalar(data, end);
+}
+
+static size_t
+countc_sse2(uint8_t *data, size_t size, uint8_t ch)
+{
+    __m128i c = _mm_set1_epi8((char)ch);
+    __m128i zero = _mm_setzero_si128();
+    size_t count = 0, idx = 0;
+
+    while (size - idx >= 16) {
+        // byte counters, flushed before they overflow
+        __m128i acc = zero;
+        size_t n = (size - idx) / 16;
+        size_t k;
+
+        if (n > 255)
+            n = 255;
+
+        for (k = 0; k < n; k++, idx += 16)
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(c,
+                        _mm_loadu_si128((__m128i *)(data + idx))));
+
+        acc = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_cvtsi128_si32(acc) +
+            (size_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    }
+    return count + countc_scalar(data + idx, size - idx, ch);
+}
+
+static void
+reverse_sse2(uint8_t *data, size_t size)
+{
+    size_t i = 0, j = size;
+
+    while (j - i >= 32) {
+        __m128i a = _mm_loadu_si128((__m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((__m128i *)(data + j - 16));
+        _mm_storeu_si128((__m128i *)(data + i), sse2_reverse(b));
+        _mm_storeu_si128((__m128i *)(data + j - 16), sse2_reverse(a));
+        i += 16;
+        j -= 16;
+    }
+    reverse_scalar(data + i, j - i);
+}
+#endif
+
+/*
+ * AVX2 kernels
+ */
+
+#ifdef HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static inline uint32_t
+avx2_spaces(__m256i v)
+{
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(t,
+                _mm256_set1_epi8(4)), t);
+    __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(ctl, sp));
+}
+
+__attribute__((target("avx2")))
+static size_t
+json_copy_avx2(uint8_t *dst, uint8_t *src, size_t size)
+{
+    __m256i low = _mm256_set1_epi8(0x1f);
+    __m256i quote = _mm256_set1_epi8('"');
+    __m256i slash = _mm256_set1_epi8('\\');
+    size_t idx;
+
+    for (idx = 0; idx + 32 <= size; idx += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(src + idx));
+        __m256i m = _mm256_or_si256(
+                _mm256_cmpeq_epi8(_mm256_min_epu8(v, low), v),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                    _mm256_cmpeq_epi8(v, slash)));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+
+        _mm256_storeu_si256((__m256i *)(dst + idx), v);
+
+        if (mask != 0)
+            return idx + __builtin_ctz(mask);
+    }
+    return idx + json_copy_scalar(dst + idx, src + idx, size - idx);
+}
+
+__attribute__((target("avx2")))
+static size_t
+space_span_avx2(uint8_t *data, size_t size)
+{
+    size_t idx;
+
+    for (idx = 0; idx + 32 <= size; idx += 32) {
+        uint32_t mask = avx2_spaces(
+                _mm256_loadu_si256((__m256i *)(data + idx)));
+
+        if (mask != 0xffffffff)
+            return idx + __builtin_ctz(~mask);
+    }
+    return idx + space_span_scalar(data + idx, size - idx);
+}
+
+__attribute__((target("avx2")))
+static size_t
+space_rspan_avx2(uint8_t *data, size_t end)
+{
+    for (; end >= 32; end -= 32) {
+        uint32_t mask = avx2_spaces(
+                _mm256_loadu_si256((__m256i *)(data + end - 32)));
+
+        if (mask != 0xffffffff)
+            return end - 32 + (32 - __builtin_clz(~mask));
+    }
+    return space_rspan_scalar(data, end);
+}
+
+__attribute__((target("avx2")))
+static size_t
+countc_avx2(uint8_t *data, size_t size, uint8_t ch)
+{
+    __m256i c = _mm256_set1_epi8((char)ch);
+    __m256i zero = _mm256_setzero_si256();
+    size_t count = 0, idx = 0;
+
+    while (size - idx >= 32) {
+        __m256i acc = zero;
+        size_t n = (size - idx) / 32;
+        size_t k;
+        uint64_t sums[4];
+
+        if (n > 255)
+            n = 255;
+
+        for (k = 0; k < n; k++, idx += 32)
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(c,
+                        _mm256_loadu_si256((__m256i *)(data + idx))));
+
+        _mm256_storeu_si256((__m256i *)sums, _mm256_sad_epu8(acc, zero));
+        count += sums[0] + sums[1] + sums[2] + sums[3];
+    }
+    return count + countc_scalar(data + idx, size - idx, ch);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+avx2_reverse(__m256i v)
+{
+    __m256i mask = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5,
+            4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+            0);
+    v = _mm256_shuffle_epi8(v, mask);
+    return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+__attribute__((target("avx2")))
+static void
+reverse_avx2(uint8_t *data, size_t size)
+{
+    size_t i = 0, j = size;
+
+    while (j - i >= 64) {
+        __m256i a = _mm256_loadu_si256((__m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((__m256i *)(data + j - 32));
+        _mm256_storeu_si256((__m256i *)(data + i), avx2_reverse(b));
+        _mm256_storeu_si256((__m256i *)(data + j - 32), avx2_reverse(a));
+        i += 32;
+        j -= 32;
+    }
+    reverse_scalar(data + i, j - i);
+}
+#endif
+
+/*
+ * Dispatchers
+ */
+
+static size_t
+space_span(uint8_t *data, size_t size)
+{
+#ifdef HAVE_AVX2_DISPATCH
+    if (USE_AVX2())
+        return space_span_avx2(data, size);
+#endif
+#ifdef HAVE_SSE2
+    return space_span_sse2(data, size);
+#else
+    return space_span_scalar(data, size);
+#endif
+}
+
+static size_t
+space_rspan(uint8_t *data, size_t size)
+{
+#ifdef HAVE_AVX2_DISPATCH
+    if (USE_AVX2())
+        return space_rspan_avx2(data, size);
+#endif
+#ifdef HAVE_SSE2
+    return space_rspan_sse2(data, size);
+#else
+    return space_rspan_scalar(data, size);
+#endif
+}
+
+static size_t
+json_copy(uint8_t *dst, uint8_t *src, size_t size)
+{
+#ifdef HAVE_AVX2_DISPATCH
+    if (USE_AVX2())
+        return json_copy_avx2(dst, src, size);
+#endif
+#ifdef HAVE_SSE2
+    return json_copy_sse2(dst, src, size);
+#else
+    return json_copy_scalar(dst, src, size);
+#endif
+}
+
+/**
+ * Test if a buf is space. O(n)
+ */
+bool
+buf_isspace(buf_t *buf)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);
+    return buf->size > 0 && space_span(buf->data, buf->size) == buf->size;
+}
+
+/**
+ * Get the index of the first non space byte in buf, buf size if there is
+ * none. buf is not changed. O(n)
+ */
+size_t
+buf_ltrim(buf_t *buf)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);
+    return space_span(buf->data, buf->size);
+}
+
+/**
+ * Get the index after the last non space byte in buf, 0 if there is
+ * none. buf is not changed. O(n)
+ */
+size_t
+buf_rtrim(buf_t *buf)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);
+    return space_rspan(buf->data, buf->size);
+}
+
+/**
+ * Count a byte in buf. O(n)
+ */
+size_t
+buf_countc(buf_t *buf, char ch)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);
+
+#ifdef HAVE_AVX2_DISPATCH
+    if (USE_AVX2())
+        return countc_avx2(buf->data, buf->size, (uint8_t)ch);
+#endif
+#ifdef HAVE_SSE2
+    return countc_sse2(buf->data, buf->size, (uint8_t)ch);
+#else
+    return countc_scalar(buf->data, buf->size, (uint8_t)ch);
+#endif
+}
+
+/**
+ * Reverse buf in place. O(n)
+ */
+void
+buf_reverse(buf_t *buf)
+{
+    assert(buf != NULL);
+
+    buf_flat(buf);
+
+#ifdef HAVE_AVX2_DISPATCH
+    if (USE_AVX2()) {
+        reverse_avx2(buf->data, buf->size);
+        return;
+    }
+#endif
+#ifdef HAVE_SSE2
+    reverse_sse2(buf->data, buf->size);
+#else
+    reverse_scalar(buf->data, buf->size);
+#endif
+}
+
+/**
+ * Add the count of each byte value in buf to `bins` (256 of them). Four
+ * interleaved tables keep repeated bytes from stalling on one counter,
+ * gathers and scatters don't pay off with sse2/avx2. O(n)
+ */
+void
+buf_histogram(buf_t *buf, size_t *bins)
+{
+    assert(buf != NULL && bins != NULL);
+
+    buf_flat(buf);
+
+    uint32_t table[4][MAX_UINT8];
+    uint8_t *data = buf->data;
+    size_t size = buf->size;
+    size_t idx = 0, i;
+
+    while (idx < size) {
+        // uint32 counters, flushed every 1gb
+        size_t end = size - idx > (1 << 30) ? idx + (1 << 30) : size;
+
+        memset(table, 0, sizeof(table));
+
+        for (; idx + 4 <= end; idx += 4) {
+            table[0][data[idx]]++;
+            table[1][data[idx + 1]]++;
+            table[2][data[idx + 2]]++;
+            table[3][data[idx + 3]]++;
+        }
+
+        for (; idx < end; idx++)
+            table[0][data[idx]]++;
+
+        for (i = 0; i < MAX_UINT8; i++)
+            bins[i] += (size_t)table[0][i] + table[1][i] + table[2][i] +
+                table[3][i];
+    }
+}
+
+/**
+ * Put bytes to buf as a quoted json string, escaped as JSON.stringify
+ * does: '"', '\\' and control bytes, other bytes (utf8) are copied as
+ * they are. Runs without escapes are scanned and copied in one pass by
+ * the simd kernels. buf is not changed on failure. O(n)
+ */
+int
+buf_putjson(buf_t *buf, uint8_t *data, size_t len)
+{
+    assert(buf != NULL);
+
+    static const char hex[] = "0123456789abcdef";
+    // data may point into buf itself, it moves as buf grows
+    bool alias = buf->data != NULL && data >= buf->data &&
+        data < buf->data + buf->cap;
+    size_t off = alias ? (size_t)(data - buf->data) : 0;
+    size_t size = buf->size;
+    size_t idx = 0;
+    int res = BUF_OK;
+
+    if (size + 2 > BUF_MAX_SIZE || len > BUF_MAX_SIZE - size - 2)
+        return BUF_ENOMEM;
+
+    while (res == BUF_OK) {
+        // room for the rest as is, 7 for the next escape and quotes
+        if ((res = buf_grow(buf, buf->size + len - idx + 7)) != BUF_OK)
+            break;
+        if (alias)
+            data = buf->data + off;
+        if (idx == 0)
+            buf->data[buf->size++] = '"';
+
+        size_t run = json_copy(buf->data + buf->size, data + idx, len - idx);
+
+        buf->size += run;
+
+        if ((idx += run) == len) {
+            buf->data[buf->size++] = '"';
+            break;
+        }
+
+        uint8_t c = data[idx++];
+        uint8_t *esc = buf->data + buf->size;
+
+        esc[0] = '\\';
+        esc[1] = json_escapes[c];
+
+        if (esc[1] == 'u') {
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0xf];
+        }
+
+        buf->size += esc[1] == 'u' ? 6 : 2;
+    }
+
+    if (res != BUF_OK)
+        buf->size = size;
+    return res;
+}
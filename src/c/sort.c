@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Sort keys by bytes, shorter keys first on a common prefix (same order
+ * as buf_cmpb).
+ */
+
+#include "buf.h"
+
+#define SORT_SMALL 32       /* buckets smaller are insertion sorted */
+#define SORT_BUCKETS 257    /* key end, then byte values 0~255 */
+
+typedef struct {
+    size_t lo;
+    size_t hi;
+    size_t depth;
+} sort_frame_t;
+
+/**
+ * Compare keys from `depth`, both are known to be equal before it.
+ */
+static inline int
+key_cmp(uint8_t *a, size_t alen, uint8_t *b, size_t blen, size_t depth)
+{
+    size_t len = alen < blen ? alen : blen;
+
+    if (len > depth) {
+        int ret = memcmp(a + depth, b + depth, len - depth);
+
+        if (ret != 0)
+            return ret;
+    }
+
+    if (alen == blen)
+        return 0;
+    return alen < blen ? -1 : 1;
+}
+
+static void
+insertion_sort(buf_key_t *keys, size_t n, size_t depth)
+{
+    size_t i, j;
+
+    for (i = 1; i < n; i++) {
+        buf_key_t key = keys[i];
+
+        for (j = i; j > 0 && key_cmp(keys[j - 1].data, keys[j - 1].size,
+                    key.data, key.size, depth) > 0; j--)
+            keys[j] = keys[j - 1];
+        keys[j] = key;
+    }
+}
+
+/* bucket of a key at depth, 0 if the key ends before */
+static inline size_t
+bucket_of(buf_key_t *key, size_t depth)
+{
+    return depth < key->size ? (size_t)key->data[depth] + 1 : 0;
+}
+
+/**
+ * Sort keys in place by MSD radix sort, small buckets are insertion
+ * sorted with memcmp. Ranges to sort are kept on a heap stack, so long
+ * common prefixes can't overflow the call stack. O(n * k)
+ */
+int
+buf_sort(buf_key_t *keys, size_t n, bool reverse)
+{
+    assert(keys != NULL || n == 0);
+
+    buf_key_t *tmp = NULL;
+    sort_frame_t *stack = NULL;
+    size_t top = 0, cap = 0;
+    size_t counts[SORT_BUCKETS], offs[SORT_BUCKETS];
+
+    if (n >= SORT_SMALL) {
+        cap = 64;
+        tmp = malloc(n * sizeof(buf_key_t));
+        stack = malloc(cap * sizeof(sort_frame_t));
+
+        if (tmp == NULL || stack == NULL) {
+            free(tmp);
+            free(stack);
+            return BUF_ENOMEM;
+        }
+
+        stack[top].lo = 0;
+        stack[top].hi = n;
+        stack[top++].depth = 0;
+    } else {
+        insertion_sort(keys, n, 0);
+    }
+
+    while (top > 0) {
+        sort_frame_t frame = stack[--top];
+        buf_key_t *base = keys + frame.lo;
+        size_t size = frame.hi - frame.lo;
+        size_t depth = frame.depth;
+        size_t i, b;
+
+        if (size < SORT_SMALL) {
+            insertion_sort(base, size, depth);
+            continue;
+        }
+
+        memset(counts, 0, sizeof(counts));
+
+        for (i = 0; i < size; i++)
+            counts[bucket_of(&base[i], depth)]++;
+
+        if (counts[0] == 0 && size > 0 &&
+                counts[bucket_of(&base[0], depth)] == size) {
+            // one bucket, go deeper without moving
+            stack[top].lo = frame.lo;
+            stack[top].hi = frame.hi;
+            stack[top++].depth = depth + 1;
+            continue;
+        }
+
+        for (b = 0, offs[0] = 0; b + 1 < SORT_BUCKETS; b++)
+            offs[b + 1] = offs[b] + counts[b];
+
+        for (i = 0; i < size; i++)
+            tmp[offs[bucket_of(&base[i], depth)]++] = base[i];
+
+        memcpy(base, tmp, size * sizeof(buf_key_t));
+
+        // keys ended (bucket 0) are equal, push the others
+        size_t lo = frame.lo + counts[0];
+
+        for (b = 1; b < SORT_BUCKETS; b++) {
+            if (counts[b] > 1) {
+                if (top == cap) {
+                    sort_frame_t *p = realloc(stack,
+                            cap * 2 * sizeof(sort_frame_t));
+
+                    if (p == NULL) {
+                        free(tmp);
+                        free(stack);
+                        return BUF_ENOMEM;
+                    }
+                    stack = p;
+                    cap *= 2;
+                }
+
+                stack[top].lo = lo;
+                stack[top].hi = lo + counts[b];
+                stack[top++].depth = depth + 1;
+            }
+            lo += counts[b];
+        }
+    }
+
+    free(tmp);
+    free(stack);
+
+    if (reverse) {
+        size_t i, j;
+
+        for (i = 0, j = n; i + 1 < j; i++, j--) {
+            buf_key_t key = keys[i];
+            keys[i] = keys[j - 1];
+            keys[j - 1] = key;
+        }
+    }
+    return BUF_OK;
+}
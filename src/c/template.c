@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2015, Chao Wang (hit9 <hit9@icloud.com>)
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Byte templates: literal segments cut at slot names once, rendered by
+ * sizing the output, one grow and a memcpy per segment and value.
+ */
+
+#include "buf.h"
+
+/**
+ * Slot whose name is at `pos`, the longest one if several, `nslots` if
+ * none.
+ */
+static size_t
+match(uint8_t *data, size_t len, size_t pos, uint8_t **names, size_t *lens,
+        size_t nslots)
+{
+    size_t slot = nslots, i;
+
+    for (i = 0; i < nslots; i++) {
+        if (lens[i] <= len - pos && names[i][0] == data[pos] &&
+                memcmp(data + pos, names[i], lens[i]) == 0 &&
+                (slot == nslots || lens[i] > lens[slot]))
+            slot = i;
+    }
+    return slot;
+}
+
+/**
+ * Compile template bytes, each occurrence of a slot name (not empty) is
+ * a hole for the slot value. Returns NULL on no memory. O(n * m)
+ */
+buf_tpl_t *
+buf_tpl_new(uint8_t *data, size_t len, uint8_t **names, size_t *lens,
+        size_t nslots)
+{
+    assert(data != NULL || len == 0);
+
+    size_t nsegs = 1, pos, slot, i;
+
+    for (i = 0; i < nslots; i++)
+        assert(names[i] != NULL && lens[i] > 0);
+
+    for (pos = 0; pos < len; ) {
+        if ((slot = match(data, len, pos, names, lens, nslots)) < nslots) {
+            nsegs++;
+            pos += lens[slot];
+        } else {
+            pos++;
+        }
+    }
+
+    buf_tpl_t *tpl = calloc(1, sizeof(buf_tpl_t));
+
+    if (tpl == NULL)
+        return NULL;
+
+    tpl->bytes = malloc(len > 0 ? len : 1);
+    tpl->segs = malloc(nsegs * sizeof(buf_tpl_seg_t));
+
+    if (tpl->bytes == NULL || tpl->segs == NULL) {
+        buf_tpl_free(tpl);
+        return NULL;
+    }
+
+    buf_tpl_seg_t *seg = tpl->segs;
+
+    seg->off = 0;
+    seg->len = 0;
+
+    for (pos = 0; pos < len; ) {
+        if ((slot = match(data, len, pos, names, lens, nslots)) < nslots) {
+            seg->slot = slot;
+            seg++;
+            seg->off = tpl->size;
+            seg->len = 0;
+            pos += lens[slot];
+        } else {
+            tpl->bytes[tpl->size++] = data[pos++];
+            seg->len++;
+        }
+    }
+
+    seg->slot = BUF_TPL_END;
+    tpl->nsegs = nsegs;
+    tpl->nslots = nslots;
+    return tpl;
+}
+
+/**
+ * Free template.
+ */
+void
+buf_tpl_free(buf_tpl_t *tpl)
+{
+    if (tpl == NULL)
+        return;
+
+    free(tpl->bytes);
+    free(tpl->segs);
+    free(tpl);
+}
+
+/**
+ * Render template with a value per slot onto the end of buf, the exact
+ * size is grown once. Values may point into the buf itself. O(n)
+ */
+int
+buf_tpl_render(buf_t *buf, buf_tpl_t *tpl, uint8_t **vals, size_t *lens)
+{
+    assert(buf != NULL && buf->unit != 0 && tpl != NULL);
+
+    size_t size = tpl->size, i;
+
+    for (i = 0; i + 1 < tpl->nsegs; i++) {
+        size_t len = lens[tpl->segs[i].slot];
+
+        if (len > BUF_MAX_SIZE - size)
+            return BUF_ENOMEM;
+        size += len;
+    }
+
+    if (size > BUF_MAX_SIZE - buf->size)
+        return BUF_ENOMEM;
+
+    // values in the buf are found again by offset if the data moves
+    uintptr_t old = (uintptr_t)buf->data;
+
+    if (buf_grow(buf, buf->size + size) != BUF_OK)
+        return BUF_ENOMEM;
+
+    uint8_t *p = buf->data + buf->size;
+
+    for (i = 0; i < tpl->nsegs; i++) {
+        buf_tpl_seg_t *seg = &tpl->segs[i];
+
+        if (seg->len > 0) {
+            memcpy(p, tpl->bytes + seg->off, seg->len);
+            p += seg->len;
+        }
+
+        if (seg->slot == BUF_TPL_END || lens[seg->slot] == 0)
+            continue;
+
+        uint8_t *val = vals[seg->slot];
+
+        if ((uintptr_t)val - old < buf->size)
+            val = buf->data + ((uintptr_t)val - old);
+
+        memcpy(p, val, lens[seg->slot]);
+        p += lens[seg->slot];
+    }
+
+    buf->size += size;
+    return BUF_OK;
+}
@@ -0,0 +1,356 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#ifndef _BUF_BASIC_BUF_HH
+#define _BUF_BASIC_BUF_HH
+
+// Header only bytes buffer for native code, no v8 required:
+//
+//   buf::BasicBuf<> b;                 // malloc, doubling, 64 bytes inline
+//   b.Append("key=", 4);
+//   size_t idx = b.Find("=");          // needle length known at compile time
+//   b.Consume(idx + 1);
+//
+// Errors are reported as return values like the C api, no exceptions.
+// Copies are disabled, bufs are moved (C++11) or swapped. View() and Span()
+// are there if the standard library has string_view (C++17) and span
+// (C++20).
+
+#include <string.h>
+#include <buf.h>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+#ifdef __cpp_lib_span
+#include <span>
+#endif
+
+namespace buf {
+
+// Allocator policies, a BasicBuf derives from its allocator so stateless
+// ones take no room. SystemAllocator calls malloc directly (inlined),
+// HookAllocator goes through the buf_set_allocator hooks set at the first
+// allocation: they are kept with the data (and swapped with it), so a
+// later buf_set_allocator can't free it with other hooks.
+struct SystemAllocator {
+    static void *Alloc(size_t size) { return malloc(size); }
+    static void *Realloc(void *ptr, size_t old, size_t size) {
+        (void)old;
+        return realloc(ptr, size);
+    }
+    static void Free(void *ptr, size_t size) { (void)size; free(ptr); }
+};
+
+class HookAllocator {
+public:
+    HookAllocator() : hooks_(NULL) {}
+
+    void *Alloc(size_t size) {
+        hooks_ = buf_get_allocator();
+        return hooks_->alloc(hooks_->ctx, size);
+    }
+    void *Realloc(void *ptr, size_t old, size_t size) {
+        return hooks_->realloc(hooks_->ctx, ptr, old, size);
+    }
+    void Free(void *ptr, size_t size) {
+        hooks_->free(hooks_->ctx, ptr, size);
+        hooks_ = NULL;
+    }
+
+    // Hooks of the allocated data, NULL if none.
+    buf_allocator_t *Hooks() const { return hooks_; }
+private:
+    buf_allocator_t *hooks_;
+};
+
+// Growth policies, the next capacity for at least `need` bytes.
+struct DoublingGrowth {
+    static size_t Next(size_t cap, size_t need) {
+        size_t next = cap > 32 ? cap : 32;
+
+        while (next < need)
+            next *= 2;
+        return next;
+    }
+};
+
+// Exactly what is asked, for bufs filled once.
+struct ExactGrowth {
+    static size_t Next(size_t cap, size_t need) { (void)cap; return need; }
+};
+
+// As buf_grow: capacity increases by whole units.
+template <size_t Unit>
+struct UnitGrowth {
+    static size_t Next(size_t cap, size_t need) {
+        return cap + (need - cap + Unit - 1) / Unit * Unit;
+    }
+};
+
+// Search of needles with length known at compile time: empty ones match
+// at start, short ones are memchr for the first byte and a fixed length
+// memcmp (inlined), long ones use the Horspool finder of buf.c.
+template <size_t Len, bool Short = (Len <= 16)>
+struct FixedFind {
+    static size_t Find(const uint8_t *data, size_t size, const uint8_t *sub,
+            size_t start) {
+        buf_finder_t finder;
+        buf_finder_init(&finder, const_cast<uint8_t *>(sub), Len);
+        return buf_finder_find(&finder, const_cast<uint8_t *>(data), size,
+                start);
+    }
+};
+
+template <size_t Len>
+struct FixedFind<Len, true> {
+    static size_t Find(const uint8_t *data, size_t size, const uint8_t *sub,
+            size_t start) {
+        if (start >= size || Len > size - start)
+            return size;
+
+        const uint8_t *p = data + start;
+        const uint8_t *last = data + size - Len;
+
+        while (p <= last) {
+            p = static_cast<const uint8_t *>(memchr(p, sub[0], last - p + 1));
+
+            if (p == NULL)
+                break;
+            if (memcmp(p + 1, sub + 1, Len - 1) == 0)
+                return p - data;
+            p++;
+        }
+        return size;
+    }
+};
+
+template <>
+struct FixedFind<0, true> {
+    static size_t Find(const uint8_t *data, size_t size, const uint8_t *sub,
+            size_t start) {
+        (void)data;
+        (void)sub;
+        return start < size ? start : size;
+    }
+};
+
+// Bytes buffer owning its data. The first `InlineCapacity` bytes live in
+// the object, larger data is allocated by `Allocator` and grown by
+// `GrowthPolicy`. Size is capped by BUF_MAX_SIZE as C bufs.
+template <typename Allocator = SystemAllocator,
+          typename GrowthPolicy = DoublingGrowth,
+          size_t InlineCapacity = 64>
+class BasicBuf : private Allocator {
+public:
+    BasicBuf() : data_(inline_), size_(0), cap_(InlineCapacity) {}
+
+    ~BasicBuf() {
+        if (data_ != inline_)
+            Allocator::Free(data_, cap_);
+    }
+
+#if __cplusplus >= 201103L
+    BasicBuf(BasicBuf &&other) : data_(inline_), size_(0),
+        cap_(InlineCapacity) {
+        Swap(other);
+    }
+
+    BasicBuf &operator=(BasicBuf &&other) {
+        if (this != &other) {
+            Clear();
+            Swap(other);
+        }
+        return *this;
+    }
+
+    BasicBuf(const BasicBuf &) = delete;
+    BasicBuf &operator=(const BasicBuf &) = delete;
+#endif
+
+    const Allocator &GetAllocator() const { return *this; }
+
+    uint8_t *Data() { return data_; }
+    const uint8_t *Data() const { return data_; }
+    size_t Size() const { return size_; }
+    size_t Capacity() const { return cap_; }
+    bool Empty() const { return size_ == 0; }
+    bool IsInline() const { return data_ == inline_; }
+
+#if __cplusplus >= 201703L
+    std::string_view View() const {
+        return std::string_view(reinterpret_cast<const char *>(data_), size_);
+    }
+#endif
+#ifdef __cpp_lib_span
+    std::span<uint8_t> Span() { return std::span<uint8_t>(data_, size_); }
+    std::span<const uint8_t> Span() const {
+        return std::span<const uint8_t>(data_, size_);
+    }
+#endif
+
+    // Make room for `cap` bytes in all, returns false on no memory.
+    bool Reserve(size_t cap) {
+        if (cap <= cap_)
+            return true;
+        if (cap > BUF_MAX_SIZE)
+            return false;
+
+        size_t next = GrowthPolicy::Next(cap_, cap);
+
+        if (next > BUF_MAX_SIZE)
+            next = BUF_MAX_SIZE;
+
+        uint8_t *data;
+
+        if (data_ == inline_) {
+            data = static_cast<uint8_t *>(Allocator::Alloc(next));
+            if (data != NULL && size_ > 0)
+                memcpy(data, inline_, size_);
+        } else {
+            data = static_cast<uint8_t *>(
+                    Allocator::Realloc(data_, cap_, next));
+        }
+
+        if (data == NULL)
+            return false;
+
+        data_ = data;
+        cap_ = next;
+        return true;
+    }
+
+    // Make room for `len` more bytes and return where they go, NULL on no
+    // memory. Size is not changed, call Commit(len) after writing.
+    uint8_t *Prepare(size_t len) {
+        if (len > BUF_MAX_SIZE - size_ || !Reserve(size_ + len))
+            return NULL;
+        return data_ + size_;
+    }
+
+    void Commit(size_t len) { size_ += len; }
+
+    bool Append(const void *data, size_t len) {
+        uint8_t *p = Prepare(len);
+
+        if (p == NULL)
+            return false;
+        if (len > 0)
+            memcpy(p, data, len);
+        size_ += len;
+        return true;
+    }
+
+    bool Append(uint8_t byte) {
+        if (size_ == cap_ && !Reserve(size_ + 1))
+            return false;
+        data_[size_++] = byte;
+        return true;
+    }
+
+    // Remove `len` bytes from the left, returns bytes removed. O(n)
+    size_t Consume(size_t len) {
+        if (len >= size_) {
+            len = size_;
+            size_ = 0;
+            return len;
+        }
+
+        size_ -= len;
+        memmove(data_, data_ + len, size_);
+        return len;
+    }
+
+    // Drop data, memory is kept.
+    void Reset() { size_ = 0; }
+
+    // Drop data and memory.
+    void Clear() {
+        if (data_ != inline_)
+            Allocator::Free(data_, cap_);
+        data_ = inline_;
+        size_ = 0;
+        cap_ = InlineCapacity;
+    }
+
+    // Find bytes from `start`, returns Size() if not found.
+    size_t Find(const uint8_t *sub, size_t len, size_t start = 0) const {
+        if (len == 1)
+            return FixedFind<1>::Find(data_, size_, sub, start);
+
+        buf_finder_t finder;
+        buf_finder_init(&finder, const_cast<uint8_t *>(sub), len);
+        return buf_finder_find(&finder, data_, size_, start);
+    }
+
+    // Find a string literal, specialized on its length.
+    template <size_t N>
+    size_t Find(const char (&sub)[N], size_t start = 0) const {
+        return FixedFind<N - 1>::Find(data_, size_,
+                reinterpret_cast<const uint8_t *>(sub), start);
+    }
+
+    // Exchange data, the allocator state goes with it.
+    void Swap(BasicBuf &other) {
+        if (this == &other)
+            return;
+
+        if (data_ != inline_ && other.data_ != other.inline_) {
+            uint8_t *data = data_;
+            data_ = other.data_;
+            other.data_ = data;
+        } else {
+            // inline data is copied, the sizes are bounded so compilers
+            // see the copies stay in the arrays
+            uint8_t tmp[InlineCapacity > 0 ? InlineCapacity : 1];
+            uint8_t *a = data_ == inline_ ? NULL : data_;
+            uint8_t *b = other.data_ == other.inline_ ? NULL : other.data_;
+            size_t na = InlineSize(size_), nb = InlineSize(other.size_);
+
+            if (a == NULL)
+                memcpy(tmp, inline_, na);
+            if (b == NULL)
+                memcpy(inline_, other.inline_, nb);
+            if (a == NULL)
+                memcpy(other.inline_, tmp, na);
+
+            data_ = b != NULL ? b : inline_;
+            other.data_ = a != NULL ? a : other.inline_;
+        }
+
+        Allocator &mine = *this, &theirs = other;
+        Allocator alloc = mine;
+        mine = theirs;
+        theirs = alloc;
+
+        size_t size = size_, cap = cap_;
+        size_ = other.size_;
+        cap_ = other.cap_;
+        other.size_ = size;
+        other.cap_ = cap;
+    }
+
+private:
+#if __cplusplus < 201103L
+    BasicBuf(const BasicBuf &);
+    BasicBuf &operator=(const BasicBuf &);
+#endif
+
+    static size_t InlineSize(size_t size) {
+        return size < InlineCapacity ? size : InlineCapacity;
+    }
+
+    uint8_t *data_;
+    size_t size_;
+    size_t cap_;
+    uint8_t inline_[InlineCapacity > 0 ? InlineCapacity : 1];
+};
+
+}  // namespace buf
+
+#endif
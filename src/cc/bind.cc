@@ -4,6 +4,9 @@
 #include <v8.h>
 #include <node.h>
 #include "buf.hh"
+#include "ring.hh"
+#include "map.hh"
+#include "template.hh"
 
 using namespace v8;
 
@@ -11,6 +14,9 @@ extern "C" {
     static void init (Handle<Object> exports) {
         NanScope();
         buf::Buf::Initialize(exports);
+        buf::Ring::Initialize(exports);
+        buf::BufMap::Initialize(exports);
+        buf::BufTemplate::Initialize(exports);
     }
     NODE_MODULE(buf, init);
 }
@@ -3,75 +3,145 @@
 
 #include <v8.h>
 #include <node.h>
+#include <vector>
 #include "buf.hh"
+#include "scan.hh"
+#include "template.hh"
 
 using namespace buf;
 
-#define ASSERT_ARGS_LEN(len)                                                 \
-    if (args.Length() != len) {                                              \
-        buf_t *err = buf_new(21);                                            \
-        buf_sprintf(err, "takes exactly %d args", len);                      \
-        NanThrowError(buf_str(err));                                         \
-        buf_free(err);                                                       \
-        return;                                                              \
+// Copy bytes [start, end) of a buf to dst, across the gap.
+static void CopyRange(buf_t *buf, size_t start, size_t end, uint8_t *dst) {
+    if (start >= end)
+        return;
+
+    if (buf->gaplen > 0 && start < buf->gap) {
+        size_t head = (end < buf->gap ? end : buf->gap) - start;
+        memcpy(dst, buf->data + start, head);
+        dst += head;
+        start += head;
+    }
+
+    if (start < end)
+        memcpy(dst, buf_at(buf, start), end - start);
+}
+
+// Put bytes [start, end) of src to another buf dst.
+static int PutRange(buf_t *dst, buf_t *src, size_t start, size_t end) {
+    int ret = buf_grow(dst, dst->size + end - start);
+
+    if (ret == BUF_OK) {
+        CopyRange(src, start, end, dst->data + dst->size);
+        dst->size += end - start;
     }
+    return ret;
+}
+
+// ArgBytes::ArgBytes - bytes of a string/buffer/buf argument without heap
+// copies mostly: buffers and flat bufs are referenced in place, short
+// strings are utf8 encoded onto the inline storage (on the stack), a buf
+// with a gap is copied there, not flattened.
+ArgBytes::ArgBytes(Handle<Value> val) : data(NULL), size(0), ok_(true) {
+    if (Buf::HasInstance(val)) {
+        buf_t *buf = ObjectWrap::Unwrap<Buf>(val->ToObject())->buf;
+
+        if (buf->gaplen == 0) {
+            data = buf->data;
+            size = buf->size;
+            return;
+        }
 
-#define ASSERT_ARGS_LEN_GT(len)                                              \
-    if (!(args.Length() > len)) {                                            \
-        buf_t *err = buf_new(22);                                            \
-        buf_sprintf(err, "takes at least %d args", len + 1);                 \
-        NanThrowError(buf_str(err));                                         \
-        buf_free(err);                                                       \
-        return;                                                              \
+        if ((data = own_.Prepare(buf->size)) == NULL) {
+            ok_ = false;
+            return;
+        }
+        CopyRange(buf, 0, buf->size, data);
+        size = buf->size;
+        own_.Commit(size);
+        return;
     }
 
-#define ASSERT_ARGS_LEN_LT(len)                                              \
-    if (!(args.Length() < len)) {                                            \
-        buf_t *err = buf_new(21);                                            \
-        buf_sprintf(err, "takes at most %d args", len - 1);                  \
-        NanThrowError(buf_str(err));                                         \
-        buf_free(err);                                                       \
-        return;                                                              \
+    if (Buffer::HasInstance(val)) {
+        data = reinterpret_cast<uint8_t *>(Buffer::Data(val));
+        size = Buffer::Length(val);
+        return;
     }
 
-#define ASSERT_UINT8(val)                                                    \
-    if (!val->IsUint32() || val->Uint32Value() > 255) {                      \
-        return NanThrowTypeError("requires unsigned 8 bit integer");         \
-     }
+    Local<String> str = val->ToString();
+    size = str->Utf8Length();
+    data = own_.Prepare(size);
+
+    if (data == NULL) {
+        size = 0;
+        ok_ = false;
+        return;
+    }
 
-#define ASSERT_UINT32(val)                                                   \
-    if (!val->IsUint32()) {                                                  \
-        return NanThrowTypeError("requires unsigned integer");               \
-     }
+    if (str->IsOneByte() && static_cast<size_t>(str->Length()) == size)
+        // pure ascii, plain copy
+        str->WriteOneByte(data, 0, size, String::NO_NULL_TERMINATION);
+    else
+        str->WriteUtf8(reinterpret_cast<char *>(data), size, NULL,
+                String::NO_NULL_TERMINATION);
+    own_.Commit(size);
+}
 
-#define ASSERT_INT32(val)                                                    \
-    if (!val->IsInt32()) {                                                   \
-        return NanThrowTypeError("requires integer");                        \
-     }
+// One byte string data owned by v8, freed on gc.
+class ExternalBytes : public NanExternalOneByteStringResource {
+public:
+    ExternalBytes(char *data, size_t size) : data_(data), size_(size) {
+        NanAdjustExternalMemory(size_);
+    }
 
-#define ASSERT_BUF_OK(operation)                                             \
-    int buf_ret = operation;                                                 \
-                                                                             \
-    if (buf_ret == BUF_ENOMEM) {                                             \
-        return NanThrowError("No memory");                                   \
-    }                                                                        \
-                                                                             \
-    if (buf_ret != BUF_OK) {                                                 \
-        return NanThrowError("Buf operation failed") ;                       \
+    ~ExternalBytes() {
+        free(data_);
+        NanAdjustExternalMemory(-static_cast<int>(size_));
     }
 
-#define TOCSTRING(v8string)                                                  \
-    String::Utf8Value tmp(v8string);                                         \
-    char *str = *tmp;
+    const char *data() const { return data_; }
+    size_t length() const { return size_; }
+private:
+    char *data_;
+    size_t size_;
+};
 
 
 Persistent<FunctionTemplate> Buf::constructor;
+size_t Buf::asyncThreshold = BUF_ASYNC_MIN;
+
+// Scratch arena of short lived bufs (inspect), reset after each use.
+static buf_arena_t *scratch = NULL;
 
-Buf::Buf(size_t unit) {
+// Workers run inline (under the async threshold) wait here to complete
+// on the next loop iteration, callbacks are always asynchronous.
+static uv_async_t inline_async;
+static bool inline_ready = false;
+static std::vector<NanAsyncWorker *> inline_queue;
+
+static NAUV_WORK_CB(InlineComplete) {
+    NanScope();
+    std::vector<NanAsyncWorker *> queue;
+    queue.swap(inline_queue);
+    uv_unref(reinterpret_cast<uv_handle_t *>(&inline_async));
+
+    for (size_t i = 0; i < queue.size(); i++) {
+        queue[i]->WorkComplete();
+        queue[i]->Destroy();
+    }
+}
+
+Buf::Buf(size_t unit) : locks(0), viewBase(NULL), viewData(NULL) {
     buf = buf_new(unit);
+    viewAllocator.alloc = ViewAlloc;
+    viewAllocator.realloc = ViewRealloc;
+    viewAllocator.free = ViewFree;
+    viewAllocator.ctx = this;
 }
 
 Buf::~Buf() {
+    // views die with the object (they hold it), just unhook
+    if (viewData != NULL)
+        buf->allocator = viewBase;
     buf_free(buf);
 }
 
@@ -92,26 +162,103 @@ void Buf::Initialize(Handle<Object> exports) {
     // Prototype
     NODE_SET_PROTOTYPE_METHOD(ctor, "grow", Grow);
     NODE_SET_PROTOTYPE_METHOD(ctor, "put", Put);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "putJSONString", PutJSONString);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "putJSONNumber", PutJSONNumber);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "putJSONRaw", PutJSONRaw);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "render", Render);
     NODE_SET_PROTOTYPE_METHOD(ctor, "pop", Pop);
     NODE_SET_PROTOTYPE_METHOD(ctor, "cmp", Cmp);
     NODE_SET_PROTOTYPE_METHOD(ctor, "clear", Clear);
     NODE_SET_PROTOTYPE_METHOD(ctor, "copy", Copy);
     NODE_SET_PROTOTYPE_METHOD(ctor, "slice", Slice);
     NODE_SET_PROTOTYPE_METHOD(ctor, "bytes", Bytes);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "view", View);
     NODE_SET_PROTOTYPE_METHOD(ctor, "charAt", CharAt);
     NODE_SET_PROTOTYPE_METHOD(ctor, "indexOf", IndexOf);
     NODE_SET_PROTOTYPE_METHOD(ctor, "equals", Equals);
     NODE_SET_PROTOTYPE_METHOD(ctor, "isSpace", IsSpace);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "trim", Trim);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "ltrim", LTrim);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "rtrim", RTrim);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "isAscii", IsAscii);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "isUtf8", IsUtf8);
     NODE_SET_PROTOTYPE_METHOD(ctor, "startsWith", StartsWith);
     NODE_SET_PROTOTYPE_METHOD(ctor, "endsWith", EndsWith);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "toLowerCase", ToLowerCase);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "toUpperCase", ToUpperCase);
     NODE_SET_PROTOTYPE_METHOD(ctor, "inspect", Inspect);
     NODE_SET_PROTOTYPE_METHOD(ctor, "toString", ToString);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "toBuffer", ToBuffer);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "putHex", PutHex);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "putBase64", PutBase64);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "toHex", ToHex);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "toBase64", ToBase64);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "encode", Encode);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "decode", Decode);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "dump", Dump);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "crc32", Crc32);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "crc32c", Crc32c);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "hash64", Hash64);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "deflateInto", DeflateInto);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "inflateInto", InflateInto);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "deflateIntoAsync", DeflateIntoAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "inflateIntoAsync", InflateIntoAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "insert", Insert);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "remove", Remove);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "splice", Splice);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "count", Count);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "histogram", Histogram);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "reverse", Reverse);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "replace", Replace);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "findAll", FindAll);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "split", Split);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "indexOfAsync", IndexOfAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "countAsync", CountAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "cmpAsync", CmpAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "copyAsync", CopyAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "hash64Async", Hash64Async);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "crc32Async", Crc32Async);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "crc32cAsync", Crc32cAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "encodeAsync", EncodeAsync);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "decodeAsync", DecodeAsync);
     // Class methods
     NODE_SET_METHOD(ctor->GetFunction(), "isBuf", IsBuf);
+    NODE_SET_METHOD(ctor->GetFunction(), "configure", Configure);
+    NODE_SET_METHOD(ctor->GetFunction(), "sort", Sort);
+    NODE_SET_METHOD(ctor->GetFunction(), "compareMany", CompareMany);
+    NODE_SET_METHOD(ctor->GetFunction(), "binarySearch", BinarySearch);
+    NODE_SET_METHOD(ctor->GetFunction(), "compileTemplate", CompileTemplate);
     // Exports
     exports->Set(NanNew<String>("Buf"), ctor->GetFunction());
 }
 
+// Unwrap a buf with flat data, for operations needing contiguous data
+// (searches, views, async work). Reads of a range use RangeBytes, buf
+// arguments ArgBytes, they leave the gap where it is.
+Buf *Buf::UnwrapFlat(Handle<Object> obj) {
+    Buf *b = ObjectWrap::Unwrap<Buf>(obj);
+    if (b->buf->gaplen > 0)  // mostly flat, skip the call
+        buf_flat(b->buf);
+    return b;
+}
+
+// Bytes [start, end) of a buf without moving its gap: in place, or copied
+// to scratch if the range spans the gap. Returns false on no memory.
+bool Buf::RangeBytes(buf_t *buf, size_t start, size_t end,
+        ScratchBytes *scratch, uint8_t **data) {
+    if (start >= end || buf->gaplen == 0 || end <= buf->gap ||
+            start >= buf->gap) {
+        *data = start < end ? buf_at(buf, start) : buf->data;
+        return true;
+    }
+
+    if ((*data = scratch->Prepare(end - start)) == NULL)
+        return false;
+    CopyRange(buf, start, end, *data);
+    scratch->Commit(end - start);
+    return true;
+}
+
 bool Buf::HasInstance(Handle<Value> val) {
     return val->IsObject() && Buf::HasInstance(val.As<Object>());
 }
@@ -131,6 +278,204 @@ bool Buf::IsStringOrBuffer(Handle<Object> obj) {
     return obj->IsString() || Buffer::HasInstance(obj);
 }
 
+Local<Object> Buf::NewInstance(size_t unit) {
+    NanEscapableScope();
+    Local<Value> argv[1] = { NanNew<Number>(unit) };
+    Local<FunctionTemplate> ctor = NanNew<FunctionTemplate>(constructor);
+    return NanEscapeScope(ctor->GetFunction()->NewInstance(1, argv));
+}
+
+encoding_t Buf::ParseEncoding(Handle<Value> val) {
+    if (!val->IsString() || val.As<String>()->Length() > 16)
+        return ENC_UNKNOWN;
+
+    ArgBytes bytes(val);
+    bytes.data[bytes.size] = '\0';  // stack has room
+    const char *str = reinterpret_cast<char *>(bytes.data);
+
+    if (strcmp(str, "utf8") == 0 || strcmp(str, "utf-8") == 0)
+        return ENC_UTF8;
+    if (strcmp(str, "ascii") == 0)
+        return ENC_ASCII;
+    if (strcmp(str, "latin1") == 0 || strcmp(str, "binary") == 0)
+        return ENC_LATIN1;
+    if (strcmp(str, "hex") == 0)
+        return ENC_HEX;
+    if (strcmp(str, "base64") == 0)
+        return ENC_BASE64;
+    return ENC_UNKNOWN;
+}
+
+// Parse optional args `[start[, end]]` from `args[idx]` to a range of
+// buf, returns false if they are not unsigned integers.
+bool Buf::ParseRange(_NAN_METHOD_ARGS, int idx, buf_t *buf,
+        size_t *start, size_t *end) {
+    return Buf::ParseRange(args, idx, args.Length(), buf, start, end);
+}
+
+// As above, of the first `argc` args (those before a callback).
+bool Buf::ParseRange(_NAN_METHOD_ARGS, int idx, int argc, buf_t *buf,
+        size_t *start, size_t *end) {
+    *start = 0;
+    *end = buf->size;
+
+    if (argc > idx && !args[idx]->IsUndefined()) {
+        if (!args[idx]->IsUint32())
+            return false;
+        *start = args[idx]->Uint32Value();
+    }
+
+    if (argc > idx + 1 && !args[idx + 1]->IsUndefined()) {
+        if (!args[idx + 1]->IsUint32())
+            return false;
+        *end = args[idx + 1]->Uint32Value();
+    }
+
+    if (*end > buf->size) *end = buf->size;
+    if (*start > *end) *start = *end;
+    return true;
+}
+
+// Run a worker over `size` bytes: on the threadpool if large enough,
+// else inline right now with the completion deferred.
+void Buf::Schedule(NanAsyncWorker *worker, size_t size) {
+    if (size >= asyncThreshold) {
+        NanAsyncQueueWorker(worker);
+        return;
+    }
+
+    if (!inline_ready) {
+        uv_async_init(uv_default_loop(), &inline_async, InlineComplete);
+        inline_ready = true;
+    }
+
+    worker->Execute();
+    inline_queue.push_back(worker);
+    uv_ref(reinterpret_cast<uv_handle_t *>(&inline_async));
+    uv_async_send(&inline_async);
+}
+
+// Take the last argument as callback, NULL if it is not a function.
+NanCallback *Buf::TakeCallback(_NAN_METHOD_ARGS) {
+    if (args.Length() == 0 || !args[args.Length() - 1]->IsFunction())
+        return NULL;
+    return new NanCallback(args[args.Length() - 1].As<Function>());
+}
+
+// Parse zlib options `{level, gzip}`, returns false on bad level.
+bool Buf::ParseZlibOptions(Handle<Value> val, int *level, bool *gzip) {
+    *level = -1;  // Z_DEFAULT_COMPRESSION
+    *gzip = false;
+
+    if (val->IsUndefined())
+        return true;
+    if (!val->IsObject())
+        return false;
+
+    Local<Object> opts = val->ToObject();
+    Local<Value> lv = opts->Get(NanNew<String>("level"));
+
+    if (!lv->IsUndefined()) {
+        if (!lv->IsInt32() || lv->Int32Value() < -1 || lv->Int32Value() > 9)
+            return false;
+        *level = lv->Int32Value();
+    }
+
+    *gzip = opts->Get(NanNew<String>("gzip"))->BooleanValue();
+    return true;
+}
+
+// Parse options `{ignoreCase}`, ascii case is ignored if true.
+bool Buf::ParseIgnoreCase(Handle<Value> val) {
+    return val->IsObject() &&
+        val->ToObject()->Get(NanNew<String>("ignoreCase"))->BooleanValue();
+}
+
+// Make a one byte string, large ones are external strings on a private
+// copy (buf data is mutable, v8 requires external data not to change).
+// Takes the ownership of `data` if `own` is true.
+Local<String> Buf::NewOneByteString(uint8_t *data, size_t size, bool own) {
+    NanEscapableScope();
+
+    if (size < BUF_EXTERN_MIN) {
+        Local<String> str = NanNew<String>(
+                static_cast<const uint8_t *>(data), static_cast<int>(size));
+        if (own)
+            free(data);
+        return NanEscapeScope(str);
+    }
+
+    char *copy = reinterpret_cast<char *>(data);
+
+    if (!own) {
+        copy = static_cast<char *>(malloc(size));
+        if (copy == NULL)
+            return Local<String>();
+        memcpy(copy, data, size);
+    }
+
+    return NanEscapeScope(NanNew<String>(new ExternalBytes(copy, size)));
+}
+
+// Make a string from bytes by encoding, returns an empty handle on
+// no memory.
+Local<String> Buf::NewString(uint8_t *data, size_t size, encoding_t enc) {
+    NanEscapableScope();
+
+    if (size == 0)
+        return NanEscapeScope(NanNew<String>(""));
+
+    switch (enc) {
+        case ENC_HEX:
+        case ENC_BASE64: {
+            size_t len = enc == ENC_HEX ? size * 2 : (size + 2) / 3 * 4;
+            // allocate exactly once, by malloc as the string frees it
+            buf_t *buf = buf_new_with(len, &buf_system_allocator);
+
+            if (buf == NULL)
+                return Local<String>();
+
+            int res = enc == ENC_HEX ? buf_hexencode(buf, data, size, '\0') :
+                buf_b64encode(buf, data, size);
+
+            if (res != BUF_OK) {
+                buf_free(buf);
+                return Local<String>();
+            }
+
+            // adopt buf data
+            uint8_t *out = buf->data;
+            buf->data = NULL;
+            buf_free(buf);
+            return NanEscapeScope(Buf::NewOneByteString(out, len, true));
+        }
+        case ENC_ASCII: {
+            if (buf_isascii(data, size))
+                return NanEscapeScope(
+                        Buf::NewOneByteString(data, size, false));
+
+            // strip high bits
+            uint8_t *out = static_cast<uint8_t *>(malloc(size));
+
+            if (out == NULL)
+                return Local<String>();
+
+            for (size_t idx = 0; idx < size; idx++)
+                out[idx] = data[idx] & 0x7f;
+            return NanEscapeScope(Buf::NewOneByteString(out, size, true));
+        }
+        case ENC_LATIN1:
+            return NanEscapeScope(Buf::NewOneByteString(data, size, false));
+        default:
+            if (buf_isascii(data, size))
+                return NanEscapeScope(
+                        Buf::NewOneByteString(data, size, false));
+            return NanEscapeScope(NanNew<String>(
+                        reinterpret_cast<char *>(data),
+                        static_cast<int>(size)));
+    }
+}
+
 // Public API: - new Buf  O(1)
 //
 NAN_METHOD(Buf::New) {
@@ -158,6 +503,47 @@ NAN_METHOD(Buf::New) {
     }
 }
 
+// Public API: - Buf.configure O(1)
+//
+NAN_METHOD(Buf::Configure) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(2);
+
+    if (args.Length() == 1) {
+        if (!args[0]->IsObject())
+            return NanThrowTypeError("requires object");
+
+        Local<Value> val = args[0]->ToObject()->Get(
+                NanNew<String>("asyncThreshold"));
+
+        if (!val->IsUndefined()) {
+            ASSERT_UINT32(val);
+            asyncThreshold = val->Uint32Value();
+        }
+
+        val = args[0]->ToObject()->Get(NanNew<String>("threads"));
+
+        if (!val->IsUndefined()) {
+            ASSERT_UINT32(val);
+            scanConfig.threads = val->Uint32Value();
+        }
+
+        val = args[0]->ToObject()->Get(NanNew<String>("minChunk"));
+
+        if (!val->IsUndefined()) {
+            ASSERT_UINT32(val);
+            scanConfig.minChunk = val->Uint32Value();
+        }
+    }
+
+    Local<Object> opts = NanNew<Object>();
+    opts->Set(NanNew<String>("asyncThreshold"),
+            NanNew<Number>(asyncThreshold));
+    opts->Set(NanNew<String>("threads"), NanNew<Number>(scanConfig.threads));
+    opts->Set(NanNew<String>("minChunk"), NanNew<Number>(scanConfig.minChunk));
+    NanReturnValue(opts);
+}
+
 // Public API: - Buf.isBuf O(1)
 //
 NAN_METHOD(Buf::IsBuf) {
@@ -166,6 +552,300 @@ NAN_METHOD(Buf::IsBuf) {
     NanReturnValue(NanNew<Boolean>(Buf::HasInstance(args[0])));
 }
 
+// Parse options `{reverse}`, returns false if not an object.
+bool Buf::ParseReverse(Handle<Value> val, bool *reverse) {
+    *reverse = false;
+
+    if (val->IsUndefined())
+        return true;
+    if (!val->IsObject())
+        return false;
+
+    *reverse = val->ToObject()->Get(NanNew<String>("reverse"))->BooleanValue();
+    return true;
+}
+
+// Public API: - Buf.sort O(n * k)
+//
+// Sort an array of bufs in place by bytes (MSD radix sort), returns the
+// array.
+NAN_METHOD(Buf::Sort) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    bool reverse;
+
+    if (!args[0]->IsArray())
+        return NanThrowTypeError("requires array");
+    if (!Buf::ParseReverse(args[1], &reverse))
+        return NanThrowTypeError("requires object");
+
+    Local<Array> arr = args[0].As<Array>();
+    uint32_t n = arr->Length();
+    std::vector<buf_key_t> keys(n);
+    std::vector<Local<Value> > vals(n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        vals[i] = arr->Get(i);
+
+        if (!Buf::HasInstance(vals[i]))
+            return NanThrowTypeError("requires array of bufs");
+    }
+
+    // bufs with a gap are copied to scratch
+    ScratchBytes scratch;
+    std::vector<uint8_t *> data;
+    std::vector<size_t> size;
+
+    if (Buf::ArrayBytes(arr, false, &scratch, &data, &size) != BUF_OK)
+        return NanThrowError("No memory");
+
+    for (uint32_t i = 0; i < n; i++) {
+        keys[i].data = data[i];
+        keys[i].size = size[i];
+        keys[i].ref = i;
+    }
+
+    ASSERT_BUF_OK(buf_sort(n > 0 ? &keys[0] : NULL, n, reverse));
+
+    for (uint32_t i = 0; i < n; i++)
+        arr->Set(i, vals[keys[i].ref]);
+    NanReturnValue(arr);
+}
+
+// Public API: - Buf.compareMany O(n * k)
+//
+// Compare each buf of an array with a string/buffer/buf (as buf.cmp), or
+// with the buf at the same index of another array. Returns an array of
+// results.
+NAN_METHOD(Buf::CompareMany) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+
+    if (!args[0]->IsArray())
+        return NanThrowTypeError("requires array");
+
+    Local<Array> arr = args[0].As<Array>();
+    uint32_t n = arr->Length();
+    Local<Array> others;
+    bool pairs = args[1]->IsArray();
+
+    if (pairs) {
+        others = args[1].As<Array>();
+        if (others->Length() != n)
+            return NanThrowRangeError("arrays differ in length");
+    } else if (!Buf::HasInstance(args[1]) &&
+            !Buf::IsStringOrBuffer(args[1])) {
+        return NanThrowTypeError("requires string/buffer/buf/array");
+    }
+
+    // one operand for all
+    ArgBytes bytes(pairs ? NanNew<String>("") : args[1]);
+    ASSERT_BYTES_OK(bytes);
+    Local<Array> ret = NanNew<Array>(n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        Local<Value> val = arr->Get(i);
+
+        if (!Buf::HasInstance(val))
+            return NanThrowTypeError("requires array of bufs");
+
+        buf_t *buf = ObjectWrap::Unwrap<Buf>(val->ToObject())->buf;
+
+        if (pairs) {
+            Local<Value> other = others->Get(i);
+
+            if (!Buf::HasInstance(other))
+                return NanThrowTypeError("requires array of bufs");
+
+            ArgBytes b(other);
+            ASSERT_BYTES_OK(b);
+            ret->Set(i, NanNew<Number>(buf_cmpb(buf, b.data, b.size)));
+        } else {
+            ret->Set(i, NanNew<Number>(buf_cmpb(buf, bytes.data,
+                            bytes.size)));
+        }
+    }
+    NanReturnValue(ret);
+}
+
+// Public API: - Buf.binarySearch O(k * log n)
+//
+// Find string/buffer/buf in an array of bufs sorted by Buf.sort (with the
+// same `reverse` option). Returns the first index found, or
+// `-(insertion index) - 1` if not found.
+NAN_METHOD(Buf::BinarySearch) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(1);
+    ASSERT_ARGS_LEN_LT(4);
+
+    bool reverse;
+
+    if (!args[0]->IsArray())
+        return NanThrowTypeError("requires array");
+    if (!Buf::HasInstance(args[1]) && !Buf::IsStringOrBuffer(args[1]))
+        return NanThrowTypeError("requires string/buffer/buf");
+    if (!Buf::ParseReverse(args[2], &reverse))
+        return NanThrowTypeError("requires object");
+
+    ArgBytes bytes(args[1]);
+    ASSERT_BYTES_OK(bytes);
+    uint8_t *data = bytes.data;
+    size_t size = bytes.size;
+
+    Local<Array> arr = args[0].As<Array>();
+    uint32_t lo = 0, hi = arr->Length();
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        Local<Value> val = arr->Get(mid);
+
+        if (!Buf::HasInstance(val))
+            return NanThrowTypeError("requires array of bufs");
+
+        int ret = buf_cmpb(ObjectWrap::Unwrap<Buf>(val->ToObject())->buf,
+                data, size);
+
+        if (reverse ? ret > 0 : ret < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < arr->Length() && buf_cmpb(ObjectWrap::Unwrap<Buf>(
+                    arr->Get(lo)->ToObject())->buf, data, size) == 0)
+        NanReturnValue(NanNew<Number>(lo));
+    NanReturnValue(NanNew<Number>(-static_cast<double>(lo) - 1));
+}
+
+// Bytes of each string/buffer/buf (and number if `numbers`) of an array:
+// flat bufs and buffers are referenced in place, strings, numbers and bufs
+// with a gap are written to `scratch`. Returns BUF_EFAILED on other
+// values, BUF_ENOMEM if scratch can't grow (then `data` is not filled).
+int Buf::ArrayBytes(Handle<Array> arr, bool numbers, ScratchBytes *scratch,
+        std::vector<uint8_t *> *data, std::vector<size_t> *size) {
+    uint32_t n = arr->Length();
+    std::vector<Local<Value> > vals(n);
+    std::vector<size_t> offs(n);
+    bool oom = false;
+
+    // getters may run js, get all values before taking any pointer
+    for (uint32_t i = 0; i < n; i++)
+        vals[i] = arr->Get(i);
+
+    data->assign(n, NULL);
+    size->assign(n, 0);
+
+    for (uint32_t i = 0; i < n; i++) {
+        Local<Value> val = vals[i];
+
+        if (Buffer::HasInstance(val)) {
+            (*data)[i] = reinterpret_cast<uint8_t *>(Buffer::Data(val));
+            (*size)[i] = Buffer::Length(val);
+            continue;
+        }
+
+        uint8_t *p;
+        offs[i] = scratch->Size();
+
+        if (Buf::HasInstance(val)) {
+            buf_t *buf = ObjectWrap::Unwrap<Buf>(val->ToObject())->buf;
+
+            if (buf->gaplen == 0) {
+                (*data)[i] = buf->data;
+                (*size)[i] = buf->size;
+                continue;
+            }
+
+            if ((p = scratch->Prepare(buf->size)) == NULL) {
+                oom = true;
+                continue;
+            }
+            CopyRange(buf, 0, buf->size, p);
+            (*size)[i] = buf->size;
+        } else if (numbers && val->IsInt32()) {
+            // decimal, without a v8 string
+            if ((p = scratch->Prepare(12)) == NULL) {
+                oom = true;
+                continue;
+            }
+            (*size)[i] = snprintf(reinterpret_cast<char *>(p), 12, "%d",
+                    val->Int32Value());
+        } else if (val->IsString() || (numbers && val->IsNumber())) {
+            Local<String> str = val->ToString();
+            size_t len = str->Utf8Length();
+
+            if ((p = scratch->Prepare(len)) == NULL) {
+                oom = true;
+                continue;
+            }
+
+            if (str->IsOneByte() && static_cast<size_t>(str->Length()) == len)
+                str->WriteOneByte(p, 0, len, String::NO_NULL_TERMINATION);
+            else
+                str->WriteUtf8(reinterpret_cast<char *>(p), len, NULL,
+                        String::NO_NULL_TERMINATION);
+            (*size)[i] = len;
+        } else {
+            return BUF_EFAILED;
+        }
+        scratch->Commit((*size)[i]);
+    }
+
+    if (oom)
+        return BUF_ENOMEM;
+
+    // scratch is done growing, point into it
+    for (uint32_t i = 0; i < n; i++) {
+        if ((*data)[i] == NULL)
+            (*data)[i] = scratch->Data() + offs[i];
+    }
+    return BUF_OK;
+}
+
+// Public API: - Buf.compileTemplate O(n * m)
+//
+// Compile string/buffer/buf bytes to a template, each occurrence of a slot
+// name (an array of string/buffer/buf, not empty) is a hole for the value
+// at the same index. Render it by buf.render.
+NAN_METHOD(Buf::CompileTemplate) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+
+    if (!Buf::HasInstance(args[0]) && !Buf::IsStringOrBuffer(args[0]))
+        return NanThrowTypeError("requires string/buffer/buf");
+    if (!args[1]->IsArray())
+        return NanThrowTypeError("requires array");
+
+    ScratchBytes scratch;
+    std::vector<uint8_t *> names;
+    std::vector<size_t> lens;
+    int ret = Buf::ArrayBytes(args[1].As<Array>(), false, &scratch, &names,
+            &lens);
+
+    if (ret == BUF_EFAILED)
+        return NanThrowTypeError("requires array of string/buffer/buf");
+    if (ret != BUF_OK)
+        return NanThrowError("No memory");
+
+    for (size_t i = 0; i < lens.size(); i++) {
+        if (lens[i] == 0)
+            return NanThrowRangeError("requires non empty slot names");
+    }
+
+    ArgBytes bytes(args[0]);
+    ASSERT_BYTES_OK(bytes);
+    buf_tpl_t *tpl = buf_tpl_new(bytes.data, bytes.size,
+            names.empty() ? NULL : &names[0], lens.empty() ? NULL : &lens[0],
+            names.size());
+
+    if (tpl == NULL)
+        return NanThrowError("No memory");
+    NanReturnValue(BufTemplate::NewInstance(tpl));
+}
+
 // Public API: - buf.cap O(1)
 //
 NAN_GETTER(Buf::GetCap) {
@@ -196,6 +876,7 @@ NAN_SETTER(Buf::SetLength) {
     ASSERT_UINT32(value);
 
     Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
     buf_t *buf = holder->buf;
     size_t len = value->Uint32Value();
 
@@ -224,7 +905,7 @@ NAN_INDEX_GETTER(Buf::GetIndex) {
     if (index >= holder->buf->size) {
         NanReturnUndefined();
     } else {
-        NanReturnValue(NanNew<Number>(holder->buf->data[index]));
+        NanReturnValue(NanNew<Number>(*buf_at(holder->buf, index)));
     }
 }
 
@@ -234,6 +915,7 @@ NAN_INDEX_SETTER(Buf::SetIndex) {
     NanScope();
 
     Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
     buf_t *buf = holder->buf;
 
     if (!(index < buf->size))
@@ -242,21 +924,22 @@ NAN_INDEX_SETTER(Buf::SetIndex) {
     if (value->IsNumber()) {
         // Byte
         ASSERT_UINT8(value);
-        buf->data[index] = value->Uint32Value();
+        *buf_at(buf, index) = value->Uint32Value();
     } else if (Buf::HasInstance(value)) {
         // Buf
         Buf *b = ObjectWrap::Unwrap<Buf>(value->ToObject());
 
         if (b->buf->size != 1)
             return NanThrowError("requires only 1 byte");
-        buf->data[index] = b->buf->data[0];
+        *buf_at(buf, index) = *buf_at(b->buf, 0);
     } else if (Buf::IsStringOrBuffer(value)) {
         // String/Buffer
-        TOCSTRING(value->ToString());
+        ArgBytes bytes(value);
+        ASSERT_BYTES_OK(bytes);
 
-        if (strlen(str) != 1)
+        if (bytes.size != 1)
             return NanThrowError("requires only 1 byte");
-        buf->data[index] = str[0];
+        *buf_at(buf, index) = bytes.data[0];
     }
 
     NanReturnValue(NanNew(value));
@@ -278,7 +961,7 @@ NAN_METHOD(Buf::CharAt) {
         // on some plats, this `{0}` wont tell v8 where the
         // '\0' terminates the string.
         char s[2] = {0, 0};
-        s[0] = holder->buf->data[idx];
+        s[0] = *buf_at(holder->buf, idx);
         NanReturnValue(NanNew<String>(s));
     }
 }
@@ -289,7 +972,8 @@ NAN_METHOD(Buf::Grow) {
     NanScope();
     ASSERT_ARGS_LEN(1);
     ASSERT_UINT32(args[0]);
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
     ASSERT_BUF_OK(buf_grow(holder->buf, args[0]->Uint32Value()));
     NanReturnValue(NanNew<Number>(holder->buf->cap));
 }
@@ -300,18 +984,39 @@ NAN_METHOD(Buf::Put) {
     NanScope();
     ASSERT_ARGS_LEN(1);
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
     buf_t *buf = holder->buf;
     size_t size = buf->size;
 
-    if (Buf::HasInstance(args[0])) {
-        // Buf
+    // cheap type checks first, Buf::HasInstance walks the prototype chain
+    if (args[0]->IsString()) {
+        // String, encode right into buf
+        Local<String> str = args[0].As<String>();
+        size_t len = str->Utf8Length();
+        ASSERT_BUF_OK(buf_grow(buf, buf->size + len));
+
+        if (str->IsOneByte() && static_cast<size_t>(str->Length()) == len)
+            // pure ascii, plain copy
+            str->WriteOneByte(buf->data + buf->size, 0, len,
+                    String::NO_NULL_TERMINATION);
+        else
+            str->WriteUtf8(reinterpret_cast<char *>(buf->data + buf->size),
+                    len, NULL, String::NO_NULL_TERMINATION);
+        buf->size += len;
+    } else if (args[0]->IsNumber()) {
+        // Byte
+        ASSERT_UINT8(args[0]);
+        ASSERT_BUF_OK(buf_putc(buf, args[0]->Uint32Value()));
+    } else if (Buffer::HasInstance(args[0])) {
+        // Buffer
+        ASSERT_BUF_OK(buf_put(buf,
+                    reinterpret_cast<uint8_t *>(Buffer::Data(args[0])),
+                    Buffer::Length(args[0])));
+    } else if (Buf::HasInstance(args[0])) {
+        // Buf, copied around its gap
         Buf *b = ObjectWrap::Unwrap<Buf>(args[0]->ToObject());
-        ASSERT_BUF_OK(buf_put(buf, b->buf->data, b->buf->size));
-    } else if (Buf::IsStringOrBuffer(args[0])) {
-        // String/Buffer
-        TOCSTRING(args[0]->ToString());
-        ASSERT_BUF_OK(buf_puts(buf, str));
+        ASSERT_BUF_OK(PutRange(buf, b->buf, 0, b->buf->size));
     } else if (args[0]->IsArray()) {
         // Array
         Local<Value> item;
@@ -325,125 +1030,575 @@ NAN_METHOD(Buf::Put) {
             ASSERT_UINT8(item);
             ASSERT_BUF_OK(buf_putc(buf, item->Uint32Value()));
         }
-    } else if (args[0]->IsNumber()) {
-        // Byte
-        ASSERT_UINT8(args[0]);
-        ASSERT_BUF_OK(buf_putc(buf, args[0]->Uint32Value()));
     } else {
         // Bad type
         return NanThrowTypeError("requires string/buffer/buf/array/number");
     }
+    BUF_PROBE4(put, buf, buf->size - size, buf->size, buf->cap);
     NanReturnValue(NanNew<Number>(buf->size - size));
 }
 
-// Public APi: - Buf.prototype.pop O(1)
-//
-NAN_METHOD(Buf::Pop) {
-    NanScope();
-    ASSERT_ARGS_LEN(1);
-    ASSERT_UINT32(args[0]);
+// Whether utf8 written by v8 may come from a lone surrogate: replaced by
+// U+FFFD (EF BF BD), or kept as ED A0..BF xx by older v8.
+static bool MaybeLoneSurrogate(const uint8_t *data, size_t size) {
+    for (size_t idx = 0; idx + 3 <= size; idx++) {
+        if ((data[idx] == 0xef && data[idx + 1] == 0xbf &&
+                    data[idx + 2] == 0xbd) ||
+                (data[idx] == 0xed && data[idx + 1] >= 0xa0))
+            return true;
+    }
+    return false;
+}
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
-    NanReturnValue(NanNew<Number>(
-                buf_rrm(holder->buf, args[0]->Uint32Value())));
+// Put a string with lone surrogates as a json string from its utf16
+// units: well formed runs are utf8 escaped by buf_putjson (its quotes cut
+// off), a lone surrogate is put as a \udxxx escape, as JSON.stringify.
+static int PutJSONUtf16(buf_t *buf, Local<String> str) {
+    String::Value value(str);
+    const uint16_t *units = *value;
+    size_t n = value.length();
+    size_t size = buf->size;
+    size_t idx = 0;
+    ScratchBytes run;
+    int res = buf_putc(buf, '"');
+
+    while (res == BUF_OK) {
+        uint8_t bytes[4];
+        size_t len;
+
+        run.Reset();
+
+        for (; idx < n; idx++) {
+            uint32_t c = units[idx];
+
+            if (c >= 0xd800 && c < 0xdc00 && idx + 1 < n &&
+                    units[idx + 1] >= 0xdc00 && units[idx + 1] < 0xe000) {
+                // a pair
+                c = 0x10000 + ((c - 0xd800) << 10) + (units[++idx] - 0xdc00);
+            } else if (c >= 0xd800 && c < 0xe000) {
+                break;
+            }
+
+            if (c < 0x80) {
+                bytes[0] = c;
+                len = 1;
+            } else if (c < 0x800) {
+                bytes[0] = 0xc0 | (c >> 6);
+                bytes[1] = 0x80 | (c & 0x3f);
+                len = 2;
+            } else if (c < 0x10000) {
+                bytes[0] = 0xe0 | (c >> 12);
+                bytes[1] = 0x80 | ((c >> 6) & 0x3f);
+                bytes[2] = 0x80 | (c & 0x3f);
+                len = 3;
+            } else {
+                bytes[0] = 0xf0 | (c >> 18);
+                bytes[1] = 0x80 | ((c >> 12) & 0x3f);
+                bytes[2] = 0x80 | ((c >> 6) & 0x3f);
+                bytes[3] = 0x80 | (c & 0x3f);
+                len = 4;
+            }
+
+            if (!run.Append(bytes, len)) {
+                res = BUF_ENOMEM;
+                break;
+            }
+        }
+
+        if (res == BUF_OK && run.Size() > 0) {
+            size_t pos = buf->size;
+
+            if ((res = buf_putjson(buf, run.Data(), run.Size())) == BUF_OK) {
+                memmove(buf->data + pos, buf->data + pos + 1,
+                        buf->size - pos - 2);
+                buf->size -= 2;
+            }
+        }
+
+        if (res != BUF_OK)
+            break;
+
+        if (idx == n) {
+            res = buf_putc(buf, '"');
+            break;
+        }
+
+        res = buf_sprintf(buf, "\\u%04x", units[idx++]);
+    }
+
+    if (res != BUF_OK)
+        buf->size = size;
+    return res;
 }
 
-// Public API: - Buf.prototype.cmp O(n)
+// Public API: - Buf.prototype.putJSONString O(k)
 //
-NAN_METHOD(Buf::Cmp) {
+// Put a string/buffer/buf as a quoted, escaped json string (same as
+// JSON.stringify for strings, lone surrogates are \udxxx escapes),
+// without a temporary js string. Returns bytes put.
+NAN_METHOD(Buf::PutJSONString) {
     NanScope();
     ASSERT_ARGS_LEN(1);
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
     buf_t *buf = holder->buf;
+    size_t size = buf->size;
 
-    if (Buf::HasInstance(args[0])) {
-        // Buf
-        Buf *b = ObjectWrap::Unwrap<Buf>(args[0]->ToObject());
-        NanReturnValue(NanNew<Number>(buf_cmp(buf, buf_str(b->buf))));
-    } else if (Buf::IsStringOrBuffer(args[0])) {
-        // String/Buffer
-        TOCSTRING(args[0]->ToString());
-        NanReturnValue(NanNew<Number>(buf_cmp(buf, str)));
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+
+        // utf16 again only if the utf8 may have lost a lone surrogate
+        if (args[0]->IsString() && !args[0].As<String>()->IsOneByte() &&
+                MaybeLoneSurrogate(bytes.data, bytes.size)) {
+            ASSERT_BUF_OK(PutJSONUtf16(buf, args[0].As<String>()));
+        } else {
+            ASSERT_BUF_OK(buf_putjson(buf, bytes.data, bytes.size));
+        }
     } else {
-        // TODO: Array
-        NanThrowTypeError("requires string/buffer/buf");
+        return NanThrowTypeError("requires string/buffer/buf");
     }
+    NanReturnValue(NanNew<Number>(buf->size - size));
 }
 
-// Public API: - Buf.prototype.equals O(n)
+// Public API: - Buf.prototype.putJSONNumber O(1)
 //
-NAN_METHOD(Buf::Equals) {
+// Put a number as JSON.stringify does, null if not finite. Returns bytes
+// put.
+NAN_METHOD(Buf::PutJSONNumber) {
     NanScope();
     ASSERT_ARGS_LEN(1);
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
-    buf_t *buf = holder->buf;
+    if (!args[0]->IsNumber())
+        return NanThrowTypeError("requires number");
 
-    if (Buf::HasInstance(args[0])) {
-        // Buf
-        Buf *b = ObjectWrap::Unwrap<Buf>(args[0]->ToObject());
-        NanReturnValue(NanNew<Boolean>(buf_equals(buf, buf_str(b->buf))));
-    } else if (Buf::IsStringOrBuffer(args[0])) {
-        // String/Buffer
-        TOCSTRING(args[0]->ToString());
-        NanReturnValue(NanNew<Boolean>(buf_equals(buf, str)));
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_t *buf = holder->buf;
+    size_t size = buf->size;
+    double num = args[0]->NumberValue();
+
+    if (args[0]->IsInt32()) {
+        char s[12];
+        int len = snprintf(s, sizeof(s), "%d", args[0]->Int32Value());
+        ASSERT_BUF_OK(buf_put(buf, reinterpret_cast<uint8_t *>(s), len));
+    } else if (num != num || num - num != 0) {
+        // NaN, Infinity
+        ASSERT_BUF_OK(buf_puts(buf, const_cast<char *>("null")));
     } else {
-        // TODO: Array
-        NanThrowTypeError("requires string/buffer/buf");
+        // v8 prints the shortest round trip form, as JSON.stringify
+        Local<String> str = args[0]->ToString();
+        size_t len = str->Length();
+        ASSERT_BUF_OK(buf_grow(buf, buf->size + len));
+        str->WriteOneByte(buf->data + buf->size, 0, len,
+                String::NO_NULL_TERMINATION);
+        buf->size += len;
     }
+    NanReturnValue(NanNew<Number>(buf->size - size));
 }
 
-// Public API: - Buf.prototype.toString  O(1)
+// Public API: - Buf.prototype.putJSONRaw O(k)
 //
-NAN_METHOD(Buf::ToString) {
+// Put a string/buffer/buf as it is, for json fragments already
+// serialized. Returns bytes put.
+NAN_METHOD(Buf::PutJSONRaw) {
     NanScope();
-    ASSERT_ARGS_LEN(0);
+    ASSERT_ARGS_LEN(1);
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
-    NanReturnValue(NanNew<String>(buf_str(holder->buf)));
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_t *buf = holder->buf;
+    size_t size = buf->size;
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        ASSERT_BUF_OK(buf_put(buf, bytes.data, bytes.size));
+    } else {
+        return NanThrowTypeError("requires string/buffer/buf");
+    }
+    NanReturnValue(NanNew<Number>(buf->size - size));
 }
 
-// Public API: - Buf.prototype.clear O(1)
+// Public API: - Buf.prototype.render O(n)
 //
-NAN_METHOD(Buf::Clear) {
+// Render a template from Buf.compileTemplate with an array of values, one
+// per slot: string/buffer/buf, or number. The output size is computed
+// first and grown once. Returns bytes put.
+NAN_METHOD(Buf::Render) {
     NanScope();
-    ASSERT_ARGS_LEN(0);
+    ASSERT_ARGS_LEN(2);
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
-    size_t size = holder->buf->size;
-    buf_clear(holder->buf);
-    NanReturnValue(NanNew<Number>(size));
-}
+    if (!BufTemplate::HasInstance(args[0]))
+        return NanThrowTypeError("requires template");
+    if (!args[1]->IsArray())
+        return NanThrowTypeError("requires array");
 
-// Public API: - Buf.prototype.bytes
-//
-NAN_METHOD(Buf::Bytes) {
-    NanScope();
-    ASSERT_ARGS_LEN(0);
+    buf_tpl_t *tpl = ObjectWrap::Unwrap<BufTemplate>(
+            args[0].As<Object>())->tpl;
+    Local<Array> arr = args[1].As<Array>();
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    if (arr->Length() != tpl->nslots)
+        return NanThrowRangeError("requires a value per slot");
 
-    size_t idx;
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
     buf_t *buf = holder->buf;
+    size_t size = buf->size;
 
-    Local<Array> bytes(NanNew<Array>());
+    ScratchBytes scratch;
+    std::vector<uint8_t *> vals;
+    std::vector<size_t> lens;
 
-    for (idx = 0; idx < buf->size; idx++)
-        bytes->Set(idx, NanNew<Number>(buf->data[idx]));
+    int ret = Buf::ArrayBytes(arr, true, &scratch, &vals, &lens);
+
+    if (ret == BUF_EFAILED)
+        return NanThrowTypeError("requires array of string/buffer/buf/number");
+    if (ret != BUF_OK)
+        return NanThrowError("No memory");
+
+    ASSERT_BUF_OK(buf_tpl_render(buf, tpl, tpl->nslots > 0 ? &vals[0] : NULL,
+                tpl->nslots > 0 ? &lens[0] : NULL));
+    NanReturnValue(NanNew<Number>(buf->size - size));
+}
+
+// Public APi: - Buf.prototype.pop O(1)
+//
+NAN_METHOD(Buf::Pop) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+    ASSERT_UINT32(args[0]);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    NanReturnValue(NanNew<Number>(
+                buf_rrm(holder->buf, args[0]->Uint32Value())));
+}
+
+// Replace `del` bytes at `idx` with string/buffer/buf `val`, in place
+// over the gap.
+int Buf::SpliceValue(buf_t *buf, size_t idx, size_t del, Handle<Value> val) {
+    // String/Buffer/Buf, a buf with a gap is copied (may be buf itself)
+    ArgBytes bytes(val);
+
+    if (!bytes.ok())
+        return BUF_ENOMEM;
+    return buf_splice(buf, idx, del, bytes.data, bytes.size);
+}
+
+// Public API: - Buf.prototype.insert O(k)
+//
+NAN_METHOD(Buf::Insert) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+    ASSERT_UINT32(args[0]);
+
+    if (!Buf::HasInstance(args[1]) && !Buf::IsStringOrBuffer(args[1]))
+        return NanThrowTypeError("requires string/buffer/buf");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
+
+    buf_t *buf = holder->buf;
+    size_t size = buf->size;
+    ASSERT_BUF_OK(Buf::SpliceValue(buf, args[0]->Uint32Value(), 0, args[1]));
+    NanReturnValue(NanNew<Number>(buf->size - size));
+}
+
+// Public API: - Buf.prototype.remove O(k)
+//
+NAN_METHOD(Buf::Remove) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+    ASSERT_UINT32(args[0]);
+    ASSERT_UINT32(args[1]);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    NanReturnValue(NanNew<Number>(buf_remove(holder->buf,
+                    args[0]->Uint32Value(), args[1]->Uint32Value())));
+}
+
+// Public API: - Buf.prototype.splice O(k)
+//
+NAN_METHOD(Buf::Splice) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(1);
+    ASSERT_ARGS_LEN_LT(4);
+    ASSERT_UINT32(args[0]);
+    ASSERT_UINT32(args[1]);
+
+    if (args.Length() == 3 && !Buf::HasInstance(args[2]) &&
+            !Buf::IsStringOrBuffer(args[2]))
+        return NanThrowTypeError("requires string/buffer/buf");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
+
+    buf_t *buf = holder->buf;
+    size_t idx = args[0]->Uint32Value();
+    size_t del = args[1]->Uint32Value();
+
+    // bytes actually removed
+    if (idx > buf->size) idx = buf->size;
+    if (del > buf->size - idx) del = buf->size - idx;
+
+    if (args.Length() == 3) {
+        ASSERT_BUF_OK(Buf::SpliceValue(buf, idx, del, args[2]));
+    } else {
+        buf_remove(buf, idx, del);
+    }
+
+    NanReturnValue(NanNew<Number>(del));
+}
+
+// Public API: - Buf.prototype.cmp O(n)
+//
+NAN_METHOD(Buf::Cmp) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    // reads around the gaps, neither buf is flattened
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    buf_t *buf = holder->buf;
+    bool icase = args.Length() == 2 && Buf::ParseIgnoreCase(args[1]);
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        // String/Buffer/Buf
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        NanReturnValue(NanNew<Number>(icase ?
+                    buf_casecmpb(buf, bytes.data, bytes.size) :
+                    buf_cmpb(buf, bytes.data, bytes.size)));
+    } else {
+        // TODO: Array
+        NanThrowTypeError("requires string/buffer/buf");
+    }
+}
+
+// Public API: - Buf.prototype.equals O(n)
+//
+NAN_METHOD(Buf::Equals) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    // reads around the gaps, neither buf is flattened
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    buf_t *buf = holder->buf;
+    bool icase = args.Length() == 2 && Buf::ParseIgnoreCase(args[1]);
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        // String/Buffer/Buf
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        NanReturnValue(NanNew<Boolean>(icase ?
+                    buf_caseequalsb(buf, bytes.data, bytes.size) :
+                    buf_equalsb(buf, bytes.data, bytes.size)));
+    } else {
+        // TODO: Array
+        NanThrowTypeError("requires string/buffer/buf");
+    }
+}
+
+// Public API: - Buf.prototype.toString  O(n)
+//
+NAN_METHOD(Buf::ToString) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(4);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    buf_t *buf = holder->buf;
+    encoding_t enc = ENC_UTF8;
+    size_t start, end;
+    ScratchBytes bytes;
+    uint8_t *data;
+
+    if (args.Length() > 0 && !args[0]->IsUndefined()) {
+        enc = Buf::ParseEncoding(args[0]);
+        if (enc == ENC_UNKNOWN)
+            return NanThrowError("unknown encoding");
+    }
+
+    if (!Buf::ParseRange(args, 1, buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+
+    if (!Buf::RangeBytes(buf, start, end, &bytes, &data))
+        return NanThrowError("No memory");
+
+    Local<String> str = Buf::NewString(data, end - start, enc);
+
+    if (str.IsEmpty())
+        return NanThrowError("No memory");
+    NanReturnValue(str);
+}
+
+// Public API: - Buf.prototype.toBuffer O(n)
+//
+// Copy [start, end) to a new buffer. Like toString it leaves the gap and
+// views alone, so a locked buf can be read.
+NAN_METHOD(Buf::ToBuffer) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(3);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    buf_t *buf = holder->buf;
+    size_t start, end;
+    ScratchBytes bytes;
+    uint8_t *data;
+
+    if (!Buf::ParseRange(args, 0, buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+
+    if (end - start > Buffer::kMaxLength)
+        return NanThrowRangeError("too large for a buffer");
+
+    if (!Buf::RangeBytes(buf, start, end, &bytes, &data))
+        return NanThrowError("No memory");
+    NanReturnValue(NanNewBufferHandle(reinterpret_cast<char *>(data),
+                static_cast<uint32_t>(end - start)));
+}
+
+// Public API: - Buf.prototype.clear O(1)
+//
+NAN_METHOD(Buf::Clear) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    size_t size = holder->buf->size;
+    buf_clear(holder->buf);
+    NanReturnValue(NanNew<Number>(size));
+}
+
+// Public API: - Buf.prototype.bytes
+//
+NAN_METHOD(Buf::Bytes) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+
+    size_t idx;
+    buf_t *buf = holder->buf;
+
+    Local<Array> bytes(NanNew<Array>());
+
+    for (idx = 0; idx < buf->size; idx++)
+        bytes->Set(idx, NanNew<Number>(*buf_at(buf, idx)));
     NanReturnValue(bytes);
 }
 
+// Allocator hooks on the data of a viewed buf: the view is detached
+// before its memory is moved or freed, the base allocator does the work.
+// Holder data only changes on the main thread, workers write to their
+// own bufs.
+void *Buf::ViewAlloc(void *ctx, size_t size) {
+    buf_allocator_t *base = static_cast<Buf *>(ctx)->viewBase;
+    return base->alloc(base->ctx, size);
+}
+
+void *Buf::ViewRealloc(void *ctx, void *ptr, size_t old, size_t size) {
+    Buf *holder = static_cast<Buf *>(ctx);
+    buf_allocator_t *base = holder->viewBase;
+
+    if (ptr != NULL && ptr == holder->viewData)
+        holder->DetachView();
+    return base->realloc(base->ctx, ptr, old, size);
+}
+
+void Buf::ViewFree(void *ctx, void *ptr, size_t size) {
+    Buf *holder = static_cast<Buf *>(ctx);
+    buf_allocator_t *base = holder->viewBase;
+
+    if (ptr != NULL && ptr == holder->viewData)
+        holder->DetachView();
+    base->free(base->ctx, ptr, size);
+}
+
+// Neuter the array buffer under views (their length becomes 0) and
+// remove the hooks. Called before data moves or is swapped out.
+void Buf::DetachView() {
+    if (viewData == NULL)
+        return;
+
+#if NODE_MODULE_VERSION > NODE_0_10_MODULE_VERSION
+    NanScope();
+    Local<Object> self = NanObjectWrapHandle(this);
+    Local<Value> ab = self->GetHiddenValue(NanNew<String>("bbuf:view"));
+
+    if (!ab.IsEmpty() && ab->IsArrayBuffer())
+        ab.As<ArrayBuffer>()->Neuter();
+    self->DeleteHiddenValue(NanNew<String>("bbuf:view"));
+#endif
+
+    buf->allocator = viewBase;
+    viewData = NULL;
+}
+
+// Public API: - Buf.prototype.view O(1)
+//
+// Returns a Uint8Array over the buf data [0, length), no copy. Views
+// share one array buffer per data block, which is neutered (views become
+// empty) once the data is reallocated, cleared or swapped out. Take a new
+// view after the buf grows or changes its length.
+//
+// Edits in place (insert, remove, splice, pop) don't detach views: the
+// bytes move under them, a live view then shows stale offsets. Writes
+// through a view skip the lock checks, so a view is refused on a locked
+// buf, and one taken before an async operation must not be written until
+// its callback.
+NAN_METHOD(Buf::View) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+
+#if NODE_MODULE_VERSION > NODE_0_10_MODULE_VERSION
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_t *buf = holder->buf;
+
+    if (buf->gaplen > 0)
+        buf_flat(buf);
+
+    Local<ArrayBuffer> ab;
+
+    if (buf->data == NULL) {
+        // nothing to watch yet
+        ab = ArrayBuffer::New(Isolate::GetCurrent(), 0);
+        NanReturnValue(Uint8Array::New(ab, 0, 0));
+    }
+
+    if (holder->viewData == buf->data) {
+        ab = args.Holder()->GetHiddenValue(
+                NanNew<String>("bbuf:view")).As<ArrayBuffer>();
+    } else {
+        // a view of the whole block, it holds the buf object alive
+        ab = ArrayBuffer::New(Isolate::GetCurrent(), buf->data, buf->cap);
+        ab->SetHiddenValue(NanNew<String>("bbuf:buf"), args.Holder());
+        args.Holder()->SetHiddenValue(NanNew<String>("bbuf:view"), ab);
+        holder->viewBase = buf->allocator;
+        holder->viewData = buf->data;
+        buf->allocator = &holder->viewAllocator;
+    }
+
+    NanReturnValue(Uint8Array::New(ab, 0, buf->size));
+#else
+    NanThrowError("view requires node >= 0.12");
+#endif
+}
+
 // Public API: - Buf.prototype.copy O(n)
 //
 NAN_METHOD(Buf::Copy) {
     NanScope();
     Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
-    Local<Value> argv[1] = { NanNew<Number>(holder->buf->unit) };
-    Local<FunctionTemplate> ctor = NanNew<FunctionTemplate>(constructor);
-    Local<Object> inst = ctor->GetFunction()->NewInstance(1, argv);
-    Buf *copy = ObjectWrap::Unwrap<Buf>(inst);
-    ASSERT_BUF_OK(buf_put(copy->buf, holder->buf->data, holder->buf->size));
+    Local<Object> inst = Buf::NewInstance(holder->buf->unit);
+    Buf *copy = Buf::UnwrapFlat(inst);
+    ASSERT_BUF_OK(PutRange(copy->buf, holder->buf, 0, holder->buf->size));
+    BUF_PROBE3(copy, holder->buf, copy->buf, holder->buf->size);
     NanReturnValue(inst);
 }
 
@@ -461,10 +1616,8 @@ NAN_METHOD(Buf::Slice) {
     Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
 
     // make a copy
-    Local<Value> argv[1] = { NanNew<Number>(holder->buf->unit) };
-    Local<FunctionTemplate> ctor = NanNew<FunctionTemplate>(constructor);
-    Local<Object> inst = ctor->GetFunction()->NewInstance(1, argv);
-    Buf *copy = ObjectWrap::Unwrap<Buf>(inst);
+    Local<Object> inst = Buf::NewInstance(holder->buf->unit);
+    Buf *copy = Buf::UnwrapFlat(inst);
 
     // slice data
 
@@ -489,13 +1642,9 @@ NAN_METHOD(Buf::Slice) {
     if (begin >= end) len = 0;
 
     if (len > 0) {
-        ASSERT_BUF_OK(buf_grow(copy->buf, len));
+        ASSERT_BUF_OK(PutRange(copy->buf, holder->buf, begin, begin + len));
     }
-
-    size_t idx = 0;
-
-    while (idx < len)
-        buf_putc(copy->buf, (holder->buf->data)[begin + idx++]);
+    BUF_PROBE3(slice, holder->buf, copy->buf, len);
     NanReturnValue(inst);
 }
 
@@ -504,28 +1653,33 @@ NAN_METHOD(Buf::Slice) {
 NAN_METHOD(Buf::IndexOf) {
     NanScope();
     ASSERT_ARGS_LEN_GT(0);
-    ASSERT_ARGS_LEN_LT(3);
+    ASSERT_ARGS_LEN_LT(4);
 
     size_t start = 0;
-    if (args.Length() == 2)
+    bool icase = false;
+
+    if (args.Length() > 1 && args[args.Length() - 1]->IsObject())
+        icase = Buf::ParseIgnoreCase(args[args.Length() - 1]);
+    if (args.Length() > 1 && !args[1]->IsObject())
         start = args[1]->Uint32Value();
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
     buf_t *buf = holder->buf;
     size_t idx = buf->size;
 
-    if (Buf::HasInstance(args[0])) {
-        // Buf
-        Buf *b = ObjectWrap::Unwrap<Buf>(args[0]->ToObject());
-        idx = buf_indexs(buf, buf_str(b->buf), start);
-    } else if (Buf::IsStringOrBuffer(args[0])) {
-        // String/Buffer
-        TOCSTRING(args[0]->ToString());
-        idx = buf_indexs(buf, str, start);
-    } else if (args[0]->IsNumber()) {
+    if (args[0]->IsNumber()) {
         // Byte
         ASSERT_UINT8(args[0]);
-        idx = buf_indexc(buf, args[0]->Uint32Value(), start);
+        uint8_t ch = args[0]->Uint32Value();
+        idx = icase ? buf_caseindexb(buf, &ch, 1, start) :
+            buf_indexc(buf, ch, start);
+    } else if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        // String/Buffer/Buf
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        idx = icase ? buf_caseindexb(buf, bytes.data, bytes.size, start) :
+            ScanIndex(scanConfig, buf->data, buf->size, bytes.data,
+                    bytes.size, start);
     } else {
         return NanThrowTypeError("requires string/buffer/buf/number");
     }
@@ -537,84 +1691,1276 @@ NAN_METHOD(Buf::IndexOf) {
     }
 }
 
-// Public API: - Buf.prototype.isSpace. O(n)
+// Public API: - Buf.prototype.count O(n)
 //
-NAN_METHOD(Buf::IsSpace) {
+NAN_METHOD(Buf::Count) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    buf_t *buf = holder->buf;
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        // String/Buffer/Buf
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        if (bytes.size == 1)
+            NanReturnValue(NanNew<Number>(buf_countc(buf, bytes.data[0])));
+        NanReturnValue(NanNew<Number>(
+                    ScanCount(scanConfig, buf->data, buf->size, bytes.data,
+                        bytes.size)));
+    } else if (args[0]->IsNumber()) {
+        // Byte
+        ASSERT_UINT8(args[0]);
+        NanReturnValue(NanNew<Number>(
+                    buf_countc(buf, args[0]->Uint32Value())));
+    } else {
+        return NanThrowTypeError("requires string/buffer/buf/number");
+    }
+}
+
+// Public API: - Buf.prototype.histogram O(n)
+//
+NAN_METHOD(Buf::Histogram) {
     NanScope();
     ASSERT_ARGS_LEN(0);
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
-    NanReturnValue(NanNew<Boolean>(buf_isspace(holder->buf)));
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    size_t bins[MAX_UINT8] = {0};
+
+    buf_histogram(holder->buf, bins);
+
+    Local<Array> arr = NanNew<Array>(MAX_UINT8);
+
+    for (int i = 0; i < MAX_UINT8; i++)
+        arr->Set(i, NanNew<Number>(bins[i]));
+    NanReturnValue(arr);
 }
 
-// Public API: - Buf.prototype.startsWith. O(min(n, k))
+// Public API: - Buf.prototype.reverse O(n)
 //
-NAN_METHOD(Buf::StartsWith) {
+NAN_METHOD(Buf::Reverse) {
     NanScope();
-    ASSERT_ARGS_LEN(1);
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_reverse(holder->buf);
+    NanReturnValue(args.Holder());
+}
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+// Public API: - Buf.prototype.replace O(n)
+//
+NAN_METHOD(Buf::Replace) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(1);
+    ASSERT_ARGS_LEN_LT(4);
+
+    for (int i = 0; i < 2; i++)
+        if (!Buf::HasInstance(args[i]) && !Buf::IsStringOrBuffer(args[i]))
+            return NanThrowTypeError("requires string/buffer/buf");
+
+    size_t limit = 1;
+    bool copy = false;
+
+    if (args.Length() == 3 && !args[2]->IsUndefined()) {
+        if (!args[2]->IsObject())
+            return NanThrowTypeError("requires object");
+
+        Local<Object> opts = args[2]->ToObject();
+        Local<Value> val = opts->Get(NanNew<String>("limit"));
+
+        if (opts->Get(NanNew<String>("all"))->BooleanValue())
+            limit = (size_t)-1;
+
+        if (!val->IsUndefined()) {
+            ASSERT_UINT32(val);
+            limit = val->Uint32Value();
+        }
+
+        copy = opts->Get(NanNew<String>("copy"))->BooleanValue();
+    }
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
     buf_t *buf = holder->buf;
 
-    if (Buf::HasInstance(args[0])) {
-        Buf *b = ObjectWrap::Unwrap<Buf>(args[0]->ToObject());
-        NanReturnValue(NanNew<Boolean>(buf_startswith(buf, buf_str(b->buf))));
-    } else if (Buf::IsStringOrBuffer(args[0])) {
-        TOCSTRING(args[0]->ToString());
-        NanReturnValue(NanNew<Boolean>(buf_startswith(buf, str)));
-    } else {
-        NanThrowTypeError("requires string/buffer/buf");
+    if (!copy)
+        ASSERT_UNLOCKED(holder);
+
+    // operands: flat bufs are referenced, others are bytes. The buf
+    // itself, its views and buffers over them alias its data
+    uint8_t *ops[2];
+    size_t lens[2];
+    bool alias = false;
+    ArgBytes sub(args[0]);
+    ArgBytes rep(args[1]);
+    ArgBytes *bytes[2] = { &sub, &rep };
+
+    if (!sub.ok() || !rep.ok())
+        return NanThrowError("No memory");
+
+    for (int i = 0; i < 2; i++) {
+        ops[i] = bytes[i]->data;
+        lens[i] = bytes[i]->size;
+        alias = alias || (lens[i] > 0 && buf->data != NULL &&
+                ops[i] >= buf->data && ops[i] < buf->data + buf->cap);
+    }
+
+    if (lens[0] == 0)
+        return NanThrowError("empty needle");
+
+    size_t count;
+
+    if (copy || alias) {
+        // replace into a new buf, swapped in if not copying
+        Local<Object> inst = Buf::NewInstance(buf->unit);
+        Buf *target = ObjectWrap::Unwrap<Buf>(inst);
+        ASSERT_BUF_OK(buf_replace_into(target->buf, buf, ops[0], lens[0],
+                    ops[1], lens[1], limit, &count));
+
+        if (copy)
+            NanReturnValue(inst);
+
+        holder->DetachView();
+        buf_swap(buf, target->buf);
+        NanReturnValue(NanNew<Number>(count));
     }
+
+    ASSERT_BUF_OK(buf_replace(buf, ops[0], lens[0], ops[1], lens[1], limit,
+                &count));
+    NanReturnValue(NanNew<Number>(count));
 }
 
-// Public API: - Buf.prototype.endsWith. O(min(n, k))
+// Public API: - Buf.prototype.findAll O(n)
 //
-NAN_METHOD(Buf::EndsWith) {
+NAN_METHOD(Buf::FindAll) {
     NanScope();
     ASSERT_ARGS_LEN(1);
 
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    if (!Buf::HasInstance(args[0]) && !Buf::IsStringOrBuffer(args[0]))
+        return NanThrowTypeError("requires string/buffer/buf");
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
     buf_t *buf = holder->buf;
+    std::vector<size_t> pos;
 
-    if (Buf::HasInstance(args[0])) {
-        Buf *b = ObjectWrap::Unwrap<Buf>(args[0]->ToObject());
-        NanReturnValue(NanNew<Boolean>(buf_endswith(buf, buf_str(b->buf))));
-    } else if (Buf::IsStringOrBuffer(args[0])) {
-        TOCSTRING(args[0]->ToString());
-        NanReturnValue(NanNew<Boolean>(buf_endswith(buf, str)));
-    } else {
-        NanThrowTypeError("requires string/buffer/buf");
-    }
+    // String/Buffer/Buf
+    ArgBytes bytes(args[0]);
+    ASSERT_BYTES_OK(bytes);
+    ScanAll(scanConfig, buf->data, buf->size, bytes.data, bytes.size, &pos);
+
+    Local<Array> arr = NanNew<Array>(pos.size());
+
+    for (size_t i = 0; i < pos.size(); i++)
+        arr->Set(i, NanNew<Number>(pos[i]));
+    NanReturnValue(arr);
 }
 
-// Public API: - Buf.prototype.inspect
+// Public API: - Buf.prototype.split O(n)
 //
-NAN_METHOD(Buf::Inspect) {
+NAN_METHOD(Buf::Split) {
     NanScope();
-    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
-    buf_t *buf = buf_new(holder->buf->unit);  // ensure not 0
+    ASSERT_ARGS_LEN(1);
 
-    buf_sprintf(buf, "<bbuf [%d]", holder->buf->size);
+    if (!Buf::HasInstance(args[0]) && !Buf::IsStringOrBuffer(args[0]))
+        return NanThrowTypeError("requires string/buffer/buf");
 
-    size_t idx;
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    buf_t *buf = holder->buf;
+    std::vector<size_t> pos;
 
-    for (idx = 0; idx < holder->buf->size; idx++) {
-        if (idx == 0)
-            buf_putc(buf, ' ');
+    // String/Buffer/Buf
+    ArgBytes bytes(args[0]);
+    ASSERT_BYTES_OK(bytes);
+    size_t len = bytes.size;
+    ScanAll(scanConfig, buf->data, buf->size, bytes.data, len, &pos);
 
-        if (idx > 32) {  // max display 33 bytes
-            buf_sprintf(buf, "..");
-            break;
-        } else {
-            buf_sprintf(buf, "%02x", (holder->buf->data)[idx]);
+    if (len == 0)
+        return NanThrowError("empty separator");
+
+    Local<Array> arr = NanNew<Array>(pos.size() + 1);
+    size_t begin = 0;
+    pos.push_back(buf->size);
+
+    for (size_t i = 0; i < pos.size(); i++) {
+        Local<Object> inst = Buf::NewInstance(buf->unit);
+        Buf *piece = Buf::UnwrapFlat(inst);
+
+        if (pos[i] > begin) {
+            ASSERT_BUF_OK(buf_put(piece->buf, buf->data + begin,
+                        pos[i] - begin));
         }
 
-        if (idx != holder->buf->size - 1)
-            buf_putc(buf, ' ');
+        arr->Set(i, inst);
+        begin = pos[i] + len;
     }
+    NanReturnValue(arr);
+}
 
-    buf_putc(buf, '>');
-
-    Local<Value> val = NanNew<String>(buf_str(buf));
-    buf_free(buf);
-    NanReturnValue(val);
+// Public API: - Buf.prototype.isSpace. O(n)
+//
+NAN_METHOD(Buf::IsSpace) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    NanReturnValue(NanNew<Boolean>(buf_isspace(holder->buf)));
+}
+
+// Public API: - Buf.prototype.trim. O(n)
+//
+NAN_METHOD(Buf::Trim) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    size_t start = buf_ltrim(holder->buf);
+    size_t end = start == holder->buf->size ? start :
+        buf_rtrim(holder->buf);
+
+    Local<Array> arr = NanNew<Array>(2);
+    arr->Set(0, NanNew<Number>(start));
+    arr->Set(1, NanNew<Number>(end));
+    NanReturnValue(arr);
+}
+
+// Public API: - Buf.prototype.ltrim. O(n)
+//
+NAN_METHOD(Buf::LTrim) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    NanReturnValue(NanNew<Number>(buf_ltrim(holder->buf)));
+}
+
+// Public API: - Buf.prototype.rtrim. O(n)
+//
+NAN_METHOD(Buf::RTrim) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    NanReturnValue(NanNew<Number>(buf_rtrim(holder->buf)));
+}
+
+// Public API: - Buf.prototype.isAscii. O(n)
+//
+NAN_METHOD(Buf::IsAscii) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    NanReturnValue(NanNew<Boolean>(
+                buf_isascii(holder->buf->data, holder->buf->size)));
+}
+
+// Public API: - Buf.prototype.isUtf8. O(n)
+//
+NAN_METHOD(Buf::IsUtf8) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    NanReturnValue(NanNew<Boolean>(
+                buf_isutf8(holder->buf->data, holder->buf->size)));
+}
+
+// Public API: - Buf.prototype.toLowerCase. O(n)
+//
+NAN_METHOD(Buf::ToLowerCase) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_lower(holder->buf);
+    NanReturnValue(args.Holder());
+}
+
+// Public API: - Buf.prototype.toUpperCase. O(n)
+//
+NAN_METHOD(Buf::ToUpperCase) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_upper(holder->buf);
+    NanReturnValue(args.Holder());
+}
+
+// Public API: - Buf.prototype.startsWith. O(min(n, k))
+//
+NAN_METHOD(Buf::StartsWith) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    buf_t *buf = holder->buf;
+    bool icase = args.Length() == 2 && Buf::ParseIgnoreCase(args[1]);
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        NanReturnValue(NanNew<Boolean>(icase ?
+                    buf_casestartswithb(buf, bytes.data, bytes.size) :
+                    buf_startswithb(buf, bytes.data, bytes.size)));
+    } else {
+        NanThrowTypeError("requires string/buffer/buf");
+    }
+}
+
+// Public API: - Buf.prototype.endsWith. O(min(n, k))
+//
+NAN_METHOD(Buf::EndsWith) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    buf_t *buf = holder->buf;
+    bool icase = args.Length() == 2 && Buf::ParseIgnoreCase(args[1]);
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        NanReturnValue(NanNew<Boolean>(icase ?
+                    buf_caseendswithb(buf, bytes.data, bytes.size) :
+                    buf_endswithb(buf, bytes.data, bytes.size)));
+    } else {
+        NanThrowTypeError("requires string/buffer/buf");
+    }
+}
+
+// Public API: - Buf.prototype.inspect
+//
+NAN_METHOD(Buf::Inspect) {
+    NanScope();
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    size_t size = holder->buf->size;
+    ScratchBytes bytes;
+    uint8_t *data;
+
+    // max display 33 bytes
+    if (!Buf::RangeBytes(holder->buf, 0, size > 33 ? 33 : size, &bytes,
+                &data))
+        return NanThrowError("No memory");
+
+    if (scratch == NULL && (scratch = buf_arena_new(0)) == NULL)
+        return NanThrowError("No memory");
+
+    buf_t *buf = buf_new_with(128, &scratch->allocator);
+
+    if (buf == NULL)
+        return NanThrowError("No memory");
+
+    buf_sprintf(buf, "<bbuf [%lu]", (unsigned long)size);
+
+    if (size > 0) {
+        buf_putc(buf, ' ');
+        buf_hexencode(buf, data, size > 33 ? 33 : size, ' ');
+        if (size > 33)
+            buf_sprintf(buf, " ..");
+    }
+
+    buf_putc(buf, '>');
+
+    Local<Value> val = NanNew<String>((char *)buf->data, buf->size);
+    buf_free(buf);
+    buf_arena_reset(scratch);
+    NanReturnValue(val);
+}
+
+// Public API: - Buf.prototype.putHex O(k)
+//
+NAN_METHOD(Buf::PutHex) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_t *buf = holder->buf;
+    size_t size = buf->size;
+    int res;
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        // String/Buffer/Buf
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        res = buf_hexdecode(buf, bytes.data, bytes.size);
+    } else {
+        return NanThrowTypeError("requires string/buffer/buf");
+    }
+
+    if (res == BUF_EFAILED)
+        return NanThrowError("invalid hex string");
+
+    ASSERT_BUF_OK(res);
+    NanReturnValue(NanNew<Number>(buf->size - size));
+}
+
+// Public API: - Buf.prototype.putBase64 O(k)
+//
+NAN_METHOD(Buf::PutBase64) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    ASSERT_UNLOCKED(holder);
+    buf_t *buf = holder->buf;
+    size_t size = buf->size;
+    int res;
+
+    if (Buf::IsStringOrBuffer(args[0]) || Buf::HasInstance(args[0])) {
+        // String/Buffer/Buf
+        ArgBytes bytes(args[0]);
+        ASSERT_BYTES_OK(bytes);
+        res = buf_b64decode(buf, bytes.data, bytes.size);
+    } else {
+        return NanThrowTypeError("requires string/buffer/buf");
+    }
+
+    if (res == BUF_EFAILED)
+        return NanThrowError("invalid base64 string");
+
+    ASSERT_BUF_OK(res);
+    NanReturnValue(NanNew<Number>(buf->size - size));
+}
+
+// Public API: - Buf.prototype.toHex O(n)
+//
+NAN_METHOD(Buf::ToHex) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    Local<String> str = Buf::NewString(holder->buf->data, holder->buf->size,
+            ENC_HEX);
+
+    if (str.IsEmpty())
+        return NanThrowError("No memory");
+    NanReturnValue(str);
+}
+
+// Public API: - Buf.prototype.toBase64 O(n)
+//
+NAN_METHOD(Buf::ToBase64) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    Local<String> str = Buf::NewString(holder->buf->data, holder->buf->size,
+            ENC_BASE64);
+
+    if (str.IsEmpty())
+        return NanThrowError("No memory");
+    NanReturnValue(str);
+}
+
+// Public API: - Buf.prototype.encode O(n)
+//
+NAN_METHOD(Buf::Encode) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    encoding_t enc = Buf::ParseEncoding(args[0]);
+
+    if (enc != ENC_HEX && enc != ENC_BASE64)
+        return NanThrowError("unknown encoding");
+
+    if (args.Length() == 2 && !Buf::HasInstance(args[1]))
+        return NanThrowTypeError("requires buf");
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    Local<Object> inst;
+
+    if (args.Length() == 2)
+        inst = args[1]->ToObject();
+    else
+        inst = Buf::NewInstance(holder->buf->unit);
+
+    Buf *target = Buf::UnwrapFlat(inst);
+    ASSERT_UNLOCKED(target);
+
+    buf_t *buf = target->buf;
+    size_t size = buf->size;
+
+    if (enc == ENC_HEX) {
+        ASSERT_BUF_OK(buf_hexencode(buf, holder->buf->data,
+                    holder->buf->size, '\0'));
+    } else {
+        ASSERT_BUF_OK(buf_b64encode(buf, holder->buf->data,
+                    holder->buf->size));
+    }
+
+    if (args.Length() == 2)
+        NanReturnValue(NanNew<Number>(buf->size - size));
+    NanReturnValue(inst);
+}
+
+// Public API: - Buf.prototype.decode O(n)
+//
+NAN_METHOD(Buf::Decode) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    encoding_t enc = Buf::ParseEncoding(args[0]);
+
+    if (enc != ENC_HEX && enc != ENC_BASE64)
+        return NanThrowError("unknown encoding");
+
+    if (args.Length() == 2 && !Buf::HasInstance(args[1]))
+        return NanThrowTypeError("requires buf");
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    Local<Object> inst;
+
+    if (args.Length() == 2)
+        inst = args[1]->ToObject();
+    else
+        inst = Buf::NewInstance(holder->buf->unit);
+
+    Buf *target = Buf::UnwrapFlat(inst);
+    ASSERT_UNLOCKED(target);
+
+    buf_t *buf = target->buf;
+    size_t size = buf->size;
+    int res;
+
+    if (enc == ENC_HEX)
+        res = buf_hexdecode(buf, holder->buf->data, holder->buf->size);
+    else
+        res = buf_b64decode(buf, holder->buf->data, holder->buf->size);
+
+    if (res == BUF_EFAILED)
+        return NanThrowError(enc == ENC_HEX ? "invalid hex string" :
+                "invalid base64 string");
+
+    ASSERT_BUF_OK(res);
+
+    if (args.Length() == 2)
+        NanReturnValue(NanNew<Number>(buf->size - size));
+    NanReturnValue(inst);
+}
+
+// Public API: - Buf.prototype.dump O(k)
+//
+NAN_METHOD(Buf::Dump) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(3);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    size_t size = holder->buf->size;
+    size_t start = 0;
+    size_t len;
+    ScratchBytes bytes;
+    uint8_t *data;
+
+    if (args.Length() > 0) {
+        ASSERT_UINT32(args[0]);
+        start = args[0]->Uint32Value();
+    }
+
+    if (start > size)
+        start = size;
+    len = size - start;
+
+    if (args.Length() > 1) {
+        ASSERT_UINT32(args[1]);
+        if (args[1]->Uint32Value() < len)
+            len = args[1]->Uint32Value();
+    }
+
+    if (!Buf::RangeBytes(holder->buf, start, start + len, &bytes, &data))
+        return NanThrowError("No memory");
+
+    buf_t *buf = buf_new(holder->buf->unit);
+    int res = buf_hexdump(buf, data, len, start);
+
+    if (res != BUF_OK) {
+        buf_free(buf);
+        return NanThrowError("No memory");
+    }
+
+    Local<Value> val = NanNew<String>((char *)buf->data, buf->size);
+    buf_free(buf);
+    NanReturnValue(val);
+}
+
+// Public API: - Buf.prototype.crc32 O(k)
+//
+NAN_METHOD(Buf::Crc32) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(4);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    size_t start, end;
+    uint32_t crc = 0;
+    ScratchBytes bytes;
+    uint8_t *data;
+
+    if (!Buf::ParseRange(args, 0, holder->buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+
+    if (args.Length() > 2) {
+        ASSERT_UINT32(args[2]);
+        crc = args[2]->Uint32Value();
+    }
+
+    if (!Buf::RangeBytes(holder->buf, start, end, &bytes, &data))
+        return NanThrowError("No memory");
+    NanReturnValue(NanNew<Number>(buf_crc32(crc, data, end - start)));
+}
+
+// Public API: - Buf.prototype.crc32c O(k)
+//
+NAN_METHOD(Buf::Crc32c) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(4);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    size_t start, end;
+    uint32_t crc = 0;
+    ScratchBytes bytes;
+    uint8_t *data;
+
+    if (!Buf::ParseRange(args, 0, holder->buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+
+    if (args.Length() > 2) {
+        ASSERT_UINT32(args[2]);
+        crc = args[2]->Uint32Value();
+    }
+
+    if (!Buf::RangeBytes(holder->buf, start, end, &bytes, &data))
+        return NanThrowError("No memory");
+    NanReturnValue(NanNew<Number>(buf_crc32c(crc, data, end - start)));
+}
+
+// Public API: - Buf.prototype.hash64 O(k)
+//
+NAN_METHOD(Buf::Hash64) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(4);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    size_t start, end;
+    uint64_t seed = 0;
+    ScratchBytes bytes;
+    uint8_t *data;
+
+    if (args.Length() > 0 && !args[0]->IsUndefined()) {
+        ASSERT_UINT32(args[0]);
+        seed = args[0]->Uint32Value();
+    }
+
+    if (!Buf::ParseRange(args, 1, holder->buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+    if (!Buf::RangeBytes(holder->buf, start, end, &bytes, &data))
+        return NanThrowError("No memory");
+
+    // 64 bits do not fit in a js number, return as hex
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)buf_hash64(
+                data, end - start, seed));
+    NanReturnValue(NanNew<String>(hex, 16));
+}
+
+// Deflate/inflate a locked buf on the threadpool into a private buf,
+// the result is put to the target buf back on the main thread (storage
+// is adopted if the target is empty).
+class Buf::ZlibWorker : public NanAsyncWorker {
+public:
+    ZlibWorker(NanCallback *callback, Local<Object> src, Local<Object> dst,
+            bool inflate, int level, bool gzip)
+        : NanAsyncWorker(callback), out(NULL), inflate(inflate),
+          level(level), gzip(gzip) {
+        SaveToPersistent("src", src);
+        SaveToPersistent("dst", dst);
+        holder = Buf::UnwrapFlat(src);
+        holder->locks++;
+    }
+
+    ~ZlibWorker() {
+        buf_free(out);
+    }
+
+    void Execute() {
+        buf_t *buf = holder->buf;
+        int res;
+
+        if ((out = buf_new(buf->unit)) == NULL) {
+            SetErrorMessage("No memory");
+            return;
+        }
+
+        if (inflate)
+            res = buf_inflate(out, buf->data, buf->size);
+        else
+            res = buf_deflate(out, buf->data, buf->size, level, gzip);
+
+        if (res == BUF_ENOMEM)
+            SetErrorMessage("No memory");
+        else if (res != BUF_OK)
+            SetErrorMessage(inflate ? "invalid compressed data" :
+                    "Buf operation failed");
+    }
+
+    void WorkComplete() {
+        holder->locks--;
+        NanAsyncWorker::WorkComplete();
+    }
+
+    void HandleOKCallback() {
+        NanScope();
+
+        Buf *target = Buf::UnwrapFlat(GetFromPersistent("dst"));
+        buf_t *buf = target->buf;
+        size_t size = out->size;
+
+        if (target->locks > 0) {
+            Local<Value> argv[1] = {
+                NanError("buf is locked by pending async operations") };
+            callback->Call(1, argv);
+            return;
+        }
+
+        if (buf->size == 0) {
+            // adopt the storage
+            target->DetachView();
+            buf_swap(buf, out);
+        } else if (buf_put(buf, out->data, out->size) != BUF_OK) {
+            Local<Value> argv[1] = { NanError("No memory") };
+            callback->Call(1, argv);
+            return;
+        }
+
+        Local<Value> argv[2] = { NanNull(), NanNew<Number>(size) };
+        callback->Call(2, argv);
+    }
+private:
+    Buf *holder;
+    buf_t *out;
+    bool inflate;
+    int level;
+    bool gzip;
+};
+
+// Public API: - Buf.prototype.deflateInto O(n)
+//
+NAN_METHOD(Buf::DeflateInto) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    if (!Buf::HasInstance(args[0]))
+        return NanThrowTypeError("requires buf");
+
+    int level;
+    bool gzip;
+
+    if (!Buf::ParseZlibOptions(args[1], &level, &gzip))
+        return NanThrowTypeError("bad options");
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    Buf *target = Buf::UnwrapFlat(args[0]->ToObject());
+    ASSERT_UNLOCKED(target);
+
+    buf_t *buf = target->buf;
+    size_t size = buf->size;
+    ASSERT_BUF_OK(buf_deflate(buf, holder->buf->data, holder->buf->size,
+                level, gzip));
+    NanReturnValue(NanNew<Number>(buf->size - size));
+}
+
+// Public API: - Buf.prototype.inflateInto O(n)
+//
+NAN_METHOD(Buf::InflateInto) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+
+    if (!Buf::HasInstance(args[0]))
+        return NanThrowTypeError("requires buf");
+
+    Buf *holder = Buf::UnwrapFlat(args.Holder());
+    Buf *target = Buf::UnwrapFlat(args[0]->ToObject());
+    ASSERT_UNLOCKED(target);
+
+    buf_t *buf = target->buf;
+    size_t size = buf->size;
+    int res = buf_inflate(buf, holder->buf->data, holder->buf->size);
+
+    if (res == BUF_EFAILED)
+        return NanThrowError("invalid compressed data");
+
+    ASSERT_BUF_OK(res);
+    NanReturnValue(NanNew<Number>(buf->size - size));
+}
+
+// Public API: - Buf.prototype.deflateIntoAsync O(n)
+//
+NAN_METHOD(Buf::DeflateIntoAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(1);
+    ASSERT_ARGS_LEN_LT(4);
+
+    Local<Value> cb = args[args.Length() - 1];
+
+    if (!Buf::HasInstance(args[0]) || !cb->IsFunction())
+        return NanThrowTypeError("requires buf and callback");
+
+    int level;
+    bool gzip;
+
+    if (!Buf::ParseZlibOptions(args.Length() == 3 ? args[1] :
+                NanUndefined(), &level, &gzip))
+        return NanThrowTypeError("bad options");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    NanCallback *callback = new NanCallback(cb.As<Function>());
+    Buf::Schedule(new ZlibWorker(callback, args.Holder(),
+                args[0]->ToObject(), false, level, gzip), holder->buf->size);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.inflateIntoAsync O(n)
+//
+NAN_METHOD(Buf::InflateIntoAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+
+    if (!Buf::HasInstance(args[0]) || !args[1]->IsFunction())
+        return NanThrowTypeError("requires buf and callback");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    NanCallback *callback = new NanCallback(args[1].As<Function>());
+    Buf::Schedule(new ZlibWorker(callback, args.Holder(),
+                args[0]->ToObject(), true, 0, false), holder->buf->size);
+    NanReturnUndefined();
+}
+
+// Read only operations on a locked buf, run by Buf::Schedule. The operand
+// is another locked buf, or a private copy of string/buffer/buf bytes.
+class Buf::OpWorker : public NanAsyncWorker {
+public:
+    enum op_t {
+        OP_INDEX,
+        OP_COUNT,
+        OP_CMP,
+        OP_COPY,
+        OP_HASH64,
+        OP_CRC32,
+        OP_CRC32C,
+        OP_ENCODE,
+        OP_DECODE,
+    };
+
+    OpWorker(NanCallback *callback, Local<Object> self, op_t op)
+        : NanAsyncWorker(callback), start(0), seed(0), enc(ENC_UNKNOWN),
+          op(op), config(scanConfig), other(NULL), sub(NULL), len(0),
+          out(NULL), result(0), hash(0) {
+        SaveToPersistent("self", self);
+        holder = Buf::UnwrapFlat(self);
+        holder->locks++;
+        end = holder->buf->size;
+    }
+
+    ~OpWorker() {
+        buf_free(out);
+    }
+
+    // Set the operand, returns false if it is not a string/buffer/buf. A
+    // flat buf is locked and referenced, a buf with a gap is copied.
+    bool SetOperand(Handle<Value> val) {
+        bool isBuf = Buf::HasInstance(val);
+
+        if (isBuf && ObjectWrap::Unwrap<Buf>(
+                    val->ToObject())->buf->gaplen == 0) {
+            SaveToPersistent("other", val->ToObject());
+            other = ObjectWrap::Unwrap<Buf>(val->ToObject());
+            other->locks++;
+            sub = other->buf->data;
+            len = other->buf->size;
+            return true;
+        }
+
+        if (!isBuf && !Buf::IsStringOrBuffer(val))
+            return false;
+
+        ArgBytes bytes(val);
+
+        if (!bytes.ok() || !own.Append(bytes.data, bytes.size)) {
+            SetErrorMessage("No memory");
+            return true;
+        }
+
+        sub = own.Data();
+        len = own.Size();
+        return true;
+    }
+
+    void SetOperand(uint8_t byte) {
+        own.Append(byte);  // inline, can't fail
+        sub = own.Data();
+        len = 1;
+    }
+
+    void Execute() {
+        buf_t *buf = holder->buf;
+        int res = BUF_OK;
+
+        if (ErrorMessage() != NULL)
+            return;
+
+        switch (op) {
+            case OP_INDEX:
+                result = ScanIndex(config, buf->data, buf->size, sub, len,
+                        start);
+                break;
+            case OP_COUNT:
+                result = ScanCount(config, buf->data, buf->size, sub, len);
+                break;
+            case OP_CMP:
+                result = buf_cmpb(buf, sub, len);
+                break;
+            case OP_HASH64:
+                hash = buf_hash64(buf->data + start, end - start, seed);
+                break;
+            case OP_CRC32:
+                result = buf_crc32(static_cast<uint32_t>(seed),
+                        buf->data + start, end - start);
+                break;
+            case OP_CRC32C:
+                result = buf_crc32c(static_cast<uint32_t>(seed),
+                        buf->data + start, end - start);
+                break;
+            default:
+                if ((out = buf_new(buf->unit)) == NULL) {
+                    res = BUF_ENOMEM;
+                } else if (op == OP_COPY) {
+                    res = buf_put(out, buf->data, buf->size);
+                } else if (op == OP_ENCODE) {
+                    res = enc == ENC_HEX ?
+                        buf_hexencode(out, buf->data, buf->size, '\0') :
+                        buf_b64encode(out, buf->data, buf->size);
+                } else {
+                    res = enc == ENC_HEX ?
+                        buf_hexdecode(out, buf->data, buf->size) :
+                        buf_b64decode(out, buf->data, buf->size);
+                }
+        }
+
+        if (res == BUF_ENOMEM)
+            SetErrorMessage("No memory");
+        else if (res != BUF_OK && op == OP_DECODE)
+            SetErrorMessage(enc == ENC_HEX ? "invalid hex string" :
+                    "invalid base64 string");
+        else if (res != BUF_OK)
+            SetErrorMessage("Buf operation failed");
+    }
+
+    void WorkComplete() {
+        holder->locks--;
+        if (other != NULL)
+            other->locks--;
+        NanAsyncWorker::WorkComplete();
+    }
+
+    void HandleOKCallback() {
+        NanScope();
+        Local<Value> val;
+
+        switch (op) {
+            case OP_INDEX:
+                val = result == static_cast<int64_t>(holder->buf->size) ?
+                    NanNew<Number>(-1) : NanNew<Number>(result);
+                break;
+            case OP_CMP:
+                val = NanNew<Number>(static_cast<int>(result));
+                break;
+            case OP_HASH64: {
+                char hex[17];
+                snprintf(hex, sizeof(hex), "%016llx",
+                        (unsigned long long)hash);
+                val = NanNew<String>(hex, 16);
+                break;
+            }
+            case OP_COPY:
+            case OP_ENCODE:
+            case OP_DECODE: {
+                Local<Object> inst = Buf::NewInstance(holder->buf->unit);
+                buf_swap(Buf::UnwrapFlat(inst)->buf, out);
+                val = inst;
+                break;
+            }
+            default:
+                val = NanNew<Number>(result);
+        }
+
+        Local<Value> argv[2] = { NanNull(), val };
+        callback->Call(2, argv);
+    }
+
+    size_t start;  // search start, or range start of checksums
+    size_t end;  // range end of checksums
+    uint64_t seed;  // hash64 seed, or crc to continue
+    encoding_t enc;
+private:
+    Buf *holder;
+    op_t op;
+    scan_config_t config;  // taken on the main thread
+    Buf *other;
+    uint8_t *sub;
+    size_t len;
+    BasicBuf<SystemAllocator, DoublingGrowth, 32> own;  // operand copy
+    buf_t *out;
+    int64_t result;
+    uint64_t hash;
+};
+
+// Public API: - Buf.prototype.indexOfAsync O(n)
+//
+NAN_METHOD(Buf::IndexOfAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(1);
+    ASSERT_ARGS_LEN_LT(4);
+
+    if (args.Length() == 3)
+        ASSERT_UINT32(args[1]);
+
+    if (!Buf::HasInstance(args[0]) && !Buf::IsStringOrBuffer(args[0]) &&
+            !args[0]->IsNumber())
+        return NanThrowTypeError("requires string/buffer/buf/number");
+
+    if (args[0]->IsNumber())
+        ASSERT_UINT8(args[0]);
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_INDEX);
+
+    if (args[0]->IsNumber()) {
+        // Byte
+        worker->SetOperand(static_cast<uint8_t>(args[0]->Uint32Value()));
+    } else {
+        worker->SetOperand(args[0]);
+    }
+
+    if (args.Length() == 3)
+        worker->start = args[1]->Uint32Value();
+
+    Buf::Schedule(worker, holder->buf->size);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.countAsync O(n)
+//
+NAN_METHOD(Buf::CountAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+
+    if (!Buf::HasInstance(args[0]) && !Buf::IsStringOrBuffer(args[0]))
+        return NanThrowTypeError("requires string/buffer/buf");
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_COUNT);
+    worker->SetOperand(args[0]);
+    Buf::Schedule(worker, holder->buf->size);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.cmpAsync O(n)
+//
+NAN_METHOD(Buf::CmpAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+
+    if (!Buf::HasInstance(args[0]) && !Buf::IsStringOrBuffer(args[0]))
+        return NanThrowTypeError("requires string/buffer/buf");
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_CMP);
+    worker->SetOperand(args[0]);
+    Buf::Schedule(worker, holder->buf->size);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.copyAsync O(n)
+//
+NAN_METHOD(Buf::CopyAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    Buf::Schedule(new OpWorker(callback, args.Holder(), OpWorker::OP_COPY),
+            holder->buf->size);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.hash64Async O(n)
+//
+NAN_METHOD(Buf::Hash64Async) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(5);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    int argc = args.Length() - 1;
+    size_t start, end;
+    uint64_t seed = 0;
+
+    if (argc > 0 && !args[0]->IsUndefined()) {
+        ASSERT_UINT32(args[0]);
+        seed = args[0]->Uint32Value();
+    }
+
+    if (!Buf::ParseRange(args, 1, argc, holder->buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_HASH64);
+    worker->seed = seed;
+    worker->start = start;
+    worker->end = end;
+    Buf::Schedule(worker, end - start);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.crc32Async O(n)
+//
+NAN_METHOD(Buf::Crc32Async) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(5);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    int argc = args.Length() - 1;
+    size_t start, end;
+    uint32_t crc = 0;
+
+    if (!Buf::ParseRange(args, 0, argc, holder->buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+
+    if (argc > 2 && !args[2]->IsUndefined()) {
+        ASSERT_UINT32(args[2]);
+        crc = args[2]->Uint32Value();
+    }
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_CRC32);
+    worker->seed = crc;
+    worker->start = start;
+    worker->end = end;
+    Buf::Schedule(worker, end - start);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.crc32cAsync O(n)
+//
+NAN_METHOD(Buf::Crc32cAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(5);
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    int argc = args.Length() - 1;
+    size_t start, end;
+    uint32_t crc = 0;
+
+    if (!Buf::ParseRange(args, 0, argc, holder->buf, &start, &end))
+        return NanThrowTypeError("requires unsigned integer");
+
+    if (argc > 2 && !args[2]->IsUndefined()) {
+        ASSERT_UINT32(args[2]);
+        crc = args[2]->Uint32Value();
+    }
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_CRC32C);
+    worker->seed = crc;
+    worker->start = start;
+    worker->end = end;
+    Buf::Schedule(worker, end - start);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.encodeAsync O(n)
+//
+NAN_METHOD(Buf::EncodeAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+
+    encoding_t enc = Buf::ParseEncoding(args[0]);
+
+    if (enc != ENC_HEX && enc != ENC_BASE64)
+        return NanThrowError("unknown encoding");
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_ENCODE);
+    worker->enc = enc;
+    Buf::Schedule(worker, holder->buf->size);
+    NanReturnUndefined();
+}
+
+// Public API: - Buf.prototype.decodeAsync O(n)
+//
+NAN_METHOD(Buf::DecodeAsync) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+
+    encoding_t enc = Buf::ParseEncoding(args[0]);
+
+    if (enc != ENC_HEX && enc != ENC_BASE64)
+        return NanThrowError("unknown encoding");
+
+    NanCallback *callback = Buf::TakeCallback(args);
+
+    if (callback == NULL)
+        return NanThrowTypeError("requires callback");
+
+    Buf *holder = ObjectWrap::Unwrap<Buf>(args.Holder());
+    OpWorker *worker = new OpWorker(callback, args.Holder(),
+            OpWorker::OP_DECODE);
+    worker->enc = enc;
+    Buf::Schedule(worker, holder->buf->size);
+    NanReturnUndefined();
 }
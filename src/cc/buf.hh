@@ -4,14 +4,111 @@
 #include <v8.h>
 #include <node.h>
 #include <buf.h>
+#include <probes.h>
+#include <vector>
 #include "nan.h"
+#include "basic_buf.hh"
 
 #define BUF_MAX_UNIT 1024 * 1024  // 1mb
+#define BUF_EXTERN_MIN 256 * 1024  // strings larger are external
+#define BUF_ASYNC_MIN 256 * 1024  // default threshold to use the threadpool
+
+#define ARG_BYTES_STACK 256
+
+#define ASSERT_ARGS_LEN(len)                                                 \
+    if (args.Length() != len) {                                              \
+        char err[32];                                                        \
+        snprintf(err, sizeof(err), "takes exactly %d args", len);            \
+        NanThrowError(err);                                                  \
+        return;                                                              \
+    }
+
+#define ASSERT_ARGS_LEN_GT(len)                                              \
+    if (!(args.Length() > len)) {                                            \
+        char err[32];                                                        \
+        snprintf(err, sizeof(err), "takes at least %d args", len + 1);       \
+        NanThrowError(err);                                                  \
+        return;                                                              \
+    }
+
+#define ASSERT_ARGS_LEN_LT(len)                                              \
+    if (!(args.Length() < len)) {                                            \
+        char err[32];                                                        \
+        snprintf(err, sizeof(err), "takes at most %d args", len - 1);        \
+        NanThrowError(err);                                                  \
+        return;                                                              \
+    }
+
+#define ASSERT_UINT8(val)                                                    \
+    if (!val->IsUint32() || val->Uint32Value() > 255) {                      \
+        return NanThrowTypeError("requires unsigned 8 bit integer");         \
+     }
+
+#define ASSERT_UINT32(val)                                                   \
+    if (!val->IsUint32()) {                                                  \
+        return NanThrowTypeError("requires unsigned integer");               \
+     }
+
+#define ASSERT_INT32(val)                                                    \
+    if (!val->IsInt32()) {                                                   \
+        return NanThrowTypeError("requires integer");                        \
+     }
+
+#define ASSERT_BUF_OK(operation)                                             \
+    int buf_ret = operation;                                                 \
+                                                                             \
+    if (buf_ret == BUF_ENOMEM) {                                             \
+        return NanThrowError("No memory");                                   \
+    }                                                                        \
+                                                                             \
+    if (buf_ret != BUF_OK) {                                                 \
+        return NanThrowError("Buf operation failed") ;                       \
+    }
+
+#define ASSERT_BYTES_OK(bytes)                                               \
+    if (!(bytes).ok()) {                                                     \
+        return NanThrowError("No memory");                                   \
+    }
+
+#define ASSERT_UNLOCKED(holder)                                              \
+    if ((holder)->locks > 0) {                                               \
+        return NanThrowError("buf is locked by pending async operations");   \
+    }
 
 namespace buf {
 using namespace v8;
 using namespace node;
 
+// Bytes of a string/buffer/buf argument: buffers and flat bufs are
+// referenced in place, short strings are utf8 encoded onto the stack. A
+// buf with a gap is copied around it, the argument is left as is.
+class ArgBytes {
+public:
+    explicit ArgBytes(Handle<Value> val);
+
+    // false if the copy couldn't be allocated, data is NULL then
+    bool ok() const { return ok_; }
+
+    uint8_t *data;
+    size_t size;
+private:
+    BasicBuf<SystemAllocator, ExactGrowth, ARG_BYTES_STACK> own_;
+    bool ok_;
+};
+
+// Growable scratch bytes, on the stack while short.
+typedef BasicBuf<SystemAllocator, DoublingGrowth, ARG_BYTES_STACK>
+    ScratchBytes;
+
+enum encoding_t {
+    ENC_UNKNOWN = 0,
+    ENC_UTF8,
+    ENC_ASCII,
+    ENC_LATIN1,
+    ENC_HEX,
+    ENC_BASE64,
+};
+
 class Buf : public ObjectWrap {
 public:
     Buf(size_t unit);
@@ -25,20 +122,72 @@ public:
     static NAN_METHOD(New);
     static NAN_METHOD(Grow);
     static NAN_METHOD(Put);
+    static NAN_METHOD(PutJSONString);
+    static NAN_METHOD(PutJSONNumber);
+    static NAN_METHOD(PutJSONRaw);
+    static NAN_METHOD(Render);
     static NAN_METHOD(Pop);
     static NAN_METHOD(Cmp);
     static NAN_METHOD(Copy);
     static NAN_METHOD(Slice);
     static NAN_METHOD(Bytes);
+    static NAN_METHOD(View);
     static NAN_METHOD(CharAt);
     static NAN_METHOD(Clear);
     static NAN_METHOD(Equals);
     static NAN_METHOD(IndexOf);
     static NAN_METHOD(IsSpace);
+    static NAN_METHOD(Trim);
+    static NAN_METHOD(LTrim);
+    static NAN_METHOD(RTrim);
+    static NAN_METHOD(IsAscii);
+    static NAN_METHOD(IsUtf8);
     static NAN_METHOD(StartsWith);
     static NAN_METHOD(EndsWith);
+    static NAN_METHOD(ToLowerCase);
+    static NAN_METHOD(ToUpperCase);
     static NAN_METHOD(ToString);
+    static NAN_METHOD(ToBuffer);
     static NAN_METHOD(Inspect);
+    static NAN_METHOD(PutHex);
+    static NAN_METHOD(PutBase64);
+    static NAN_METHOD(ToHex);
+    static NAN_METHOD(ToBase64);
+    static NAN_METHOD(Encode);
+    static NAN_METHOD(Decode);
+    static NAN_METHOD(Dump);
+    static NAN_METHOD(Crc32);
+    static NAN_METHOD(Crc32c);
+    static NAN_METHOD(Hash64);
+    static NAN_METHOD(DeflateInto);
+    static NAN_METHOD(InflateInto);
+    static NAN_METHOD(DeflateIntoAsync);
+    static NAN_METHOD(InflateIntoAsync);
+    static NAN_METHOD(Insert);
+    static NAN_METHOD(Remove);
+    static NAN_METHOD(Splice);
+    static NAN_METHOD(Count);
+    static NAN_METHOD(Histogram);
+    static NAN_METHOD(Reverse);
+    static NAN_METHOD(Replace);
+    static NAN_METHOD(FindAll);
+    static NAN_METHOD(Split);
+    static NAN_METHOD(Configure);
+    static NAN_METHOD(Sort);
+    static NAN_METHOD(CompareMany);
+    static NAN_METHOD(BinarySearch);
+    static NAN_METHOD(CompileTemplate);
+    static NAN_METHOD(IndexOfAsync);
+    static NAN_METHOD(CountAsync);
+    static NAN_METHOD(CmpAsync);
+    static NAN_METHOD(CopyAsync);
+    static NAN_METHOD(Hash64Async);
+    static NAN_METHOD(Crc32Async);
+    static NAN_METHOD(Crc32cAsync);
+    static NAN_METHOD(EncodeAsync);
+    static NAN_METHOD(DecodeAsync);
+    static size_t asyncThreshold;
+    static void Schedule(NanAsyncWorker *worker, size_t size);
     static NAN_GETTER(GetCap);
     static NAN_SETTER(SetCap);
     static NAN_GETTER(GetLength);
@@ -48,6 +197,41 @@ public:
 private:
     static bool IsStringOrBuffer(Handle<Value> val);
     static bool IsStringOrBuffer(Handle<Object> obj);
+    static Local<Object> NewInstance(size_t unit);
+    static Buf *UnwrapFlat(Handle<Object> obj);
+    static bool RangeBytes(buf_t *buf, size_t start, size_t end,
+            ScratchBytes *scratch, uint8_t **data);
+    static int SpliceValue(buf_t *buf, size_t idx, size_t del,
+            Handle<Value> val);
+    static encoding_t ParseEncoding(Handle<Value> val);
+    static bool ParseIgnoreCase(Handle<Value> val);
+    static bool ParseReverse(Handle<Value> val, bool *reverse);
+    static bool ParseRange(_NAN_METHOD_ARGS, int idx, buf_t *buf,
+            size_t *start, size_t *end);
+    static bool ParseRange(_NAN_METHOD_ARGS, int idx, int argc, buf_t *buf,
+            size_t *start, size_t *end);
+    static NanCallback *TakeCallback(_NAN_METHOD_ARGS);
+    static int ArrayBytes(Handle<Array> arr, bool numbers,
+            ScratchBytes *scratch, std::vector<uint8_t *> *data,
+            std::vector<size_t> *size);
+    static bool ParseZlibOptions(Handle<Value> val, int *level, bool *gzip);
+    static Local<String> NewString(uint8_t *data, size_t size,
+            encoding_t enc);
+    static Local<String> NewOneByteString(uint8_t *data, size_t size,
+            bool own);
+    static void *ViewAlloc(void *ctx, size_t size);
+    static void *ViewRealloc(void *ctx, void *ptr, size_t old, size_t size);
+    static void ViewFree(void *ctx, void *ptr, size_t size);
+    void DetachView();
+    class ZlibWorker;
+    class OpWorker;
+    friend class ArgBytes;
+    friend class Ring;
+    friend class BufMap;
     buf_t* buf;
+    int locks;  // pending async operations reading the buf
+    buf_allocator_t viewAllocator;  // hooks on buf data while viewed
+    buf_allocator_t *viewBase;  // allocator under the hooks
+    uint8_t *viewData;  // data under the view, NULL if none
 };
 };
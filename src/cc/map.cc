@@ -0,0 +1,295 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#include <v8.h>
+#include <node.h>
+#include "buf.hh"
+#include "map.hh"
+
+using namespace buf;
+
+// Key bytes of a string/buffer/buf value by ArgBytes: referenced in
+// place, strings and bufs with a gap are copied (on the stack if short).
+#define MAP_KEY(val, key, len)                                               \
+    if (!Buf::HasInstance(val) && !Buffer::HasInstance(val) &&               \
+            !val->IsString()) {                                              \
+        return NanThrowTypeError("requires string/buffer/buf");              \
+    }                                                                        \
+                                                                             \
+    ArgBytes key##_bytes(val);                                               \
+    ASSERT_BYTES_OK(key##_bytes);                                            \
+    uint8_t *key = key##_bytes.data;                                         \
+    size_t len = key##_bytes.size;
+
+#define ASSERT_NOT_ITERATING(holder)                                         \
+    if ((holder)->iterating > 0) {                                           \
+        return NanThrowError("map is changed in forEach");                   \
+    }
+
+Persistent<FunctionTemplate> BufMap::mapConstructor;
+Persistent<FunctionTemplate> BufMap::setConstructor;
+
+BufMap::BufMap(buf_map_t *map, bool set) : map(map), set(set),
+    iterating(0), memory(0) {
+    AdjustMemory();
+}
+
+BufMap::~BufMap() {
+    NanAdjustExternalMemory(-static_cast<int>(memory));
+    buf_map_free(map);
+}
+
+// Report the map memory to v8 as external, so gc sees what a map holds.
+// It grows on puts only, clear and delete keep it for reuse.
+void BufMap::AdjustMemory() {
+    size_t size = map->cap * sizeof(buf_map_slot_t) +
+        map->ecap * sizeof(buf_map_entry_t) + map->kcap;
+
+    if (size != memory) {
+        NanAdjustExternalMemory(static_cast<int>(size) -
+                static_cast<int>(memory));
+        memory = size;
+    }
+}
+
+// Register prototypes and exports
+//
+void BufMap::Initialize(Handle<Object> exports) {
+    NanScope();
+    // BufMap
+    Local<FunctionTemplate> ctor = NanNew<FunctionTemplate>(NewMap);
+    ctor->InstanceTemplate()->SetInternalFieldCount(1);
+    ctor->SetClassName(NanNew("BufMap"));
+    NanAssignPersistent(mapConstructor, ctor);
+    ctor->InstanceTemplate()->SetAccessor(NanNew<String>("size"), GetSize);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "get", Get);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "set", Put);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "has", Has);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "increment", Increment);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "delete", Delete);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "clear", Clear);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "forEach", ForEach);
+    exports->Set(NanNew<String>("BufMap"), ctor->GetFunction());
+    // BufSet
+    ctor = NanNew<FunctionTemplate>(NewSet);
+    ctor->InstanceTemplate()->SetInternalFieldCount(1);
+    ctor->SetClassName(NanNew("BufSet"));
+    NanAssignPersistent(setConstructor, ctor);
+    ctor->InstanceTemplate()->SetAccessor(NanNew<String>("size"), GetSize);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "add", Add);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "has", Has);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "delete", Delete);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "clear", Clear);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "forEach", ForEach);
+    exports->Set(NanNew<String>("BufSet"), ctor->GetFunction());
+}
+
+// new BufMap([capacity]), new BufSet([capacity]), the capacity is a hint
+// of keys to hold before rehashing.
+void BufMap::New(_NAN_METHOD_ARGS, bool set) {
+    ASSERT_ARGS_LEN_LT(2);
+
+    if (!args.IsConstructCall())
+        return NanThrowError(set ? "use new BufSet(..)" : "use new BufMap(..)");
+
+    size_t hint = 0;
+
+    if (args.Length() == 1 && !args[0]->IsUndefined()) {
+        ASSERT_UINT32(args[0]);
+        hint = args[0]->Uint32Value();
+    }
+
+    buf_map_t *map = buf_map_new(hint);
+
+    if (map == NULL)
+        return NanThrowError("No memory");
+
+    BufMap *holder = new BufMap(map, set);
+    holder->Wrap(args.This());
+    NanReturnValue(args.This());
+}
+
+// Public API: - BufMap constructor
+//
+NAN_METHOD(BufMap::NewMap) {
+    NanScope();
+    BufMap::New(args, false);
+}
+
+// Public API: - BufSet constructor
+//
+NAN_METHOD(BufMap::NewSet) {
+    NanScope();
+    BufMap::New(args, true);
+}
+
+// Public API: - BufMap.prototype.size, BufSet.prototype.size getter
+//
+NAN_GETTER(BufMap::GetSize) {
+    NanScope();
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    NanReturnValue(NanNew<Number>(holder->map->size));
+}
+
+// Public API: - BufMap.prototype.get O(k)
+//
+// Returns undefined if the key is not found.
+NAN_METHOD(BufMap::Get) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+    MAP_KEY(args[0], key, len);
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    double *value = buf_map_get(holder->map, key, len);
+
+    if (value == NULL)
+        NanReturnUndefined();
+    NanReturnValue(NanNew<Number>(*value));
+}
+
+// Public API: - BufMap.prototype.set O(k)
+//
+NAN_METHOD(BufMap::Put) {
+    NanScope();
+    ASSERT_ARGS_LEN(2);
+    MAP_KEY(args[0], key, len);
+
+    if (!args[1]->IsNumber())
+        return NanThrowTypeError("requires number");
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    ASSERT_NOT_ITERATING(holder);
+
+    double *value;
+    int ret = buf_map_put(holder->map, key, len, &value);
+    holder->AdjustMemory();
+    ASSERT_BUF_OK(ret);
+    *value = args[1]->NumberValue();
+    NanReturnValue(args.Holder());
+}
+
+// Public API: - BufMap.prototype.increment O(k)
+//
+// Add `delta` (default 1) to the value of key, a new key starts from 0.
+// Returns the new value.
+NAN_METHOD(BufMap::Increment) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+    MAP_KEY(args[0], key, len);
+
+    double delta = 1;
+
+    if (args.Length() == 2 && !args[1]->IsUndefined()) {
+        if (!args[1]->IsNumber())
+            return NanThrowTypeError("requires number");
+        delta = args[1]->NumberValue();
+    }
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    ASSERT_NOT_ITERATING(holder);
+
+    double *value;
+    int ret = buf_map_put(holder->map, key, len, &value);
+    holder->AdjustMemory();
+    ASSERT_BUF_OK(ret);
+    *value += delta;
+    NanReturnValue(NanNew<Number>(*value));
+}
+
+// Public API: - BufSet.prototype.add O(k)
+//
+// Returns true if the key is new.
+NAN_METHOD(BufMap::Add) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+    MAP_KEY(args[0], key, len);
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    ASSERT_NOT_ITERATING(holder);
+
+    size_t size = holder->map->size;
+    double *value;
+    int ret = buf_map_put(holder->map, key, len, &value);
+    holder->AdjustMemory();
+    ASSERT_BUF_OK(ret);
+    NanReturnValue(NanNew<Boolean>(holder->map->size > size));
+}
+
+// Public API: - BufMap.prototype.has, BufSet.prototype.has O(k)
+//
+NAN_METHOD(BufMap::Has) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+    MAP_KEY(args[0], key, len);
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    NanReturnValue(NanNew<Boolean>(
+                buf_map_get(holder->map, key, len) != NULL));
+}
+
+// Public API: - BufMap.prototype.delete, BufSet.prototype.delete O(k)
+//
+NAN_METHOD(BufMap::Delete) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+    MAP_KEY(args[0], key, len);
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    ASSERT_NOT_ITERATING(holder);
+    NanReturnValue(NanNew<Boolean>(buf_map_del(holder->map, key, len)));
+}
+
+// Public API: - BufMap.prototype.clear, BufSet.prototype.clear O(n)
+//
+NAN_METHOD(BufMap::Clear) {
+    NanScope();
+    ASSERT_ARGS_LEN(0);
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    ASSERT_NOT_ITERATING(holder);
+    buf_map_clear(holder->map);
+    NanReturnUndefined();
+}
+
+// Public API: - BufMap.prototype.forEach, BufSet.prototype.forEach O(n)
+//
+// Calls `callback(value, key)` (`callback(key)` for sets) in insertion
+// order, keys are new bufs. The map can't be changed in the callback.
+NAN_METHOD(BufMap::ForEach) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+
+    if (!args[0]->IsFunction())
+        return NanThrowTypeError("requires function");
+
+    BufMap *holder = ObjectWrap::Unwrap<BufMap>(args.Holder());
+    Local<Function> callback = args[0].As<Function>();
+    size_t idx = 0;
+    uint8_t *key;
+    size_t len;
+    double *value;
+
+    holder->iterating++;
+
+    while ((idx = buf_map_next(holder->map, idx, &key, &len, &value)) != 0) {
+        Local<Object> inst = Buf::NewInstance(len > 0 ? len : 1);
+        Buf *b = ObjectWrap::Unwrap<Buf>(inst);
+
+        if (buf_put(b->buf, key, len) != BUF_OK) {
+            holder->iterating--;
+            return NanThrowError("No memory");
+        }
+
+        Local<Value> argv[2] = { NanNew<Number>(*value), inst };
+        Local<Value> ret = holder->set ?
+            callback->Call(args.Holder(), 1, argv + 1) :
+            callback->Call(args.Holder(), 2, argv);
+
+        if (ret.IsEmpty())
+            break;  // thrown
+    }
+
+    holder->iterating--;
+    NanReturnUndefined();
+}
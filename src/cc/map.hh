@@ -0,0 +1,47 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#ifndef _BUF_MAP_HH
+#define _BUF_MAP_HH
+
+#include <v8.h>
+#include <node.h>
+#include <buf.h>
+#include "nan.h"
+
+namespace buf {
+using namespace v8;
+using namespace node;
+
+// Hash map from bytes of string/buffer/buf keys to numbers, exported as
+// BufMap, and as BufSet without values.
+class BufMap : public ObjectWrap {
+public:
+    BufMap(buf_map_t *map, bool set);
+    ~BufMap();
+
+    static Persistent<FunctionTemplate> mapConstructor;
+    static Persistent<FunctionTemplate> setConstructor;
+    static void Initialize(Handle<Object> exports);
+    static NAN_METHOD(NewMap);
+    static NAN_METHOD(NewSet);
+    static NAN_METHOD(Get);
+    static NAN_METHOD(Put);
+    static NAN_METHOD(Add);
+    static NAN_METHOD(Has);
+    static NAN_METHOD(Increment);
+    static NAN_METHOD(Delete);
+    static NAN_METHOD(Clear);
+    static NAN_METHOD(ForEach);
+    static NAN_GETTER(GetSize);
+private:
+    static void New(_NAN_METHOD_ARGS, bool set);
+    void AdjustMemory();
+    buf_map_t *map;
+    bool set;
+    int iterating;  // running forEach calls
+    size_t memory;  // slots, entries and keys reported to v8
+};
+};
+
+#endif
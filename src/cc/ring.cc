@@ -0,0 +1,278 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#include <errno.h>
+#include <v8.h>
+#include <node.h>
+#include <vector>
+#include "buf.hh"
+#include "ring.hh"
+
+using namespace buf;
+
+#define ASSERT_OPEN(holder)                                                  \
+    if ((holder)->ring == NULL) {                                            \
+        return NanThrowError("ring is closed");                              \
+    }
+
+Persistent<FunctionTemplate> Ring::constructor;
+
+Ring::Ring(buf_ring_t *ring) : ring(ring) {}
+
+Ring::~Ring() {
+    buf_ring_free(ring);
+}
+
+// Register prototypes and exports
+//
+void Ring::Initialize(Handle<Object> exports) {
+    NanScope();
+    // Constructor
+    Local<FunctionTemplate> ctor = NanNew<FunctionTemplate>(New);
+    ctor->InstanceTemplate()->SetInternalFieldCount(1);
+    ctor->SetClassName(NanNew("Ring"));
+    // Persistents
+    NanAssignPersistent(constructor, ctor);
+    // Accessors
+    ctor->InstanceTemplate()->SetAccessor(NanNew<String>("cap"), GetCap);
+    ctor->InstanceTemplate()->SetAccessor(NanNew<String>("length"), GetLength);
+    // Prototype
+    NODE_SET_PROTOTYPE_METHOD(ctor, "put", Put);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "take", Take);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "takeInto", TakeInto);
+    NODE_SET_PROTOTYPE_METHOD(ctor, "close", Close);
+    // Class methods
+    NODE_SET_METHOD(ctor->GetFunction(), "unlink", Unlink);
+    // Exports
+    exports->Set(NanNew<String>("Ring"), ctor->GetFunction());
+}
+
+// Parse optional timeout (ms), undefined for non-blocking, -1 to wait
+// forever.
+bool Ring::ParseTimeout(Handle<Value> val, long *timeout) {
+    *timeout = 0;
+
+    if (val->IsUndefined())
+        return true;
+    if (!val->IsInt32() || val->Int32Value() < -1)
+        return false;
+
+    *timeout = val->Int32Value();
+    return true;
+}
+
+// Public API: - Ring constructor
+//
+// new Ring(size[, name]) creates a ring, new Ring(name) opens one.
+NAN_METHOD(Ring::New) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    if (!args.IsConstructCall())
+        return NanThrowError("use new Ring(..)");
+
+    buf_ring_t *ring;
+
+    if (args[0]->IsString()) {
+        NanUtf8String name(args[0]);
+        ring = buf_ring_open(*name);
+    } else {
+        ASSERT_UINT32(args[0]);
+
+        if (args.Length() == 2 && !args[1]->IsString())
+            return NanThrowTypeError("requires string");
+
+        size_t cap = args[0]->Uint32Value();
+
+        if (cap == 0 || cap > BUF_MAX_SIZE)
+            return NanThrowRangeError("bad ring size");
+
+        if (args.Length() == 2) {
+            NanUtf8String name(args[1]);
+            ring = buf_ring_new(*name, cap);
+        } else {
+            ring = buf_ring_new(NULL, cap);
+        }
+    }
+
+    if (ring == NULL)
+        return NanThrowError(strerror(errno));
+
+    Ring *holder = new Ring(ring);
+    holder->Wrap(args.This());
+    NanReturnValue(args.This());
+}
+
+// Public API: - Ring.unlink
+//
+NAN_METHOD(Ring::Unlink) {
+    NanScope();
+    ASSERT_ARGS_LEN(1);
+
+    if (!args[0]->IsString())
+        return NanThrowTypeError("requires string");
+
+    NanUtf8String name(args[0]);
+    NanReturnValue(NanNew<Boolean>(buf_ring_unlink(*name) == BUF_OK));
+}
+
+// Public API: - Ring.prototype.cap getter
+//
+NAN_GETTER(Ring::GetCap) {
+    NanScope();
+    Ring *holder = ObjectWrap::Unwrap<Ring>(args.Holder());
+    ASSERT_OPEN(holder);
+    NanReturnValue(NanNew<Number>(holder->ring->cap));
+}
+
+// Public API: - Ring.prototype.length getter
+//
+NAN_GETTER(Ring::GetLength) {
+    NanScope();
+    Ring *holder = ObjectWrap::Unwrap<Ring>(args.Holder());
+    ASSERT_OPEN(holder);
+    NanReturnValue(NanNew<Number>(buf_ring_size(holder->ring)));
+}
+
+// Public API: - Ring.prototype.put O(n)
+//
+// Put a string/buffer/buf, or an array of them committed at once, returns
+// false if the ring has no room (after `timeout` ms).
+NAN_METHOD(Ring::Put) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(3);
+
+    Ring *holder = ObjectWrap::Unwrap<Ring>(args.Holder());
+    ASSERT_OPEN(holder);
+
+    buf_ring_t *ring = holder->ring;
+    long timeout;
+
+    if (!Ring::ParseTimeout(args[1], &timeout))
+        return NanThrowTypeError("requires integer timeout");
+
+    Local<Array> vals;
+
+    if (args[0]->IsArray()) {
+        vals = args[0].As<Array>();
+    } else {
+        vals = NanNew<Array>(1);
+        vals->Set(0, args[0]);
+    }
+
+    // encode every value once before reserving, the reservation must be
+    // committed with exactly the bytes written
+    ScratchBytes scratch;
+    std::vector<uint8_t *> data;
+    std::vector<size_t> lens;
+    int ret = Buf::ArrayBytes(vals, false, &scratch, &data, &lens);
+
+    if (ret == BUF_EFAILED)
+        return NanThrowTypeError("requires string/buffer/buf");
+    if (ret != BUF_OK)
+        return NanThrowError("No memory");
+
+    size_t size = 0;
+
+    for (size_t i = 0; i < lens.size(); i++)
+        size += lens[i];
+
+    if (size > ring->cap)
+        return NanThrowRangeError("too large for the ring");
+
+    size_t pos;
+
+    while (buf_ring_reserve(ring, size, &pos) != BUF_OK) {
+        if (timeout == 0 || !buf_ring_wait(ring, size, true, timeout))
+            NanReturnValue(NanFalse());
+    }
+
+    size_t off = pos;
+
+    for (size_t i = 0; i < data.size(); i++) {
+        buf_ring_write(ring, off, data[i], lens[i]);
+        off += lens[i];
+    }
+
+    buf_ring_commit(ring, pos, size);
+    NanReturnValue(NanTrue());
+}
+
+// Public API: - Ring.prototype.takeInto O(n)
+//
+// Take at most `max` bytes to a buf, waits `timeout` ms for any bytes,
+// returns number of bytes taken.
+NAN_METHOD(Ring::TakeInto) {
+    NanScope();
+    ASSERT_ARGS_LEN_GT(0);
+    ASSERT_ARGS_LEN_LT(4);
+
+    if (!Buf::HasInstance(args[0]))
+        return NanThrowTypeError("requires buf");
+
+    Ring *holder = ObjectWrap::Unwrap<Ring>(args.Holder());
+    ASSERT_OPEN(holder);
+
+    Buf *target = Buf::UnwrapFlat(args[0]->ToObject());
+    ASSERT_UNLOCKED(target);
+
+    size_t max = (size_t)-1;
+    long timeout;
+
+    if (args.Length() > 1 && !args[1]->IsUndefined()) {
+        ASSERT_UINT32(args[1]);
+        max = args[1]->Uint32Value();
+    }
+
+    if (!Ring::ParseTimeout(args[2], &timeout))
+        return NanThrowTypeError("requires integer timeout");
+
+    if (timeout != 0)
+        buf_ring_wait(holder->ring, 1, false, timeout);
+
+    size_t size = target->buf->size;
+    ASSERT_BUF_OK(buf_ring_take(holder->ring, target->buf, max));
+    NanReturnValue(NanNew<Number>(target->buf->size - size));
+}
+
+// Public API: - Ring.prototype.take O(n)
+//
+// Same as takeInto, returns a new buf.
+NAN_METHOD(Ring::Take) {
+    NanScope();
+    ASSERT_ARGS_LEN_LT(3);
+
+    Ring *holder = ObjectWrap::Unwrap<Ring>(args.Holder());
+    ASSERT_OPEN(holder);
+
+    size_t max = (size_t)-1;
+    long timeout;
+
+    if (args.Length() > 0 && !args[0]->IsUndefined()) {
+        ASSERT_UINT32(args[0]);
+        max = args[0]->Uint32Value();
+    }
+
+    if (!Ring::ParseTimeout(args[1], &timeout))
+        return NanThrowTypeError("requires integer timeout");
+
+    if (timeout != 0)
+        buf_ring_wait(holder->ring, 1, false, timeout);
+
+    Local<Object> inst = Buf::NewInstance(1024);
+    Buf *target = Buf::UnwrapFlat(inst);
+    ASSERT_BUF_OK(buf_ring_take(holder->ring, target->buf, max));
+    NanReturnValue(inst);
+}
+
+// Public API: - Ring.prototype.close
+//
+NAN_METHOD(Ring::Close) {
+    NanScope();
+    Ring *holder = ObjectWrap::Unwrap<Ring>(args.Holder());
+    buf_ring_free(holder->ring);
+    holder->ring = NULL;
+    NanReturnUndefined();
+}
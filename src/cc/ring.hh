@@ -0,0 +1,39 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#ifndef _BUF_RING_HH
+#define _BUF_RING_HH
+
+#include <v8.h>
+#include <node.h>
+#include <buf.h>
+#include "nan.h"
+
+namespace buf {
+using namespace v8;
+using namespace node;
+
+// Bytes ring in shared memory, multiple producers and single consumer,
+// which may live in different processes.
+class Ring : public ObjectWrap {
+public:
+    Ring(buf_ring_t *ring);
+    ~Ring();
+
+    static Persistent<FunctionTemplate> constructor;
+    static void Initialize(Handle<Object> exports);
+    static NAN_METHOD(New);
+    static NAN_METHOD(Unlink);
+    static NAN_METHOD(Put);
+    static NAN_METHOD(Take);
+    static NAN_METHOD(TakeInto);
+    static NAN_METHOD(Close);
+    static NAN_GETTER(GetCap);
+    static NAN_GETTER(GetLength);
+private:
+    static bool ParseTimeout(Handle<Value> val, long *timeout);
+    buf_ring_t *ring;
+};
+};
+
+#endif
@@ -0,0 +1,317 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#include <algorithm>
+#include <deque>
+#include <uv.h>
+#include "scan.hh"
+
+#define SCAN_HEAD 64  // chain positions kept per chunk when counting
+
+namespace buf {
+
+scan_config_t scanConfig = { 0, SCAN_MIN_CHUNK };
+
+enum scan_mode_t {
+    SCAN_INDEX,
+    SCAN_COUNT,
+    SCAN_ALL,
+};
+
+// A chunk owns matches starting in [lo, hi), found by scanning up to
+// `hi + len - 1`. Its non-overlapping chain assumes a match may start at
+// `lo`, the merge resyncs it with the previous chunk.
+struct chunk_t {
+    size_t lo;
+    size_t hi;
+    size_t count;  // matches on the chain
+    size_t end;  // end of the last match
+    std::vector<size_t> pos;  // chain positions (head only if counting)
+};
+
+struct scan_t {
+    scan_config_t config;
+    buf_finder_t finder;
+    uint8_t *data;
+    size_t size;
+    scan_mode_t mode;
+    std::vector<chunk_t> chunks;
+    size_t next;  // next chunk to take
+    size_t found;  // first chunk with a match (index mode)
+    size_t helpers;  // pool threads on it, guarded by poolLock
+    uv_mutex_t lock;
+};
+
+// Helper threads, kept for the process. A scan posts itself once per
+// helper wanted, helpers take posts and join its chunks.
+static uv_once_t poolOnce = UV_ONCE_INIT;
+static uv_mutex_t poolLock;
+static uv_cond_t poolPosted;
+static uv_cond_t poolDone;
+static std::deque<scan_t *> poolPosts;
+static size_t poolSize = 0;
+
+static int CpuCount() {
+    static int count = 0;
+
+    if (count == 0) {
+        uv_cpu_info_t *cpus;
+
+        if (uv_cpu_info(&cpus, &count) != 0 || count < 1) {
+            count = 1;
+        } else {
+            uv_free_cpu_info(cpus, count);
+        }
+    }
+    return count;
+}
+
+static void ScanChunk(scan_t *scan, chunk_t *chunk) {
+    size_t len = scan->finder.len;
+    size_t limit = std::min(chunk->hi + len - 1, scan->size);
+    size_t idx = chunk->lo;
+
+    while (idx < chunk->hi) {
+        size_t p = buf_finder_find(&scan->finder, scan->data, limit, idx);
+
+        if (p >= chunk->hi)
+            break;
+
+        chunk->count++;
+        chunk->end = p + len;
+
+        if (scan->mode != SCAN_COUNT || chunk->pos.size() < SCAN_HEAD)
+            chunk->pos.push_back(p);
+
+        if (scan->mode == SCAN_INDEX)
+            break;
+        idx = p + len;
+    }
+}
+
+static void ScanThread(void *arg) {
+    scan_t *scan = static_cast<scan_t *>(arg);
+
+    for (;;) {
+        uv_mutex_lock(&scan->lock);
+        size_t k = scan->next++;
+        bool stop = k >= scan->chunks.size() || k > scan->found;
+        uv_mutex_unlock(&scan->lock);
+
+        if (stop)
+            return;
+
+        ScanChunk(scan, &scan->chunks[k]);
+
+        if (scan->mode == SCAN_INDEX && scan->chunks[k].count > 0) {
+            uv_mutex_lock(&scan->lock);
+            if (k < scan->found)
+                scan->found = k;
+            uv_mutex_unlock(&scan->lock);
+        }
+    }
+}
+
+static void PoolThread(void *arg) {
+    (void)arg;
+    uv_mutex_lock(&poolLock);
+
+    for (;;) {
+        while (poolPosts.empty())
+            uv_cond_wait(&poolPosted, &poolLock);
+
+        scan_t *scan = poolPosts.front();
+        poolPosts.pop_front();
+        scan->helpers++;
+        uv_mutex_unlock(&poolLock);
+
+        ScanThread(scan);
+
+        uv_mutex_lock(&poolLock);
+        if (--scan->helpers == 0)
+            uv_cond_broadcast(&poolDone);
+    }
+}
+
+static void PoolInit() {
+    uv_mutex_init(&poolLock);
+    uv_cond_init(&poolPosted);
+    uv_cond_init(&poolDone);
+}
+
+// Start helpers up to `n`, returns how many there are. Called with
+// poolLock held.
+static size_t PoolReserve(size_t n) {
+    n = std::min(n, (size_t)SCAN_MAX_HELPERS);
+
+    while (poolSize < n) {
+        uv_thread_t tid;
+
+        if (uv_thread_create(&tid, PoolThread, NULL) != 0)
+            break;  // scan with the helpers there are
+        poolSize++;
+    }
+    return std::min(n, poolSize);
+}
+
+// Cut [start, size) in chunks and scan them on the threads.
+static void Scan(scan_t *scan, size_t start) {
+    size_t range = scan->size - start;
+    size_t threads = scan->config.threads > 0 ? scan->config.threads :
+        CpuCount();
+    size_t nchunks = range / std::max(scan->config.minChunk, (size_t)1);
+
+    // a few chunks per thread to balance
+    nchunks = std::min(nchunks, threads * 4);
+    nchunks = std::max(nchunks, (size_t)1);
+
+    size_t step = (range + nchunks - 1) / nchunks;
+
+    for (size_t lo = start; lo < scan->size; lo += step) {
+        chunk_t chunk;
+        chunk.lo = lo;
+        chunk.hi = std::min(lo + step, scan->size);
+        chunk.count = 0;
+        chunk.end = lo;
+        scan->chunks.push_back(chunk);
+    }
+
+    scan->next = 0;
+    scan->found = scan->chunks.size();
+    scan->helpers = 0;
+    threads = std::min(threads, scan->chunks.size());
+
+    if (threads <= 1) {
+        for (size_t k = 0; k < scan->chunks.size(); k++) {
+            ScanChunk(scan, &scan->chunks[k]);
+            if (scan->mode == SCAN_INDEX && scan->chunks[k].count > 0)
+                break;
+        }
+        return;
+    }
+
+    uv_once(&poolOnce, PoolInit);
+    uv_mutex_init(&scan->lock);
+    uv_mutex_lock(&poolLock);
+
+    size_t helpers = PoolReserve(threads - 1);
+
+    for (size_t i = 0; i < helpers; i++)
+        poolPosts.push_back(scan);
+    uv_cond_broadcast(&poolPosted);
+    uv_mutex_unlock(&poolLock);
+
+    ScanThread(scan);  // this thread takes chunks too
+
+    // chunks are all taken, drop posts no helper got to and wait for
+    // the helpers still scanning
+    uv_mutex_lock(&poolLock);
+    poolPosts.erase(std::remove(poolPosts.begin(), poolPosts.end(), scan),
+            poolPosts.end());
+    while (scan->helpers > 0)
+        uv_cond_wait(&poolDone, &poolLock);
+    uv_mutex_unlock(&poolLock);
+    uv_mutex_destroy(&scan->lock);
+}
+
+// Merge chunk chains in order to the global non-overlapping chain, a chunk
+// whose chain starts inside the previous match is rescanned until it meets
+// its own chain again.
+static size_t Merge(scan_t *scan, std::vector<size_t> *out) {
+    size_t len = scan->finder.len;
+    size_t next = 0;
+    size_t count = 0;
+
+    for (size_t k = 0; k < scan->chunks.size(); k++) {
+        chunk_t *chunk = &scan->chunks[k];
+
+        if (chunk->count == 0)
+            continue;
+
+        size_t i = 0;
+
+        if (chunk->pos[0] < next) {
+            size_t limit = std::min(chunk->hi + len - 1, scan->size);
+            size_t p = buf_finder_find(&scan->finder, scan->data, limit, next);
+            i = chunk->count;
+
+            while (p < chunk->hi) {
+                std::vector<size_t>::iterator it = std::lower_bound(
+                        chunk->pos.begin(), chunk->pos.end(), p);
+
+                if (it != chunk->pos.end() && *it == p) {
+                    i = it - chunk->pos.begin();  // synced
+                    break;
+                }
+
+                count++;
+                if (out != NULL)
+                    out->push_back(p);
+                next = p + len;
+                p = buf_finder_find(&scan->finder, scan->data, limit, next);
+            }
+
+            if (i == chunk->count)
+                continue;
+        }
+
+        count += chunk->count - i;
+        if (out != NULL)
+            out->insert(out->end(), chunk->pos.begin() + i, chunk->pos.end());
+        next = chunk->end;
+    }
+    return count;
+}
+
+// Find first position of bytes in data from `start`, `size` if not found.
+size_t ScanIndex(const scan_config_t &config, uint8_t *data, size_t size,
+        uint8_t *sub, size_t len, size_t start) {
+    if (len == 0 || start >= size)
+        return start < size ? start : size;
+
+    scan_t scan;
+    scan.config = config;
+    buf_finder_init(&scan.finder, sub, len);
+    scan.data = data;
+    scan.size = size;
+    scan.mode = SCAN_INDEX;
+    Scan(&scan, start);
+
+    for (size_t k = 0; k < scan.chunks.size(); k++)
+        if (scan.chunks[k].count > 0)
+            return scan.chunks[k].pos[0];
+    return size;
+}
+
+// Count non-overlapping occurrences of bytes in data, 0 for empty bytes.
+size_t ScanCount(const scan_config_t &config, uint8_t *data, size_t size,
+        uint8_t *sub, size_t len) {
+    if (len == 0 || size == 0)
+        return 0;
+
+    scan_t scan;
+    scan.config = config;
+    buf_finder_init(&scan.finder, sub, len);
+    scan.data = data;
+    scan.size = size;
+    scan.mode = SCAN_COUNT;
+    Scan(&scan, 0);
+    return Merge(&scan, NULL);
+}
+
+// Put positions of non-overlapping occurrences of bytes in data to `out`.
+void ScanAll(const scan_config_t &config, uint8_t *data, size_t size,
+        uint8_t *sub, size_t len, std::vector<size_t> *out) {
+    if (len == 0 || size == 0)
+        return;
+
+    scan_t scan;
+    scan.config = config;
+    buf_finder_init(&scan.finder, sub, len);
+    scan.data = data;
+    scan.size = size;
+    scan.mode = SCAN_ALL;
+    Scan(&scan, 0);
+    Merge(&scan, out);
+}
+}
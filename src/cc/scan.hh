@@ -0,0 +1,34 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#ifndef _BUF_SCAN_HH
+#define _BUF_SCAN_HH
+
+#include <vector>
+#include <buf.h>
+
+#define SCAN_MIN_CHUNK 1024 * 1024  // 1mb
+#define SCAN_MAX_HELPERS 64
+
+namespace buf {
+
+// Parallel search, bytes are cut in chunks scanned by `threads` threads
+// (0 for cpu count): the calling one and helpers of a pool started on
+// first use. Each chunk is at least `minChunk` bytes.
+struct scan_config_t {
+    int threads;
+    size_t minChunk;
+};
+
+// Set by Buf.configure on the main thread, async workers take a copy.
+extern scan_config_t scanConfig;
+
+size_t ScanIndex(const scan_config_t &config, uint8_t *data, size_t size,
+        uint8_t *sub, size_t len, size_t start);
+size_t ScanCount(const scan_config_t &config, uint8_t *data, size_t size,
+        uint8_t *sub, size_t len);
+void ScanAll(const scan_config_t &config, uint8_t *data, size_t size,
+        uint8_t *sub, size_t len, std::vector<size_t> *out);
+}
+
+#endif
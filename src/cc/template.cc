@@ -0,0 +1,81 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#include <v8.h>
+#include <node.h>
+#include "buf.hh"
+#include "template.hh"
+
+using namespace buf;
+
+Persistent<FunctionTemplate> BufTemplate::constructor;
+
+BufTemplate::BufTemplate(buf_tpl_t *tpl) : tpl(tpl) {}
+
+BufTemplate::~BufTemplate() {
+    buf_tpl_free(tpl);
+}
+
+// Register prototypes and exports
+//
+void BufTemplate::Initialize(Handle<Object> exports) {
+    NanScope();
+    // Constructor
+    Local<FunctionTemplate> ctor = NanNew<FunctionTemplate>(New);
+    ctor->InstanceTemplate()->SetInternalFieldCount(1);
+    ctor->SetClassName(NanNew("BufTemplate"));
+    // Persistents
+    NanAssignPersistent(constructor, ctor);
+    // Accessors
+    ctor->InstanceTemplate()->SetAccessor(NanNew<String>("slots"), GetSlots);
+    ctor->InstanceTemplate()->SetAccessor(NanNew<String>("length"), GetLength);
+    // Exports
+    exports->Set(NanNew<String>("BufTemplate"), ctor->GetFunction());
+}
+
+bool BufTemplate::HasInstance(Handle<Value> val) {
+    return val->IsObject() && val.As<Object>()->InternalFieldCount() == 1 &&
+        NanHasInstance(constructor, val);
+}
+
+// Wrap a compiled template, the object owns it.
+Local<Object> BufTemplate::NewInstance(buf_tpl_t *tpl) {
+    NanEscapableScope();
+    Local<Value> argv[1] = { NanNew<External>(tpl) };
+    Local<FunctionTemplate> ctor = NanNew<FunctionTemplate>(constructor);
+    return NanEscapeScope(ctor->GetFunction()->NewInstance(1, argv));
+}
+
+// Public API: - BufTemplate constructor
+//
+// Not for js, templates are made by Buf.compileTemplate.
+NAN_METHOD(BufTemplate::New) {
+    NanScope();
+
+    if (!args.IsConstructCall() || args.Length() != 1 ||
+            !args[0]->IsExternal())
+        return NanThrowError("use Buf.compileTemplate(..)");
+
+    buf_tpl_t *tpl = static_cast<buf_tpl_t *>(
+            args[0].As<External>()->Value());
+    BufTemplate *holder = new BufTemplate(tpl);
+    holder->Wrap(args.This());
+    NanReturnValue(args.This());
+}
+
+// Public API: - BufTemplate.prototype.slots getter
+//
+NAN_GETTER(BufTemplate::GetSlots) {
+    NanScope();
+    BufTemplate *holder = ObjectWrap::Unwrap<BufTemplate>(args.Holder());
+    NanReturnValue(NanNew<Number>(holder->tpl->nslots));
+}
+
+// Public API: - BufTemplate.prototype.length getter
+//
+// Bytes of the literals, the output size without values.
+NAN_GETTER(BufTemplate::GetLength) {
+    NanScope();
+    BufTemplate *holder = ObjectWrap::Unwrap<BufTemplate>(args.Holder());
+    NanReturnValue(NanNew<Number>(holder->tpl->size));
+}
@@ -0,0 +1,34 @@
+// Bytes buffer addon with dynamic size for nodejs/iojs
+// Copyright (c) Chao Wang <hit9@icloud.com>
+
+#ifndef _BUF_TEMPLATE_HH
+#define _BUF_TEMPLATE_HH
+
+#include <v8.h>
+#include <node.h>
+#include <buf.h>
+#include "nan.h"
+
+namespace buf {
+using namespace v8;
+using namespace node;
+
+// Compiled byte template, made by Buf.compileTemplate and rendered by
+// buf.render.
+class BufTemplate : public ObjectWrap {
+public:
+    BufTemplate(buf_tpl_t *tpl);
+    ~BufTemplate();
+
+    static Persistent<FunctionTemplate> constructor;
+    static void Initialize(Handle<Object> exports);
+    static bool HasInstance(Handle<Value> val);
+    static Local<Object> NewInstance(buf_tpl_t *tpl);
+    static NAN_METHOD(New);
+    static NAN_GETTER(GetSlots);
+    static NAN_GETTER(GetLength);
+    buf_tpl_t *tpl;
+};
+};
+
+#endif
@@ -3,6 +3,9 @@
 var assert = require('assert');
 var bbuf   = require('./index');
 var Buf    = bbuf.Buf;
+var Ring   = bbuf.Ring;
+var BufMap = bbuf.BufMap;
+var BufSet = bbuf.BufSet;
 
 describe('bbuf', function() {
   it('new Buf()', function() {
@@ -37,6 +40,75 @@ describe('bbuf', function() {
     assert(buf.cap === 12);
     buf.clear();
     assert(buf.put('中文') === 6);
+    buf.clear();
+    assert(buf.put(new Buffer([0, 255, 1])) === 3);
+    assert.deepEqual(buf.bytes(), [0, 255, 1]);
+    assert(buf.put(buf) === 3);
+    assert.deepEqual(buf.bytes(), [0, 255, 1, 0, 255, 1]);
+    buf.clear();
+    assert(buf.put('\u00e9a') === 3);
+    assert(buf.toString() === '\u00e9a');
+  });
+
+  it('buf.putJSONString/Number/Raw', function() {
+    var buf = new Buf(4);
+    var strs = ['', 'abc', 'a"b\\c', 'line\nbreak\ttab\r\b\f',
+                '\u0000\u001f\u007f', '中文 \u00e9',
+                new Array(100).join('x"')];
+    strs.forEach(function(s) {
+      buf.clear();
+      assert(buf.putJSONString(s) === Buffer.byteLength(JSON.stringify(s)));
+      assert(buf.toString() === JSON.stringify(s));
+      assert(JSON.parse(buf.toString()) === s);
+    });
+    // lone surrogates are escaped, pairs and U+FFFD are utf8
+    buf.clear();
+    assert(buf.putJSONString('a\ud800b\udc00\ud83d\ude00\ufffd') === 23);
+    assert(buf.toString() === '"a\\ud800b\\udc00\ud83d\ude00\ufffd"');
+    buf.clear();
+    buf.put('a\nb');
+    buf.putJSONString(buf);
+    assert(buf.toString() === 'a\nb"a\\nb"');
+    [0, -1, 1.5, -0, 1e21, 1e-7, 0.1, 2147483648, NaN, Infinity].forEach(
+      function(n) {
+        buf.clear();
+        buf.putJSONNumber(n);
+        assert(buf.toString() === JSON.stringify(n));
+      });
+    buf.clear();
+    buf.putJSONRaw('{"a":');
+    buf.putJSONNumber(1);
+    buf.putJSONRaw(new Buffer('}'));
+    assert.deepEqual(JSON.parse(buf.toString()), {a: 1});
+    assert.throws(function() { buf.putJSONNumber('1'); });
+    assert.throws(function() { buf.putJSONString(1); });
+  });
+
+  it('Buf.compileTemplate/buf.render', function() {
+    var tpl = Buf.compileTemplate('HTTP/1.1 $status OK\r\n' +
+      'Content-Length: $len\r\nX-Id: $id$status\r\n\r\n',
+      ['$status', '$len', new Buffer('$id')]);
+    assert(tpl.slots === 3);
+    assert(tpl.length === 42);
+    var buf = new Buf(4);
+    var id = new Buf(4);
+    id.put('ab');
+    assert(buf.render(tpl, [200, 1.5, id]) === 53);
+    assert(buf.toString() === 'HTTP/1.1 200 OK\r\nContent-Length: 1.5\r\n' +
+           'X-Id: ab200\r\n\r\n');
+    buf.clear();
+    assert(buf.render(tpl, [new Buffer('404'), '中文', -1]) === 56);
+    assert(buf.toString().indexOf('Length: 中文\r\nX-Id: -1404') > 0);
+    // values from the buf itself
+    assert(buf.render(tpl, [buf, '', '']) === 56 * 2 + 42);
+    assert(buf.slice(56 + 9, 56 + 17).toString() === 'HTTP/1.1');
+    assert.throws(function() {buf.render(tpl, [1, 2])}, RangeError);
+    assert.throws(function() {buf.render(tpl, [1, 2, {}])}, TypeError);
+    assert.throws(function() {buf.render({}, [])}, TypeError);
+    assert.throws(function() {Buf.compileTemplate('a', [''])}, RangeError);
+    assert.throws(function() {Buf.compileTemplate('a', [1])}, TypeError);
+    assert.throws(function() {new bbuf.BufTemplate()}, Error);
+    assert(new Buf(4).render(Buf.compileTemplate('', []), []) === 0);
   });
 
   it('buf.toString', function() {
@@ -44,6 +116,39 @@ describe('bbuf', function() {
     var str = 'abcdefg';
     assert(buf.put(str) === str.length);
     assert(buf.toString() === str);
+    assert(buf.toString('utf8', 1, 3) === 'bc');
+    assert(buf.toString(undefined, 5) === 'fg');
+    assert(buf.toString('utf8', 5, 100) === 'fg');
+    assert(buf.toString('utf8', 5, 1) === '');
+    assert(buf.toString('hex', 0, 2) === '6162');
+    assert(buf.toString('base64') === 'YWJjZGVmZw==');
+    buf.put([0, 104]);
+    assert(buf.toString() === 'abcdefg\u0000h');
+    buf.clear();
+    buf.put('中文');
+    assert(buf.toString() === '中文');
+    assert(buf.toString('latin1', 0, 1) === '\u00e4');
+    assert(buf.toString('ascii', 0, 1) === 'd');
+    assert.throws(function() {buf.toString('what')}, Error);
+    // large external string
+    buf.clear();
+    for (var i = 0; i < 1024 * 10; i++)
+      buf.put('0123456789abcdef0123456789abcdef');
+    var s = buf.toString();
+    assert(s.length === buf.length);
+    assert(s.slice(-4) === 'cdef');
+    assert(buf.toString('latin1').length === buf.length);
+  });
+
+  it('buf.isAscii/isUtf8', function() {
+    var buf = new Buf(4);
+    assert(buf.isAscii() && buf.isUtf8());
+    buf.put('hello');
+    assert(buf.isAscii() && buf.isUtf8());
+    buf.put('中文');
+    assert(!buf.isAscii() && buf.isUtf8());
+    buf.pop(1);
+    assert(!buf.isUtf8());
   });
 
   it('buf.clear', function() {
@@ -96,6 +201,118 @@ describe('bbuf', function() {
     assert.deepEqual(buf.bytes(), [97, 98, 99]);
   });
 
+  it('buf.view', function() {
+    var buf = new Buf(4);
+    assert(buf.view().length === 0);
+    assert(buf.put('abc') === 3);
+    var view = buf.view();
+    assert(view instanceof Uint8Array);
+    assert.deepEqual([].slice.call(view), [97, 98, 99]);
+    view[0] = 120;
+    assert(buf.toString() === 'xbc');
+    // shares memory while the data stays
+    assert(buf.pop(1) === 1);
+    assert(buf.view().length === 2);
+    assert(view.length === 3);
+    // detached once the data moves
+    buf.put('0123456789');
+    assert(view.length === 0);
+    assert(buf.view().length === 12);
+    view = buf.view();
+    buf.clear();
+    assert(view.length === 0);
+  });
+
+  it('buf.view on a locked buf', function(done) {
+    var buf = new Buf(4);
+    buf.put('abc');
+    buf.hash64Async(function(err) {
+      assert(!err && buf.view().length === 3);
+      done();
+    });
+    assert.throws(function() {buf.view()}, /locked/);
+  });
+
+  it('Buf.createWriteStream', function(done) {
+    var buf = new Buf(4);
+    var ws = Buf.createWriteStream(buf, {highWaterMark: 8});
+    for (var i = 0; i < 10; i++)
+      ws.write(i % 2 ? 'ab' : new Buffer('cd'));
+    ws.write('\u00e9', 'latin1');
+    ws.end(new Buffer('Z'), function() {
+      assert(buf.length === 22);
+      assert(buf.toString('latin1') ===
+             new Array(6).join('cdab') + '\u00e9Z');
+      assert.throws(function() {Buf.createWriteStream('abc')}, TypeError);
+      done();
+    });
+  });
+
+  it('buf.createReadStream', function(done) {
+    var buf = new Buf(4);
+    buf.put('hello world');
+    var chunks = [];
+    buf.createReadStream({chunkSize: 3})
+      .on('data', function(chunk) {
+        assert(Buffer.isBuffer(chunk) && chunk.length <= 3);
+        chunks.push(chunk.toString());
+      })
+      .on('end', function() {
+        assert.deepEqual(chunks, ['hel', 'lo ', 'wor', 'ld']);
+        var out = new Buf(4);
+        buf.createReadStream({start: 6, end: 9})
+          .pipe(Buf.createWriteStream(out))
+          .on('finish', function() {
+            assert(out.toString() === 'wor');
+            done();
+          });
+      });
+  });
+
+  it('buf.createReadStream while the buf changes', function(done) {
+    var buf = new Buf(4);
+    buf.put('hello world');
+    var rs = buf.createReadStream({chunkSize: 3});
+    var chunks = [];
+    // all chunks are read into the stream buffer, then the buf grows
+    rs.read(0);
+    buf[0] = 72;
+    buf.put(new Buffer(1024));
+    rs.on('data', function(chunk) {
+      chunks.push(chunk.toString());
+    }).on('end', function() {
+      assert.deepEqual(chunks, ['hel', 'lo ', 'wor', 'ld']);
+      // zero-copy chunks share the buf data while it stays
+      var zc = buf.createReadStream({chunkSize: 3, zeroCopy: true});
+      var chunk = zc.read(3);
+      buf[1] = 69;
+      if (typeof Buffer.from === 'function')
+        assert(chunk.toString() === 'HEl');
+      done();
+    });
+  });
+
+  it('buf.createReadStream on a locked buf', function(done) {
+    var buf = new Buf(4);
+    buf.put('hello world');
+    var chunks = [];
+    buf.hash64Async(function(err) {
+      assert(!err);
+    });
+    var rs = buf.createReadStream({chunkSize: 4});
+    // chunks are read right now, while the buf is locked
+    rs.read(0);
+    assert.throws(function() {buf.view()}, /locked/);
+    assert(buf.toBuffer(0, 5).toString() === 'hello');
+    rs.on('data', function(chunk) {
+      chunks.push(chunk.toString());
+    }).on('end', function() {
+      assert.deepEqual(chunks, ['hell', 'o wo', 'rld']);
+      assert(buf.toBuffer(6).toString() === 'world');
+      done();
+    });
+  });
+
   it('get buf[idx]', function() {
     var buf = new Buf(4);
     assert(buf.put('abcdef') === 6);
@@ -142,6 +359,12 @@ describe('bbuf', function() {
     buf.put('中文');
     assert(buf.cmp(buf) == 0);
     assert(buf.slice(1).cmp(buf.slice(1)) == 0);
+    buf.clear();
+    buf.put('a\u0000b');
+    assert(buf.cmp('a\u0000b') === 0);
+    assert(buf.cmp('a\u0000c') < 0);
+    assert(buf.cmp('a') > 0);
+    assert(buf.cmp(new Buffer('a\u0000b')) === 0);
   });
 
   it('buf.cmp', function() {
@@ -171,6 +394,12 @@ describe('bbuf', function() {
     assert(buf.indexOf('天') === 3);
     assert(buf.indexOf(buf.slice(1)) === 1);
     assert(buf.indexOf(buf.slice(0, 4)) === 0);
+    buf.clear();
+    var str = new Array(300).join('ab') + 'c';
+    buf.put('x' + str);
+    assert(buf.indexOf(str) === 1);
+    assert(buf.indexOf(str + 'c') === -1);
+    assert(buf.indexOf(new Buffer('bc')) === buf.length - 2);
   });
 
   it('buf.isspace', function() {
@@ -188,6 +417,7 @@ describe('bbuf', function() {
     buf.put('hello world');
     assert(buf.startsWith('hello'));
     assert(!buf.startsWith('abcd'));
+    assert(!buf.startsWith('hello world!'));
     buf.clear();
     buf.put('你好');
     assert(buf.startsWith(buf.slice(0, 3)));
@@ -200,6 +430,7 @@ describe('bbuf', function() {
     buf.put('hello world');
     assert(buf.endsWith('world'));
     assert(!buf.endsWith('abcd'));
+    assert(!buf.endsWith('a hello world'));
     buf.clear();
     buf.put('你好');
     assert(buf.endsWith(buf.slice(5)));
@@ -207,4 +438,538 @@ describe('bbuf', function() {
     assert(!buf.endsWith(buf.slice(1, 3)));
     assert(buf.endsWith('好'));
   });
+
+  it('buf.putHex/toHex', function() {
+    var buf = new Buf(4);
+    assert(buf.putHex('616263') === 3);
+    assert(buf.toString() === 'abc');
+    assert(buf.toHex() === '616263');
+    assert(buf.putHex(new Buffer('FF00')) === 2);
+    assert.deepEqual(buf.bytes(), [97, 98, 99, 255, 0]);
+    assert(buf.toHex() === '616263ff00');
+    assert.throws(function() {buf.putHex('abc')}, Error);
+    assert.throws(function() {buf.putHex('zz')}, Error);
+    assert(buf.length === 5);
+    buf.clear();
+    assert(buf.toHex() === '');
+    var str = '';
+    for (var i = 0; i < 100; i++)
+      str += '0123456789abcdef';
+    assert(buf.putHex(str) === 800);
+    assert(buf.toHex() === str);
+  });
+
+  it('buf.putBase64/toBase64', function() {
+    var buf = new Buf(4);
+    assert(buf.putBase64('aGVsbG8=') === 5);
+    assert(buf.toString() === 'hello');
+    assert(buf.toBase64() === 'aGVsbG8=');
+    buf.clear();
+    assert(buf.putBase64('aGVsbG8') === 5);
+    assert(buf.toString() === 'hello');
+    assert.throws(function() {buf.putBase64('a')}, Error);
+    assert.throws(function() {buf.putBase64('a*==')}, Error);
+    buf.clear();
+    buf.put('中文');
+    assert(buf.toBase64() === new Buffer('中文').toString('base64'));
+  });
+
+  it('buf.encode/decode', function() {
+    var buf = new Buf(4);
+    buf.put('abc');
+    assert(buf.encode('hex').toString() === '616263');
+    assert(buf.encode('base64').toString() === 'YWJj');
+    assert(buf.encode('hex').decode('hex').equals('abc'));
+    var dst = new Buf(4);
+    assert(buf.encode('base64', dst) === 4);
+    assert(dst.decode('base64', dst) === 3);
+    assert(dst.toString() === 'YWJjabc');
+    assert.throws(function() {buf.encode('what')}, Error);
+    assert.throws(function() {buf.decode('hex')}, Error);
+  });
+
+  it('buf.dump', function() {
+    var buf = new Buf(4);
+    buf.put('hello world\n');
+    assert(buf.dump() ===
+      '00000000  68 65 6c 6c 6f 20 77 6f  72 6c 64 0a              ' +
+      '|hello world.|\n0000000c\n');
+    assert(buf.dump(6, 5) ===
+      '00000006  77 6f 72 6c 64                                    ' +
+      '|world|\n0000000b\n');
+  });
+
+  it('buf.inspect', function() {
+    var buf = new Buf(4);
+    assert(buf.inspect() === '<bbuf [0]>');
+    buf.put('abc');
+    assert(buf.inspect() === '<bbuf [3] 61 62 63>');
+    buf.length = 40;
+    assert(/^<bbuf \[40\] 61 62 63( 20){30} \.\.>$/.test(buf.inspect()));
+  });
+
+  it('buf.crc32/crc32c', function() {
+    var buf = new Buf(4);
+    assert(buf.crc32() === 0);
+    buf.put('123456789');
+    assert(buf.crc32() === 0xcbf43926);
+    assert(buf.crc32c() === 0xe3069283);
+    var crc = buf.crc32(0, 4);
+    assert(buf.crc32(4, buf.length, crc) === 0xcbf43926);
+    crc = buf.crc32c(0, 5);
+    assert(buf.crc32c(5, undefined, crc) === 0xe3069283);
+    assert.throws(function() {buf.crc32(-1)}, TypeError);
+  });
+
+  it('buf.hash64', function() {
+    var buf = new Buf(4);
+    assert(buf.hash64() === 'ef46db3751d8e999');
+    buf.put('abc');
+    assert(buf.hash64() === '44bc2cf5ad770999');
+    assert(buf.hash64(1) !== buf.hash64());
+    assert(buf.hash64(0, 1, 3) === buf.slice(1).hash64());
+  });
+
+  it('buf.deflateInto/inflateInto', function() {
+    var buf = new Buf(4);
+    var z = new Buf(4);
+    var out = new Buf(4);
+    for (var i = 0; i < 100; i++) buf.put('hello world');
+    assert(buf.deflateInto(z) === z.length);
+    assert(z.length < buf.length);
+    assert(z.inflateInto(out) === buf.length);
+    assert(out.equals(buf));
+    z.clear();
+    buf.deflateInto(z, {gzip: true, level: 9});
+    assert(z[0] === 0x1f && z[1] === 0x8b);
+    out.clear();
+    z.inflateInto(out);
+    assert(out.equals(buf));
+    assert.throws(function() {buf.inflateInto(out)}, Error);
+    assert.throws(function() {buf.deflateInto(z, {level: 10})}, TypeError);
+  });
+
+  it('buf.deflateIntoAsync/inflateIntoAsync', function(done) {
+    var buf = new Buf(4);
+    var z = new Buf(4);
+    var out = new Buf(4);
+    for (var i = 0; i < 100; i++) buf.put('hello world');
+    buf.deflateIntoAsync(z, {gzip: true}, function(err, n) {
+      assert(!err && n === z.length);
+      buf.put('!');
+      z.inflateIntoAsync(out, function(err, n) {
+        assert(!err && n === buf.length - 1);
+        assert(out.equals(buf.slice(0, -1)));
+        done();
+      });
+    });
+    assert.throws(function() {buf.put('!')}, Error);
+  });
+
+  it('buf.count', function() {
+    var buf = new Buf(4);
+    buf.put('abcabcaaaa');
+    assert(buf.count('abc') === 2);
+    assert(buf.count('aa') === 2);
+    assert(buf.count(new Buffer('a')) === 6);
+    assert(buf.count('') === 0);
+    assert.throws(function() {buf.count(1)}, TypeError);
+  });
+
+  it('Buf.configure', function() {
+    var threshold = Buf.configure().asyncThreshold;
+    assert(Buf.configure({asyncThreshold: 0}).asyncThreshold === 0);
+    assert(Buf.configure({asyncThreshold: threshold}).asyncThreshold ===
+           threshold);
+    assert.throws(function() {Buf.configure({asyncThreshold: -1})},
+                  TypeError);
+  });
+
+  [0, 1024 * 1024].forEach(function(threshold) {
+    it('buf async ops, threshold ' + threshold, function(done) {
+      var origin = Buf.configure().asyncThreshold;
+      Buf.configure({asyncThreshold: threshold});
+      var buf = new Buf(4);
+      for (var i = 0; i < 100; i++) buf.put('abcdef');
+      var other = buf.copy();
+      var pending = 0;
+      var sync = true;
+      function check(expect) {
+        pending++;
+        return function(err, val) {
+          assert(!sync && !err);
+          expect(val);
+          if (--pending === 0) {
+            assert.doesNotThrow(function() {buf.put('!')});
+            Buf.configure({asyncThreshold: origin});
+            done();
+          }
+        };
+      }
+      buf.indexOfAsync('def', 10, check(function(v) {assert(v === 15)}));
+      buf.indexOfAsync(0x66, check(function(v) {assert(v === 5)}));
+      buf.indexOfAsync('xyz', check(function(v) {assert(v === -1)}));
+      buf.countAsync('cd', check(function(v) {assert(v === 100)}));
+      buf.cmpAsync(other, check(function(v) {assert(v === 0)}));
+      buf.copyAsync(check(function(v) {assert(v.equals(buf))}));
+      buf.hash64Async(1, check(function(v) {assert(v === buf.hash64(1))}));
+      buf.crc32Async(check(function(v) {assert(v === buf.crc32())}));
+      buf.crc32cAsync(check(function(v) {assert(v === buf.crc32c())}));
+      // ranges, and checksums continued over a later range
+      buf.hash64Async(1, 3, 10, check(function(v) {
+        assert(v === buf.hash64(1, 3, 10));
+      }));
+      buf.crc32Async(0, 10, check(function(v) {
+        buf.crc32Async(10, undefined, v, check(function(w) {
+          assert(w === buf.crc32());
+        }));
+      }));
+      buf.crc32cAsync(5, 20, buf.crc32c(0, 5), check(function(v) {
+        assert(v === buf.crc32c(0, 20));
+      }));
+      assert.throws(function() {buf.crc32Async('a', function() {})},
+                    TypeError);
+      buf.encodeAsync('hex', check(function(v) {
+        assert(v.toString() === buf.toHex());
+      }));
+      assert.throws(function() {buf.put('!')}, Error);
+      assert.throws(function() {other.clear()}, Error);
+      sync = false;
+    });
+  });
+
+  it('buf.findAll/split', function() {
+    var buf = new Buf(4);
+    buf.put('a,b,,c');
+    assert.deepEqual(buf.findAll(','), [1, 3, 4]);
+    assert.deepEqual(buf.findAll('xyz'), []);
+    assert.deepEqual(buf.split(',').map(String), ['a', 'b', '', 'c']);
+    assert.deepEqual(buf.split(',,').map(String), ['a,b', 'c']);
+    assert.throws(function() {buf.split('')}, Error);
+  });
+
+  it('parallel search', function() {
+    var origin = Buf.configure();
+    var buf = new Buf(1024);
+    for (var i = 0; i < 10000; i++) buf.put(i % 7 ? 'aab' : 'aaa');
+    var count = buf.count('aa');
+    var all = buf.findAll('aa');
+    var index = buf.indexOf('ba', 100);
+    Buf.configure({threads: 4, minChunk: 97});
+    assert(buf.count('aa') === count);
+    assert.deepEqual(buf.findAll('aa'), all);
+    assert(buf.indexOf('ba', 100) === index);
+    Buf.configure(origin);
+  });
+
+  it('buf.insert/remove/splice', function() {
+    var buf = new Buf(4);
+    buf.put('helloworld');
+    assert(buf.insert(5, ', ') === 2);
+    assert(buf.length === 12);
+    assert(buf[5] === 44 && buf.charAt(7) === 'w');
+    assert(buf.insert(100, '!') === 1);
+    assert(buf.toString() === 'hello, world!');
+    assert(buf.remove(5, 1) === 1);
+    assert(buf.remove(11, 10) === 1);
+    assert(buf.toString() === 'hello world');
+    assert(buf.splice(0, 5, 'HELLO') === 5);
+    assert(buf.splice(6, 5, new Buffer('there')) === 5);
+    buf[5] = '_';
+    assert(buf.toString() === 'HELLO_there');
+    assert(buf.splice(5, 1) === 1);
+    buf.insert(0, buf);
+    assert(buf.toString() === 'HELLOthereHELLOthere');
+    for (var i = 0; i < 100; i++) buf.insert(i % buf.length, 'x');
+    assert(buf.count('x') === 100 && buf.length === 120);
+    assert.throws(function() {buf.insert(-1, 'a')}, TypeError);
+  });
+
+  it('reads of bufs with a gap', function() {
+    var gapped = function(s) {
+      var buf = new Buf(4);
+      buf.put(s);
+      buf.insert(2, 'X');
+      return buf;
+    };
+    var buf = gapped('abcdef');
+    var other = gapped('abcdef');
+    var flat = new Buf(4);
+    flat.put('abXcdef');
+    assert(buf.cmp(other) === 0 && buf.equals(other));
+    assert(buf.cmp('abXcdeg') < 0);
+    assert(buf.equals('ABXCDEF', {ignoreCase: true}));
+    assert(buf.startsWith(other) && buf.endsWith('Xcdef'));
+    assert(buf.toString() === 'abXcdef');
+    assert(buf.toString('utf8', 1, 4) === 'bXc');
+    assert(buf.toString('hex', 2, 3) === '58');
+    assert.deepEqual(buf.bytes(), flat.bytes());
+    assert(buf.copy().equals(flat) && buf.slice(1, 5).equals('bXcd'));
+    assert(buf.crc32(1, 6) === flat.crc32(1, 6));
+    assert(buf.hash64() === flat.hash64());
+    assert(buf.inspect() === flat.inspect());
+    assert(flat.indexOf(other) === 0 && flat.count(gapped('ab')) === 1);
+    assert(flat.put(gapped('12')) === 3 && flat.toString() === 'abXcdef12X');
+    var bufs = [gapped('zz'), gapped('aa'), gapped('mm')];
+    Buf.sort(bufs);
+    assert.deepEqual(bufs.map(String), ['aaX', 'mmX', 'zzX']);
+    assert.deepEqual(Buf.compareMany(bufs, gapped('mm')), [-12, 0, 13]);
+    assert(Buf.binarySearch(bufs, gapped('zz')) === 2);
+    var map = new BufMap();
+    map.set(gapped('key'), 1);
+    assert(map.get('keXy') === 1 && map.get(gapped('key')) === 1);
+  });
+
+  it('buf.replace', function() {
+    var buf = new Buf(4);
+    buf.put('a-b-c-d');
+    assert(buf.replace('-', '+') === 1);
+    assert(buf.toString() === 'a+b-c-d');
+    assert(buf.replace('-', '', {all: true}) === 2);
+    assert(buf.toString() === 'a+bcd');
+    assert(buf.replace(new Buffer('+'), '<->', {all: true}) === 1);
+    assert(buf.toString() === 'a<->bcd');
+    var copy = buf.replace('<->', '', {copy: true});
+    assert(copy.toString() === 'abcd' && buf.toString() === 'a<->bcd');
+    buf.clear();
+    buf.put('xxxx');
+    assert(buf.replace('x', 'yy', {all: true, limit: 3}) === 3);
+    assert(buf.toString() === 'yyyyyyx');
+    assert(buf.replace(buf, 'z') === 1);
+    assert(buf.toString() === 'z');
+    // operands over the buf data
+    buf.clear();
+    buf.put('xyzABxyz');
+    assert(buf.replace('xyz', buf.view().subarray(3, 5), {all: true}) === 2);
+    assert(buf.toString() === 'ABABAB');
+    buf.clear();
+    buf.put('aXbX');
+    assert(buf.replace('X', buf.view().subarray(0, 3), {all: true}) === 2);
+    assert(buf.toString() === 'aaXbbaXb');
+    assert.throws(function() {buf.replace('', 'a')}, Error);
+  });
+
+  it('ignoreCase options', function() {
+    var buf = new Buf(4);
+    buf.put('Content-Type: Text/HTML; charset=UTF-8');
+    var opts = {ignoreCase: true};
+    assert(buf.equals('content-type: text/html; charset=utf-8', opts));
+    assert(!buf.equals('content-type: text/html; charset=utf-8'));
+    assert(buf.cmp('CONTENT-TYPE: TEXT/HTML; CHARSET=UTF-8', opts) === 0);
+    assert(buf.cmp('content-typf', opts) < 0);
+    assert(buf.startsWith('CONTENT-type', opts));
+    assert(!buf.startsWith('CONTENT-type'));
+    assert(buf.endsWith('utf-8', opts));
+    assert(buf.indexOf('text/html', opts) === 14);
+    assert(buf.indexOf('text/html') === -1);
+    assert(buf.indexOf('T', 1, opts) === 3);
+    assert(buf.indexOf(99, opts) === 0);
+    assert(buf.equals(new Buf(0), {ignoreCase: false}) === false);
+  });
+
+  it('buf.toLowerCase/toUpperCase', function() {
+    var buf = new Buf(4);
+    buf.put('Hello, 世界 ABCXYZ[`{@');
+    assert(buf.toLowerCase() === buf);
+    assert(buf.toString() === 'hello, 世界 abcxyz[`{@');
+    buf.toUpperCase();
+    assert(buf.toString() === 'HELLO, 世界 ABCXYZ[`{@');
+  });
+
+  it('buf.trim/ltrim/rtrim', function() {
+    var buf = new Buf(4);
+    buf.put(' \t abc def \r\n\v\f');
+    assert(buf.ltrim() === 3);
+    assert(buf.rtrim() === 10);
+    assert.deepEqual(buf.trim(), [3, 10]);
+    buf.clear();
+    buf.put('   ');
+    assert.deepEqual(buf.trim(), [3, 3]);
+    assert(buf.isSpace());
+    buf.put('\xa0');
+    assert(!buf.isSpace());
+  });
+
+  it('buf.count(byte)/histogram', function() {
+    var buf = new Buf(4);
+    var i;
+    for (i = 0; i < 1000; i++)
+      buf.put(i % 7);
+    assert(buf.count(3) === 143);
+    assert(buf.count(new Buffer([6])) === 142);
+    var bins = buf.histogram();
+    assert(bins.length === 256);
+    assert(bins[0] === 143 && bins[6] === 142 && bins[7] === 0);
+  });
+
+  it('buf.reverse', function() {
+    var buf = new Buf(4);
+    var s = '';
+    for (var i = 0; i < 100; i++)
+      s += String.fromCharCode(97 + i % 26);
+    buf.put(s);
+    assert(buf.reverse() === buf);
+    assert(buf.toString() === s.split('').reverse().join(''));
+  });
+
+  it('Buf.sort', function() {
+    var strs = [], i, j;
+    for (i = 0; i < 500; i++) {
+      var s = '';
+      for (j = 0; j < i % 7; j++)
+        s += 'ab\u00ff'.charAt((i * 31 + j * 7) % 3);
+      strs.push(s);
+    }
+    var bufs = strs.map(function(s) {
+      var buf = new Buf(4);
+      buf.put(s);
+      return buf;
+    });
+    assert(Buf.sort(bufs) === bufs);
+    for (i = 1; i < bufs.length; i++)
+      assert(bufs[i - 1].cmp(bufs[i]) <= 0);
+    Buf.sort(bufs, {reverse: true});
+    for (i = 1; i < bufs.length; i++)
+      assert(bufs[i - 1].cmp(bufs[i]) >= 0);
+    assert.throws(function() {Buf.sort(['a'])}, TypeError);
+  });
+
+  it('Buf.compareMany/binarySearch', function() {
+    var bufs = ['b', 'd', 'd', 'f'].map(function(s) {
+      var buf = new Buf(4);
+      buf.put(s);
+      return buf;
+    });
+    assert.deepEqual(Buf.compareMany(bufs, 'd'), [-2, 0, 0, 2]);
+    assert.deepEqual(Buf.compareMany(bufs, bufs.slice().reverse()),
+                     [-4, 0, 0, 4]);
+    assert(Buf.binarySearch(bufs, 'd') === 1);
+    assert(Buf.binarySearch(bufs, new Buffer('f')) === 3);
+    assert(Buf.binarySearch(bufs, 'a') === -1);
+    assert(Buf.binarySearch(bufs, 'e') === -4);
+    assert(Buf.binarySearch(bufs, 'g') === -5);
+    bufs.reverse();
+    assert(Buf.binarySearch(bufs, 'd', {reverse: true}) === 1);
+    assert(Buf.binarySearch(bufs, 'c', {reverse: true}) === -4);
+  });
+});
+
+describe('Ring', function() {
+  it('ring.put/take', function() {
+    var ring = new Ring(100);
+    assert(ring.cap === 128);
+    assert(ring.length === 0);
+    assert(ring.put('abc'));
+    assert(ring.put(['de', new Buffer('f'), new Buf(4)]));
+    assert(ring.length === 6);
+    assert(ring.take(4).toString() === 'abcd');
+    var buf = new Buf(4);
+    buf.put('x');
+    assert(ring.takeInto(buf) === 2);
+    assert(buf.toString() === 'xef');
+    assert(ring.take().length === 0);
+    assert(ring.take(undefined, 5).length === 0);
+    assert.throws(function() {ring.put(new Array(130).join('a'))}, RangeError);
+    for (var i = 0; i < 16; i++) assert(ring.put('abcdefgh'));
+    assert(!ring.put('a'));
+    assert(!ring.put('a', 5));
+    ring.close();
+    assert.throws(function() {ring.take()}, Error);
+  });
+
+  it('ring.put bad value reserves nothing', function() {
+    var ring = new Ring(64);
+    var buf = new Buf(2);
+    buf.put('cd');
+    assert.throws(function() {ring.put(['ab', 1])}, TypeError);
+    assert(ring.length === 0);
+    var vals = [buf];
+    Object.defineProperty(vals, 1, {get: function() {
+      buf.put('e');  // grows, moves the buf data
+      return 'f';
+    }});
+    assert(ring.put(vals));
+    assert(ring.put('g'));
+    assert(ring.take().toString() === 'cdefg');
+  });
+
+  it('named ring', function() {
+    var name = '/bbuf-test-' + process.pid;
+    var ring = new Ring(64, name);
+    var other = new Ring(name);
+    assert(Ring.unlink(name));
+    assert(other.cap === 64);
+    other.put('hello');
+    assert(ring.take().toString() === 'hello');
+    assert.throws(function() {new Ring(name)}, Error);
+  });
+});
+
+describe('BufMap', function() {
+  it('map.get/set/has/increment/delete', function() {
+    var map = new BufMap();
+    var buf = new Buf(4);
+    buf.put('abc');
+    assert(map.increment(buf) === 1);
+    assert(map.increment('abc', 2) === 3);
+    assert(map.get(new Buffer('abc')) === 3);
+    assert(map.set('你好', 1.5) === map);
+    assert(map.get('你好') === 1.5);
+    assert(map.get('x') === undefined);
+    assert(map.size === 2);
+    assert(map.has('abc') && !map.has('ab'));
+    assert(map.delete('abc') && !map.delete('abc'));
+    assert(map.size === 1);
+    map.clear();
+    assert(map.size === 0 && !map.has('你好'));
+    assert.throws(function() {map.get(1)}, TypeError);
+    assert.throws(function() {map.set('a', 'b')}, TypeError);
+  });
+
+  it('map many keys', function() {
+    var map = new BufMap(16);
+    var i;
+    for (i = 0; i < 10000; i++)
+      map.increment('key' + (i % 5000));
+    for (i = 0; i < 5000; i += 2)
+      map.delete('key' + i);
+    for (i = 0; i < 5000; i++)
+      map.increment('new' + i);
+    assert(map.size === 7500);
+    assert(map.get('key1') === 2 && map.get('key2') === undefined);
+    assert(map.get('new4999') === 1);
+  });
+
+  it('map.forEach', function() {
+    var map = new BufMap();
+    map.set('a', 1);
+    map.set('b', 2);
+    map.set('c', 3);
+    map.delete('b');
+    var keys = [], values = [];
+    map.forEach(function(value, key) {
+      assert(Buf.isBuf(key));
+      keys.push(key.toString());
+      values.push(value);
+    });
+    assert.deepEqual(keys, ['a', 'c']);
+    assert.deepEqual(values, [1, 3]);
+    assert.throws(function() {
+      map.forEach(function() {map.set('d', 4)});
+    }, Error);
+    map.set('d', 4);
+    assert(map.size === 3);
+  });
+
+  it('set.add/has/delete/forEach', function() {
+    var set = new BufSet();
+    assert(set.add('abc'));
+    assert(!set.add(new Buffer('abc')));
+    assert(set.add(''));
+    assert(set.has('') && set.size === 2);
+    var keys = [];
+    set.forEach(function(key) {keys.push(key.toString())});
+    assert.deepEqual(keys, ['abc', '']);
+    assert(set.delete('abc') && set.size === 1);
+  });
 });
@@ -0,0 +1,193 @@
+/**
+ * Allocator test: arena hooks (grow in place, reclaim the last allocation,
+ * reset to one block), bufs on an allocator and buf_swap exchanging them.
+ *
+ *   make test-c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "buf.h"
+#include "test.h"
+
+static void *
+alloc(buf_arena_t *arena, size_t size)
+{
+    return arena->allocator.alloc(arena->allocator.ctx, size);
+}
+
+static void *
+resize(buf_arena_t *arena, void *ptr, size_t old, size_t size)
+{
+    return arena->allocator.realloc(arena->allocator.ctx, ptr, old, size);
+}
+
+static void
+release(buf_arena_t *arena, void *ptr, size_t size)
+{
+    arena->allocator.free(arena->allocator.ctx, ptr, size);
+}
+
+static size_t
+blocks(buf_arena_t *arena)
+{
+    buf_arena_block_t *block;
+    size_t n = 0;
+
+    for (block = arena->blocks; block != NULL; block = block->next)
+        n++;
+    return n;
+}
+
+static void
+test_realloc(void)
+{
+    buf_arena_t *arena = buf_arena_new(0);
+    uint8_t *a, *b, *c;
+
+    CHECK(arena != NULL);
+    CHECK((a = alloc(arena, 100)) != NULL);
+    memset(a, 'a', 100);
+
+    // the last allocation grows in place
+    CHECK(resize(arena, a, 100, 200) == a);
+    memset(a + 100, 'b', 100);
+
+    // not the last one any more, copied
+    CHECK((c = alloc(arena, 16)) != NULL);
+    CHECK((b = resize(arena, a, 200, 300)) != NULL && b != a);
+    CHECK(b[0] == 'a' && b[99] == 'a' && b[100] == 'b' && b[199] == 'b');
+
+    // no room left in the block, copied to a new one
+    CHECK((c = resize(arena, b, 300, 8192)) != NULL && c != b);
+    CHECK(c[0] == 'a' && c[199] == 'b');
+    CHECK(blocks(arena) == 2);
+
+    // from NULL, a plain alloc
+    CHECK(resize(arena, NULL, 0, 8) != NULL);
+    buf_arena_free(arena);
+}
+
+static void
+test_free(void)
+{
+    buf_arena_t *arena = buf_arena_new(0);
+    uint8_t *a, *b, *c;
+
+    CHECK(arena != NULL);
+    a = alloc(arena, 64);
+    b = alloc(arena, 64);
+    CHECK(a != NULL && b == a + 64);
+
+    // not the last allocation, kept
+    release(arena, a, 64);
+    CHECK((c = alloc(arena, 64)) == b + 64);
+
+    // the last allocation is reclaimed, once
+    release(arena, c, 64);
+    CHECK(alloc(arena, 64) == c);
+    release(arena, c, 64);
+    release(arena, c, 64);
+    release(arena, b, 64);
+    CHECK(alloc(arena, 64) == c);
+    buf_arena_free(arena);
+}
+
+static void
+test_reset(void)
+{
+    buf_arena_t *arena = buf_arena_new(1024);
+    uint8_t *a;
+    int i;
+
+    CHECK(arena != NULL && arena->block == 4096);
+    CHECK(blocks(arena) == 0);
+    buf_arena_reset(arena);
+
+    for (i = 0; i < 10; i++)
+        CHECK(alloc(arena, 1000) != NULL);
+    CHECK(blocks(arena) == 3);
+
+    // one block kept for reuse
+    buf_arena_reset(arena);
+    CHECK(blocks(arena) == 1 && arena->used == 0 && arena->last == NULL);
+    a = alloc(arena, 1000);
+    buf_arena_reset(arena);
+    CHECK(alloc(arena, 1000) == a);
+    CHECK(blocks(arena) == 1);
+    buf_arena_free(arena);
+}
+
+static void
+test_new_with(void)
+{
+    buf_arena_t *arena = buf_arena_new(0);
+    buf_t *buf;
+
+    CHECK(arena != NULL);
+    CHECK((buf = buf_new_with(16, &arena->allocator)) != NULL);
+    CHECK(buf->allocator == &arena->allocator);
+    CHECK(buf_puts(buf, "hello") == BUF_OK);
+    CHECK(buf->data == arena->last);
+    // grows in place on the arena
+    CHECK(buf_puts(buf, " world, grow past one unit") == BUF_OK);
+    CHECK(buf->data == arena->last && blocks(arena) == 1);
+    CHECK(buf_equals(buf, "hello world, grow past one unit"));
+    buf_free(buf);
+    CHECK(arena->last == NULL && arena->used == 0);
+
+    // NULL takes the global allocator
+    buf_set_allocator(&arena->allocator);
+    CHECK(buf_get_allocator() == &arena->allocator);
+    CHECK((buf = buf_new_with(16, NULL)) != NULL);
+    CHECK(buf->allocator == &arena->allocator);
+    buf_free(buf);
+    buf_set_allocator(NULL);
+    CHECK(buf_get_allocator() == &buf_system_allocator);
+    CHECK((buf = buf_new(16)) != NULL);
+    CHECK(buf->allocator == &buf_system_allocator);
+    buf_free(buf);
+    buf_arena_free(arena);
+}
+
+static void
+test_swap(void)
+{
+    buf_arena_t *arena = buf_arena_new(0);
+    buf_t *a, *b;
+
+    CHECK(arena != NULL);
+    a = buf_new_with(16, &arena->allocator);
+    b = buf_new(16);
+    CHECK(a != NULL && b != NULL);
+    CHECK(buf_puts(a, "arena") == BUF_OK);
+    CHECK(buf_puts(b, "system") == BUF_OK);
+    CHECK(buf_insert(b, 0, (uint8_t *)"X", 1) == BUF_OK);
+
+    // data goes with its allocator, gap included
+    buf_swap(a, b);
+    CHECK(a->allocator == &buf_system_allocator);
+    CHECK(b->allocator == &arena->allocator);
+    CHECK(a->gaplen > 0 && buf_equals(a, "Xsystem"));
+    CHECK(b->gaplen == 0 && buf_equals(b, "arena"));
+
+    // each is grown and freed by its own allocator
+    CHECK(buf_puts(a, "!") == BUF_OK && buf_equals(a, "Xsystem!"));
+    CHECK(buf_puts(b, "!") == BUF_OK && b->data == arena->last);
+    buf_free(a);
+    buf_free(b);
+    buf_arena_free(arena);
+}
+
+int
+main(void)
+{
+    test_realloc();
+    test_free();
+    test_reset();
+    test_new_with();
+    test_swap();
+    printf("test-alloc: ok\n");
+    return 0;
+}
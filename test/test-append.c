@@ -0,0 +1,193 @@
+/**
+ * Concurrent append test: writers put variable length records while the
+ * reader seals and takes slots, every record must arrive whole, once and
+ * in its writer's order.
+ *
+ *   make test-c
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "test.h"
+
+#define WRITERS 4
+#define RECORDS 20000
+#define CAP 1024
+
+// record: len (1), writer (1), seq (4), payload, sum (1)
+#define HEADER 6
+#define MIN_RECORD (HEADER + 1)
+#define MAX_RECORD 64
+
+static buf_append_t *ap;
+
+static uint8_t
+record_byte(int writer, uint32_t seq, size_t i)
+{
+    return (uint8_t)(writer * 31 + seq * 7 + i);
+}
+
+static size_t
+record_len(int writer, uint32_t seq)
+{
+    return MIN_RECORD + (writer + seq * 13) % (MAX_RECORD - MIN_RECORD + 1);
+}
+
+static void *
+writer(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    uint8_t rec[MAX_RECORD];
+    uint32_t seq;
+
+    for (seq = 0; seq < RECORDS; seq++) {
+        size_t len = record_len(id, seq);
+        uint8_t sum = 0;
+        size_t i;
+
+        rec[0] = (uint8_t)len;
+        rec[1] = (uint8_t)id;
+        memcpy(rec + 2, &seq, 4);
+        for (i = HEADER; i < len - 1; i++)
+            rec[i] = record_byte(id, seq, i);
+        for (i = 0; i < len - 1; i++)
+            sum += rec[i];
+        rec[len - 1] = sum;
+
+        // full until the reader takes, retry
+        while (buf_append_put(ap, rec, len) != BUF_OK)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static uint32_t next[WRITERS];
+static size_t takes;
+
+// check records of a taken slot, they never span two slots
+static void
+check_slot(buf_t *buf)
+{
+    size_t pos = 0;
+
+    CHECK(buf->size <= CAP);
+
+    while (pos < buf->size) {
+        uint8_t *rec = buf->data + pos;
+        size_t len = rec[0];
+        uint32_t seq;
+        uint8_t sum = 0;
+        int id = rec[1];
+        size_t i;
+
+        CHECK(len >= MIN_RECORD && len <= MAX_RECORD);
+        CHECK(pos + len <= buf->size);
+        CHECK(id < WRITERS);
+        memcpy(&seq, rec + 2, 4);
+        CHECK(seq == next[id]);
+        CHECK(len == record_len(id, seq));
+        for (i = HEADER; i < len - 1; i++)
+            CHECK(rec[i] == record_byte(id, seq, i));
+        for (i = 0; i < len - 1; i++)
+            sum += rec[i];
+        CHECK(rec[len - 1] == sum);
+
+        next[id]++;
+        pos += len;
+    }
+    takes++;
+}
+
+static void
+test_limits(void)
+{
+    buf_append_t *small = buf_append_new(8);
+    buf_t *buf = buf_new(8);
+    uint8_t *data;
+
+    CHECK(buf_append_new(0) == NULL);
+    CHECK(small != NULL && buf != NULL);
+    CHECK(buf_append_put(small, (uint8_t *)"123456789", 9) == BUF_EFAILED);
+    CHECK(buf_append_take(small, buf) == BUF_EFAILED);
+
+    CHECK(buf_append_put(small, (uint8_t *)"12345", 5) == BUF_OK);
+    CHECK(buf_append_peek(small, &data) == 5 && !memcmp(data, "12345", 5));
+    // rotates to the free slot
+    CHECK(buf_append_put(small, (uint8_t *)"6789", 4) == BUF_OK);
+    CHECK(buf_append_peek(small, &data) == 4 && !memcmp(data, "6789", 4));
+    // live slot full, the sealed one not taken
+    CHECK(buf_append_put(small, (uint8_t *)"abcde", 5) == BUF_EFAILED);
+    CHECK(buf_append_seal(small) == BUF_EFAILED);
+
+    CHECK(buf_append_take(small, buf) == BUF_OK);
+    CHECK(buf->size == 5 && !memcmp(buf->data, "12345", 5));
+    CHECK(buf_append_put(small, (uint8_t *)"abcde", 5) == BUF_OK);
+    CHECK(buf_append_take(small, buf) == BUF_OK);
+    CHECK(buf->size == 4 && !memcmp(buf->data, "6789", 4));
+    CHECK(buf_append_seal(small) == BUF_OK);
+    CHECK(buf_append_take(small, buf) == BUF_OK);
+    CHECK(buf->size == 5 && !memcmp(buf->data, "abcde", 5));
+    CHECK(buf_append_take(small, buf) == BUF_EFAILED);
+
+    buf_append_free(small);
+    buf_free(buf);
+}
+
+static void
+test_concurrent(void)
+{
+    pthread_t tids[WRITERS];
+    buf_t *buf = buf_new(CAP);
+    size_t idle = 0;
+    int i;
+
+    ap = buf_append_new(CAP);
+    CHECK(ap != NULL && buf != NULL);
+
+    for (i = 0; i < WRITERS; i++)
+        CHECK(pthread_create(&tids[i], NULL, writer,
+                    (void *)(intptr_t)i) == 0);
+
+    for (;;) {
+        int all = 1;
+
+        for (i = 0; i < WRITERS; i++)
+            all &= next[i] == RECORDS;
+        if (all)
+            break;
+
+        if (buf_append_take(ap, buf) == BUF_OK) {
+            check_slot(buf);
+            continue;
+        }
+        // seal partial slots too, now and then
+        if (++idle % 4 == 0)
+            buf_append_seal(ap);
+        sched_yield();
+    }
+
+    for (i = 0; i < WRITERS; i++)
+        pthread_join(tids[i], NULL);
+
+    // all taken, nothing left
+    CHECK(buf_append_seal(ap) == BUF_OK);
+    CHECK(buf_append_take(ap, buf) == BUF_OK);
+    CHECK(buf->size == 0);
+
+    buf_append_free(ap);
+    buf_free(buf);
+}
+
+int
+main(void)
+{
+    test_limits();
+    test_concurrent();
+    printf("test-append: ok (%zu takes)\n", takes);
+    return 0;
+}
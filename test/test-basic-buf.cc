@@ -0,0 +1,190 @@
+/**
+ * BasicBuf test: inline and heap data, growth policies, fixed length
+ * finds, swaps between inline and heap bufs, and hook allocators kept
+ * with their data. Built as C++98 and C++11.
+ *
+ *   make test-c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "basic_buf.hh"
+#include "test.h"
+
+using namespace buf;
+
+static size_t allocs;
+
+static void *
+counting_alloc(void *ctx, size_t size)
+{
+    (void)ctx;
+    allocs++;
+    return malloc(size);
+}
+
+static void *
+counting_realloc(void *ctx, void *ptr, size_t old, size_t size)
+{
+    (void)ctx;
+    (void)old;
+    return realloc(ptr, size);
+}
+
+static void
+counting_free(void *ctx, void *ptr, size_t size)
+{
+    (void)ctx;
+    (void)size;
+    allocs--;
+    free(ptr);
+}
+
+static buf_allocator_t counting = {
+    counting_alloc, counting_realloc, counting_free, NULL};
+
+template <typename B>
+static bool
+equals(const B &b, const char *s)
+{
+    return b.Size() == strlen(s) && memcmp(b.Data(), s, b.Size()) == 0;
+}
+
+static void
+test_append(void)
+{
+    BasicBuf<SystemAllocator, DoublingGrowth, 8> b;
+
+    CHECK(b.IsInline() && b.Empty() && b.Capacity() == 8);
+    CHECK(b.Append("key=", 4) && b.Append('v') && b.IsInline());
+    CHECK(b.Append("alue", 4) && !b.IsInline());
+    CHECK(b.Capacity() == 32 && equals(b, "key=value"));
+
+    uint8_t *p = b.Prepare(100);
+    CHECK(p == b.Data() + 9 && b.Capacity() == 128);
+    memcpy(p, "!", 1);
+    b.Commit(1);
+    CHECK(equals(b, "key=value!"));
+
+    CHECK(b.Consume(4) == 4 && equals(b, "value!"));
+    CHECK(b.Consume(100) == 6 && b.Empty());
+    CHECK(!b.Reserve(BUF_MAX_SIZE + 1));
+    CHECK(b.Append('x') && b.Prepare(BUF_MAX_SIZE) == NULL);
+
+    b.Reset();
+    CHECK(b.Capacity() == 128);
+    b.Clear();
+    CHECK(b.IsInline() && b.Capacity() == 8);
+
+    BasicBuf<SystemAllocator, ExactGrowth, 0> exact;
+    CHECK(exact.Append("abc", 3) && exact.Capacity() == 3);
+    BasicBuf<SystemAllocator, UnitGrowth<10>, 0> unit;
+    CHECK(unit.Append("abc", 3) && unit.Capacity() == 10);
+    CHECK(unit.Reserve(25) && unit.Capacity() == 30);
+}
+
+static void
+test_find(void)
+{
+    BasicBuf<> b;
+    const char *text = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+    const char *longer = "0123456789abcdefghij";
+
+    CHECK(b.Append(text, strlen(text)));
+    CHECK(b.Find("\r\n") == 14);
+    CHECK(b.Find("\r\n", 15) == 23);
+    CHECK(b.Find("\r\n\r\n") == 23);
+    CHECK(b.Find("") == 0 && b.Find("", 5) == 5);
+    CHECK(b.Find("x") == b.Size());
+    CHECK(b.Find(reinterpret_cast<const uint8_t *>("Host"), 4) == 16);
+    CHECK(b.Find(reinterpret_cast<const uint8_t *>("/"), 1, 5) == 10);
+
+    // long needles take the Horspool finder
+    b.Reset();
+    CHECK(b.Append("xx", 2) && b.Append(longer, strlen(longer)));
+    CHECK(b.Find("0123456789abcdefghij") == 2);
+    CHECK(b.Find("0123456789abcdefghiX") == b.Size());
+}
+
+template <size_t N>
+static void
+test_swap(void)
+{
+    typedef BasicBuf<SystemAllocator, DoublingGrowth, N> B;
+    const char *big = "a heap buf, longer than the inline storage of all "
+        "the capacities tested here";
+    B a, b, c;
+
+    // inline and inline
+    CHECK(a.Append("ab", N >= 2 ? 2 : 0) && b.Append("c", N >= 1 ? 1 : 0));
+    a.Swap(b);
+    CHECK(equals(a, N >= 1 ? "c" : "") && equals(b, N >= 2 ? "ab" : ""));
+
+    // inline and heap
+    CHECK(c.Append(big, strlen(big)) && !c.IsInline());
+    a.Swap(c);
+    CHECK(!a.IsInline() && equals(a, big));
+    CHECK(c.IsInline() && equals(c, N >= 1 ? "c" : ""));
+    c.Swap(a);
+    CHECK(!c.IsInline() && equals(c, big) && equals(a, N >= 1 ? "c" : ""));
+
+    // heap and heap
+    CHECK(a.Append(big, strlen(big)) && !a.IsInline());
+    a.Swap(c);
+    CHECK(c.Size() == (N >= 1 ? 1 : 0) + strlen(big));
+    CHECK(equals(a, big));
+    a.Swap(a);
+    CHECK(equals(a, big));
+}
+
+static void
+test_hooks(void)
+{
+    BasicBuf<HookAllocator, DoublingGrowth, 4> a, b;
+    const char *big = "more than four bytes";
+
+    CHECK(a.GetAllocator().Hooks() == NULL);
+    buf_set_allocator(&counting);
+    CHECK(a.Append(big, strlen(big)) && allocs == 1);
+    CHECK(a.GetAllocator().Hooks() == &counting);
+
+    // a later global allocator doesn't own data already allocated
+    buf_set_allocator(NULL);
+    CHECK(a.Append(big, strlen(big)) && allocs == 1);
+    CHECK(b.Append(big, strlen(big)));
+    CHECK(b.GetAllocator().Hooks() == &buf_system_allocator);
+
+    // hooks go with the data
+    a.Swap(b);
+    CHECK(a.GetAllocator().Hooks() == &buf_system_allocator);
+    CHECK(b.GetAllocator().Hooks() == &counting);
+    b.Clear();
+    CHECK(allocs == 0 && b.GetAllocator().Hooks() == NULL);
+
+#if __cplusplus >= 201103L
+    buf_set_allocator(&counting);
+    BasicBuf<HookAllocator, DoublingGrowth, 4> c;
+    CHECK(c.Append(big, strlen(big)) && allocs == 1);
+    buf_set_allocator(NULL);
+    BasicBuf<HookAllocator, DoublingGrowth, 4> d(
+            static_cast<BasicBuf<HookAllocator, DoublingGrowth, 4> &&>(c));
+    CHECK(d.GetAllocator().Hooks() == &counting && c.IsInline());
+    d = static_cast<BasicBuf<HookAllocator, DoublingGrowth, 4> &&>(a);
+    CHECK(allocs == 0 && d.GetAllocator().Hooks() == &buf_system_allocator);
+#endif
+}
+
+int
+main(void)
+{
+    test_append();
+    test_find();
+    test_swap<0>();
+    test_swap<1>();
+    test_swap<8>();
+    test_swap<64>();
+    test_hooks();
+    printf("test-basic-buf: ok (%ld)\n", (long)__cplusplus);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * Gap buffer test: after mid-buffer edits leave a gap, the public
+ * functions must see the same bytes as on a flat buf. Replacements
+ * pointing into the buf being edited are kept whole.
+ *
+ *   make test-c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "buf.h"
+#include "test.h"
+
+// "abcdef" with "X" inserted at 2, the gap is left after "abX"
+static buf_t *
+gapped(void)
+{
+    buf_t *buf = buf_new(16);
+
+    CHECK(buf != NULL);
+    CHECK(buf_puts(buf, "abcdef") == BUF_OK);
+    CHECK(buf_insert(buf, 2, (uint8_t *)"X", 1) == BUF_OK);
+    CHECK(buf->gaplen > 0 && buf->gap == 3);
+    return buf;
+}
+
+static void
+test_put_str(void)
+{
+    buf_t *buf = gapped();
+
+    CHECK(buf_puts(buf, "Z") == BUF_OK);
+    CHECK(buf->gaplen == 0);
+    CHECK(strcmp(buf_str(buf), "abXcdefZ") == 0);
+    buf_free(buf);
+
+    buf = gapped();
+    CHECK(strcmp(buf_str(buf), "abXcdef") == 0);
+    CHECK(buf_putc(buf, 'Z') == BUF_OK);
+    CHECK(buf_sprintf(buf, "%d", 12) == BUF_OK);
+    CHECK(buf_equals(buf, "abXcdefZ12"));
+    buf_free(buf);
+
+    // put bytes of the buf itself, after the gap
+    buf = gapped();
+    CHECK(buf_put(buf, buf_at(buf, 4), 3) == BUF_OK);
+    CHECK(buf_equals(buf, "abXcdefdef"));
+    buf_free(buf);
+}
+
+static void
+test_cmp(void)
+{
+    buf_t *buf = gapped();
+
+    CHECK(buf_cmp(buf, "abXcdef") == 0);
+    CHECK(buf_cmp(buf, "abXcdeg") < 0);
+    CHECK(buf_cmp(buf, "abXb") > 0);
+    CHECK(buf_cmp(buf, "abXcdefg") < 0);
+    CHECK(buf_equals(buf, "abXcdef") && !buf_equals(buf, "abcdef"));
+    CHECK(buf_startswith(buf, "abXc") && !buf_startswith(buf, "abc"));
+    CHECK(buf_endswith(buf, "Xcdef") && !buf_endswith(buf, "bcdef"));
+    CHECK(buf_casecmp(buf, "ABxCDEF") == 0);
+    CHECK(buf_casecmp(buf, "ABxCDEG") < 0);
+    CHECK(buf_caseequals(buf, "ABXCDEF"));
+    CHECK(buf_casestartswith(buf, "ABXC"));
+    CHECK(buf_caseendswith(buf, "xCDEF"));
+    // reads do not move the gap
+    CHECK(buf->gaplen > 0 && buf->gap == 3);
+
+    buf_upper(buf);
+    CHECK(buf_equals(buf, "ABXCDEF"));
+    buf_lower(buf);
+    CHECK(buf_equals(buf, "abxcdef"));
+    CHECK(buf->gaplen > 0);
+    buf_free(buf);
+}
+
+static void
+test_rm_search(void)
+{
+    buf_t *buf = gapped();
+
+    CHECK(buf_rrm(buf, 2) == 2);
+    CHECK(buf_equals(buf, "abXcd"));
+    CHECK(buf_rrm(buf, 3) == 3);
+    CHECK(buf->gaplen == 0 && buf_equals(buf, "ab"));
+    buf_free(buf);
+
+    buf = gapped();
+    CHECK(buf_lrm(buf, 3) == 3);
+    CHECK(buf_equals(buf, "cdef"));
+    buf_free(buf);
+
+    buf = gapped();
+    CHECK(buf_indexs(buf, "Xc", 0) == 2);
+    CHECK(buf_indexc(buf, 'd', 0) == 4);
+    CHECK(buf_caseindexs(buf, "xCD", 0) == 2);
+    CHECK(buf_count(buf, (uint8_t *)"c", 1) == 1);
+    buf_free(buf);
+
+    buf = gapped();
+    CHECK(buf_countc(buf, 'X') == 1);
+    buf_reverse(buf);
+    CHECK(buf_equals(buf, "fedcXba"));
+    buf_free(buf);
+}
+
+static void
+test_replace_alias(void)
+{
+    buf_t *buf = buf_new(8);
+    buf_t *out = buf_new(4);
+    size_t count;
+
+    // forward, the replacement is overwritten by the first match
+    CHECK(buf != NULL && out != NULL);
+    CHECK(buf_puts(buf, "xyzABxyz") == BUF_OK);
+    CHECK(buf_replace(buf, (uint8_t *)"xyz", 3, buf->data + 3, 2,
+                (size_t)-1, &count) == BUF_OK);
+    CHECK(count == 2 && buf_equals(buf, "ABABAB"));
+
+    // backward, the grow frees the replacement
+    buf_clear(buf);
+    CHECK(buf_puts(buf, "aXbX") == BUF_OK && buf->cap == 8);
+    CHECK(buf_replace(buf, (uint8_t *)"X", 1, buf->data, 3, (size_t)-1,
+                &count) == BUF_OK);
+    CHECK(count == 2 && buf_equals(buf, "aaXbbaXb"));
+
+    // into a buf the replacement points into
+    CHECK(buf_puts(out, "ab") == BUF_OK && out->cap == 4);
+    CHECK(buf_replace_into(out, buf, (uint8_t *)"X", 1, out->data, 2,
+                (size_t)-1, &count) == BUF_OK);
+    CHECK(count == 2 && buf_equals(out, "abaaabbbaabb"));
+    buf_free(out);
+    buf_free(buf);
+}
+
+int
+main(void)
+{
+    test_put_str();
+    test_cmp();
+    test_rm_search();
+    test_replace_alias();
+    printf("test-gap: ok\n");
+    return 0;
+}
@@ -0,0 +1,20 @@
+/**
+ * Checks for the c tests, a failure prints where and exits.
+ */
+
+#ifndef __BUF_TEST_H
+#define __BUF_TEST_H 1
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(expr)                                                         \
+    do {                                                                    \
+        if (!(expr)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,          \
+                    __LINE__, #expr);                                       \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
+
+#endif